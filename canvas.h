@@ -6,6 +6,41 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+/* POSIX.1-2001 interfaces (ftruncate, fseeko, ...) are only declared when the C
+   library exposes them: always on Apple, and on glibc unless a strict -std=c99/c11
+   hides them (add -D_POSIX_C_SOURCE=200112L to get them back). */
+#if defined(__APPLE__) || (defined(__unix__) && defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L)
+#define CANVAS__POSIX 1
+#endif
+
+#if !defined(CANVAS_NO_MMAP) && defined(CANVAS__POSIX)
+/* Define CANVAS_NO_MMAP to keep every writer on plain stdio. */
+#define CANVAS_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif /* CANVAS_HAS_MMAP */
+
+#if defined(CANVAS_FRAME_RING) && defined(CANVAS_HAS_MMAP)
+/* Define CANVAS_FRAME_RING to build the shared-memory frame ring. It uses
+   shm_open, which needs -lrt on glibc older than 2.34. Without it, or without
+   mmap, frame_ring_create and frame_ring_open return NULL. */
+#define CANVAS_HAS_FRAME_RING 1
+#endif /* CANVAS_HAS_FRAME_RING */
+
+#if defined(CANVAS_THREADS) && !defined(_WIN32)
+/* Define CANVAS_THREADS to a worker count (e.g. -DCANVAS_THREADS=8 -pthread)
+   to split blurs and other bulk passes across pthreads. Without it, or on
+   Windows, the same work runs on the calling thread. */
+#define CANVAS_HAS_THREADS 1
+#include <pthread.h>
+#define CANVAS__WORKERS (CANVAS_THREADS > 1 ? CANVAS_THREADS : 1)
+#else
+#define CANVAS__WORKERS 1
+#endif /* CANVAS_HAS_THREADS */
+
 #ifndef CANVASDEF
 /*
    Define CANVASDEF before including this file to control function linkage.
@@ -16,6 +51,10 @@
 #define CANVASDEF
 #endif /* CANVASDEF */
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     size_t x, y, w, h;
 } Rectangle;
@@ -46,17 +85,407 @@ CANVASDEF void canvas_rect_fill(Canvas *c, Rectangle rec, uint32_t color);
 CANVASDEF void canvas_circle(Canvas *c, int cx, int cy, int r, uint32_t color);
 CANVASDEF void canvas_circle_fill(Canvas *c, int cx, int cy, int r, uint32_t color);
 
+/* Anti-aliased variants with analytic coverage, no supersampling. Pixel (x, y)
+   covers [x, x + 1) x [y, y + 1), so integer + 0.5 is a pixel centre. Edge
+   pixels blend the colour at their coverage (times its alpha); fully covered
+   interior spans are plain fills. canvas_circle_aa draws a 1px wide ring. */
+CANVASDEF void canvas_line_aa(Canvas *c, float x0, float y0, float x1, float y1, uint32_t color);
+CANVASDEF void canvas_circle_aa(Canvas *c, float cx, float cy, float r, uint32_t color);
+CANVASDEF void canvas_circle_fill_aa(Canvas *c, float cx, float cy, float r, uint32_t color);
+
 CANVASDEF void canvas_triangle(Canvas *c, int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
 CANVASDEF void canvas_triangle_fill(Canvas *c, int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
 
+typedef struct {
+    float x, y;
+} Vector2;
+
+typedef enum {
+    FILL_NONZERO = 0,
+    FILL_EVEN_ODD
+} FillRule;
+
+/* Fills `contours` closed contours; contour i is the next counts[i] points.
+   A pixel is inside when its centre is. Coordinates are clamped to +-2^26.
+   Returns -1 if the edge table cannot be allocated. */
+CANVASDEF int canvas_polygon_fill(Canvas *c, const Vector2 *points, const size_t *counts, size_t contours, FillRule rule, uint32_t color);
+
+/* Paints fill spans with something other than a single colour: linear or
+   radial gradients through a CANVAS_GRADIENT_LUT-entry colour ramp, or a
+   pattern canvas repeated in both directions. Like the plain fills they
+   overwrite pixels rather than blend. */
+#ifndef CANVAS_GRADIENT_LUT
+#define CANVAS_GRADIENT_LUT 1024    // ramp entries, must be a power of two
+#endif
+
+typedef enum {
+    PAINT_SOLID = 0,
+    PAINT_LINEAR,
+    PAINT_RADIAL,
+    PAINT_PATTERN
+} PaintType;
+
+// what a gradient does past its end points
+typedef enum {
+    SPREAD_PAD = 0,
+    SPREAD_REPEAT,
+    SPREAD_REFLECT
+} PaintSpread;
+
+typedef struct {
+    float offset;       // 0..1 along the gradient, non-decreasing across stops
+    uint32_t color;
+} GradientStop;
+
+typedef struct {
+    PaintType type;
+    PaintSpread spread;
+    uint32_t color;             // PAINT_SOLID
+    float x0, y0, x1, y1;       // linear: start and end point; radial: centre in x0, y0
+    float radius;               // radial
+    const Canvas *pattern;      // PAINT_PATTERN, pixel (0, 0) lands on (x0, y0)
+    uint32_t lut[CANVAS_GRADIENT_LUT];
+} Paint;
+
+CANVASDEF void paint_solid(Paint *p, uint32_t color);
+CANVASDEF int paint_linear(Paint *p, float x0, float y0, float x1, float y1, const GradientStop *stops, size_t count, PaintSpread spread);
+CANVASDEF int paint_radial(Paint *p, float cx, float cy, float radius, const GradientStop *stops, size_t count, PaintSpread spread);
+CANVASDEF void paint_pattern(Paint *p, const Canvas *pattern, int x, int y);
+
+CANVASDEF void canvas_hline_paint(Canvas *c, int x0, int x1, int y, const Paint *p);
+CANVASDEF void canvas_rect_fill_paint(Canvas *c, Rectangle rec, const Paint *p);
+CANVASDEF int canvas_polygon_fill_paint(Canvas *c, const Vector2 *points, const size_t *counts, size_t contours, FillRule rule, const Paint *p);
+
+/* Thick strokes and rounded shapes. Like polygons they cover the pixels whose
+   centres fall inside, and every covered row span is filled exactly once,
+   top to bottom. Strokes are the union of convex pieces (segments, joins and
+   caps) filled with the non-zero rule; ellipses, annuli and rounded
+   rectangles are generated row by row. Ellipse strokes are the area between
+   the ellipses grown and shrunk by half the width; rounded rectangle strokes
+   stay inside `rec`. canvas_polyline returns -1 if the outline cannot be
+   allocated. */
+#ifndef CANVAS_MITER_LIMIT
+#define CANVAS_MITER_LIMIT 4.0f     // longest miter, in line widths, before it becomes a bevel
+#endif
+
+typedef enum {
+    CAP_BUTT = 0,   // ends exactly at the end points
+    CAP_SQUARE,     // extends half the width past them
+    CAP_ROUND
+} LineCap;
+
+typedef enum {
+    JOIN_MITER = 0,
+    JOIN_BEVEL,
+    JOIN_ROUND
+} LineJoin;
+
+CANVASDEF int canvas_thick_line(Canvas *c, float x0, float y0, float x1, float y1, float width, LineCap cap, uint32_t color);
+CANVASDEF int canvas_polyline(Canvas *c, const Vector2 *points, size_t count, int closed, float width, LineCap cap, LineJoin join, uint32_t color);
+CANVASDEF void canvas_ellipse(Canvas *c, float cx, float cy, float rx, float ry, float width, uint32_t color);
+CANVASDEF void canvas_ellipse_fill(Canvas *c, float cx, float cy, float rx, float ry, uint32_t color);
+CANVASDEF void canvas_annulus(Canvas *c, float cx, float cy, float r_inner, float r_outer, uint32_t color);
+CANVASDEF void canvas_rounded_rect(Canvas *c, Rectangle rec, float radius, float width, uint32_t color);
+CANVASDEF void canvas_rounded_rect_fill(Canvas *c, Rectangle rec, float radius, uint32_t color);
+
+/* Shaded triangles. Every vertex attribute is interpolated linearly across the
+   triangle (screen-space, no perspective correction) and stepped in fixed point
+   along each span. Coverage follows the polygon rule (pixel centres inside, top
+   and left edges included), so meshes that share edges fill every pixel once.
+   Pixels are overwritten, alpha included, like the other fills.
+   Gouraud triangles interpolate the vertex colours; textured ones sample the
+   texture at (u, v), where 0..1 spans the image, and multiply it by the
+   interpolated colour (white vertices leave the texture untouched). With a
+   depth buffer a pixel is drawn only if its depth is less than the stored one,
+   which it then replaces; z is clamped to 0..1. Both return -1 if the depth
+   buffer or texture is unusable. */
+typedef struct {
+    float x, y;
+    float z;            // depth, 0 = near, 1 = far
+    float u, v;         // texture coordinates
+    uint32_t color;     // 0xRRGGBBAA
+} Vertex;
+
+typedef enum {
+    TEXTURE_NEAREST = 0,
+    TEXTURE_BILINEAR
+} TextureFilter;
+
+typedef enum {
+    TEXTURE_WRAP = 0,   // repeat outside 0..1
+    TEXTURE_CLAMP       // extend the edge texels
+} TextureWrap;
+
+typedef struct {
+    const Canvas *image;
+    TextureFilter filter;
+    TextureWrap wrap;
+} Texture;
+
+typedef enum {
+    DEPTH_16 = 0,
+    DEPTH_32
+} DepthFormat;
+
+typedef struct {
+    size_t width, height;
+    DepthFormat format;
+    void *values;       // uint16_t or uint32_t per pixel, row major
+} DepthBuffer;
+
+CANVASDEF int depth_buffer_init(DepthBuffer *d, size_t width, size_t height, DepthFormat format);
+CANVASDEF void depth_buffer_free(DepthBuffer *d);
+CANVASDEF void depth_buffer_clear(DepthBuffer *d);     // everything at the far plane
+
+CANVASDEF int canvas_triangle_gouraud(Canvas *c, const Vertex v[3], DepthBuffer *depth);
+CANVASDEF int canvas_triangle_textured(Canvas *c, const Vertex v[3], const Texture *tex, DepthBuffer *depth);
+
+/* Scanline flood fill. Replaces the region connected to (x, y) whose pixels
+   are within `tolerance` of the seed pixel on every channel. Pending spans
+   live on a fixed-capacity FloodStack; when it fills up, the dropped spans
+   are found again by rescanning the filled area, so memory stays at the
+   stack plus one bit per pixel. Returns -1 if that cannot be allocated. */
+#ifndef CANVAS_FLOOD_STACK
+#define CANVAS_FLOOD_STACK 4096     // spans on the stack canvas_flood_fill allocates
+#endif
+
+typedef enum {
+    FLOOD_4 = 0,    // left, right, up, down
+    FLOOD_8         // diagonals too
+} FloodConnectivity;
+
+typedef struct {
+    size_t x0, x1, y;   // inclusive run of filled pixels
+} FloodSpan;
+
+typedef struct {
+    FloodSpan *spans;
+    size_t capacity, count;
+} FloodStack;
+
+CANVASDEF int flood_stack_init(FloodStack *s, size_t capacity);
+CANVASDEF void flood_stack_free(FloodStack *s);
+CANVASDEF int canvas_flood_fill(Canvas *c, int x, int y, uint32_t color, uint8_t tolerance);
+CANVASDEF int canvas_flood_fill_ex(Canvas *c, int x, int y, uint32_t color, uint8_t tolerance, FloodConnectivity conn, FloodStack *stack);
+
+/* Blurs confined to `region`, which samples its own edge pixels past the
+   border. Both cost the same per pixel for any radius. Channels are blurred
+   independently. Return -1 if the scratch copy cannot be allocated. */
+CANVASDEF int canvas_box_blur(Canvas *c, Rectangle region, int radius);
+CANVASDEF int canvas_gaussian_blur(Canvas *c, Rectangle region, float sigma);
+
+/* Colormaps turn a float scalar field into colours through a 256-entry LUT.
+   Values are normalised between vmin and vmax (logarithmically with
+   COLORMAP_LOG, which needs 0 < vmin < vmax), clamped to the ends of the map,
+   and NaN becomes `nan_color`. */
+#define CANVAS_COLORMAP_SIZE 256
+
+typedef enum {
+    COLORMAP_VIRIDIS = 0,
+    COLORMAP_MAGMA,
+    COLORMAP_INFERNO,
+    COLORMAP_PLASMA,
+    COLORMAP_GRAY
+} ColormapName;
+
+enum {
+    COLORMAP_LOG = 1 << 0,
+    COLORMAP_REVERSE = 1 << 1
+};
+
+typedef struct {
+    uint32_t lut[CANVAS_COLORMAP_SIZE];
+    uint32_t nan_color;
+    uint32_t flags;     // COLORMAP_* bits
+} Colormap;
+
+CANVASDEF void colormap_builtin(Colormap *cm, ColormapName name, uint32_t flags);
+CANVASDEF int colormap_from_stops(Colormap *cm, const GradientStop *stops, size_t count, uint32_t flags);
+CANVASDEF void canvas_colormap_apply(Canvas *c, const float *field, size_t stride, float vmin, float vmax, const Colormap *cm);
+
+/* Density canvases count how many points and line pixels land on each cell,
+   for scatter plots too dense to draw directly. Batches are split across
+   CANVAS_THREADS workers, each counting into a private buffer that is merged
+   at the end (the buffers stay allocated until density_free). Points are
+   floored to cells and anything outside is dropped; counts saturate at
+   UINT32_MAX. Rendering maps the counts through a colormap and leaves
+   empty cells untouched; `scale` replaces the colormap's COLORMAP_LOG flag. */
+typedef enum {
+    DENSITY_LINEAR = 0, // count / max
+    DENSITY_LOG,        // log(1 + count) / log(1 + max)
+    DENSITY_EQ_HIST     // rank of the count among the non-empty cells
+} DensityScale;
+
+typedef struct {
+    size_t width, height;
+    uint32_t *counts;
+    uint32_t **scratch;  // private per-worker counts, allocated on first use; [0] counts in place
+    size_t workers;      // entries in scratch
+} DensityCanvas;
+
+CANVASDEF int density_init(DensityCanvas *d, size_t width, size_t height);
+CANVASDEF void density_free(DensityCanvas *d);
+CANVASDEF void density_clear(DensityCanvas *d);
+CANVASDEF void density_add_point(DensityCanvas *d, float x, float y);
+CANVASDEF void density_add_line(DensityCanvas *d, float x0, float y0, float x1, float y1);
+// segments are point pairs: points[2 * i] to points[2 * i + 1]
+CANVASDEF int density_add_points(DensityCanvas *d, const Vector2 *points, size_t count);
+CANVASDEF int density_add_lines(DensityCanvas *d, const Vector2 *points, size_t segments);
+CANVASDEF int canvas_density_render(Canvas *c, const DensityCanvas *d, DensityScale scale, const Colormap *cm);
+
+/* Canvas comparison for golden images and frame deduplication. canvas_diff
+   returns 1 when some pixel differs by more than `tolerance` on a channel, 0
+   when none does and -1 when the sizes differ; the bounding box and count of
+   those pixels are filled when the pointers are not NULL. Without them it
+   stops at the first difference. canvas_hash is a 64-bit content hash of the
+   size and pixels. PSNR (in dB, over R, G and B) is capped at
+   CANVAS_PSNR_IDENTICAL for identical canvases; SSIM compares luma in 8x8
+   windows placed every 4 pixels, plus a last row and column of windows flush
+   with the right and bottom edges. Both return -1 on a size mismatch. */
+#define CANVAS_PSNR_IDENTICAL 100.0
+
+CANVASDEF int canvas_diff(const Canvas *a, const Canvas *b, uint8_t tolerance, Rectangle *bbox, size_t *count);
+CANVASDEF uint64_t canvas_hash(const Canvas *c);
+CANVASDEF int canvas_psnr(const Canvas *a, const Canvas *b, double *psnr);
+CANVASDEF int canvas_ssim(const Canvas *a, const Canvas *b, double *ssim);
+
+/* Text with the built-in 5x7 ASCII font. Each scale is rasterized once into a
+   coverage atlas that stays cached across calls; the cache is not thread-safe.
+   '\n' starts a new line and anything outside ' '..'~' draws as '?'. The
+   colour's alpha is applied on top of the glyph coverage. Scales are clamped
+   to 1..CANVAS_TEXT_MAX_SCALE, which bounds the atlas size. */
+#define CANVAS_FONT_WIDTH 5
+#define CANVAS_FONT_HEIGHT 7
+#define CANVAS_FONT_ADVANCE 6   // pen advance per character, unscaled
+#define CANVAS_FONT_LINE 9      // baseline-to-baseline distance, unscaled
+#ifndef CANVAS_TEXT_ATLASES
+#define CANVAS_TEXT_ATLASES 4   // number of scales kept in the atlas cache
+#endif
+#ifndef CANVAS_TEXT_MAX_SCALE
+#define CANVAS_TEXT_MAX_SCALE 64    // 95 glyphs of 320x448 coverage bytes (~13.6 MB)
+#endif
+#if CANVAS_TEXT_MAX_SCALE < 1 || CANVAS_TEXT_MAX_SCALE > 13107
+#error "CANVAS_TEXT_MAX_SCALE must be 1..13107: glyph spans are 16-bit"
+#endif
+
+CANVASDEF void canvas_text(Canvas *c, int x, int y, const char *text, int scale, uint32_t color);
+CANVASDEF void canvas_text_measure(const char *text, int scale, int *width, int *height);
+CANVASDEF void canvas_text_cache_free(void);
+
 /* PNG encoder */
+typedef enum {
+    PNG_COLOR_AUTO = 0, // smallest lossless form: palette, gray, gray+alpha, RGB or RGBA
+    PNG_COLOR_RGBA,     // always 8-bit RGBA (colour type 6)
+    PNG_COLOR_INDEXED,  // always palette (colour type 3), quantizing if needed (lossy)
+} PngColorMode;
+
+#define PNG_HASH_SIZE 1024
+
+typedef struct {
+    uint8_t bit_depth;
+    uint8_t color_type;
+    uint32_t palette_size;
+    // 0xRRGGBBAA, entries with alpha < 255 first so tRNS stays short
+    uint32_t palette[256];
+    // open-addressing colour -> palette index + 1 (0 = empty slot)
+    uint32_t hash_keys[PNG_HASH_SIZE];
+    uint16_t hash_vals[PNG_HASH_SIZE];
+    // RGBA4444 -> palette index, only set when the image was quantized
+    uint8_t *quant_lut;
+} PngFormat;
+
 static uint32_t crc32_table[256];
 CANVASDEF void make_crc32_table(void);
 CANVASDEF uint32_t crc32(const uint8_t *buf, size_t len);
 CANVASDEF uint32_t adler32(const uint8_t *data, size_t len);
+CANVASDEF uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len);
 CANVASDEF int write_be32(FILE *f, uint32_t v);
 CANVASDEF int write_chunk(FILE *f, const char type[4], const uint8_t *data, uint32_t len);
+CANVASDEF int png_format_detect(PngFormat *fmt, const uint32_t *pixels, uint32_t width, uint32_t height, PngColorMode mode);
+CANVASDEF void png_format_free(PngFormat *fmt);
 CANVASDEF int write_png_from_rgba32(const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height);
+CANVASDEF int write_png_from_rgba32_ex(const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height, PngColorMode mode);
+
+/* Row-oriented PNG output: each stored deflate block goes out as its own IDAT,
+   so only one row and one 64K block are ever held in memory. */
+typedef struct {
+    FILE *f;
+    const PngFormat *fmt;
+    uint32_t width, height;
+    uint32_t rows_written;
+    uint8_t *row;       // packed scanline, filter byte first
+    size_t row_bytes;
+    uint8_t *block;     // IDAT payload being assembled
+    size_t block_len;   // stored bytes in the current block
+    uint64_t raw_left;  // scanline bytes not yet added to a block
+    uint32_t adler;
+    int first;          // zlib header still to be written
+} PngStream;
+
+CANVASDEF int png_stream_begin(PngStream *s, const char *filename, uint32_t width, uint32_t height, const PngFormat *fmt);
+CANVASDEF int png_stream_write_row(PngStream *s, const uint32_t *row);
+CANVASDEF int png_stream_end(PngStream *s);
+
+/* Animated PNG: only the rectangle that changed since the previous frame is stored */
+typedef struct {
+    FILE *f;
+    uint32_t width, height;
+    uint16_t fps;
+    uint32_t num_frames;
+    uint32_t sequence;  // fcTL/fdAT sequence number
+    long actl_pos;      // patched with the frame count in apng_end
+    long fctl_pos;      // last fcTL, its delay grows while frames repeat
+    uint8_t fctl[26];
+    uint32_t *prev;     // previous frame, to diff against
+} ApngWriter;
+
+CANVASDEF ApngWriter *apng_start(const char *filename, size_t width, size_t height, int fps);
+CANVASDEF int apng_write_frame(ApngWriter *w, const Canvas *c);
+CANVASDEF int apng_end(ApngWriter *w);
+
+/* PNG export queue: frames are encoded and written by CANVAS_THREADS workers
+   while the caller keeps rendering. png_export_submit blocks while the
+   pixels of queued and in-progress jobs would exceed `max_bytes` (a job
+   larger than the budget runs alone). The callback, if any, runs on the
+   worker that finished the job. Without threads every job is written inside
+   png_export_submit. png_export_wait and png_export_end return -1 if a job
+   failed since the previous wait. */
+typedef enum {
+    PNG_EXPORT_COPY = 0,    // the queue copies the pixels, the buffer is free again on return
+    PNG_EXPORT_BORROW,      // the caller keeps the buffer unchanged until the job's callback
+    PNG_EXPORT_TAKE         // the queue free()s the buffer once the job is done
+} PngExportOwnership;
+
+typedef void (*PngExportCallback)(void *user, const char *filename, int result);
+
+typedef struct canvas__PngJob canvas__PngJob;
+
+typedef struct {
+    PngColorMode mode;
+    PngExportCallback callback;
+    void *user;
+    size_t max_bytes, bytes;    // in-flight pixel budget and current use
+    size_t pending;             // submitted jobs not finished yet
+    int failed;                 // a job failed since the last wait
+#ifdef CANVAS_HAS_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // broadcast on every queue or counter change
+    pthread_t threads[CANVAS__WORKERS];
+    size_t workers;             // 0 if none could be started: submit writes inline
+    int stopping;
+    canvas__PngJob *head, *tail;
+#endif // CANVAS_HAS_THREADS
+} PngExportQueue;
+
+CANVASDEF PngExportQueue *png_export_start(size_t max_bytes, PngColorMode mode, PngExportCallback callback, void *user);
+CANVASDEF int png_export_submit(PngExportQueue *q, const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height, PngExportOwnership ownership);
+CANVASDEF int png_export_wait(PngExportQueue *q);
+CANVASDEF int png_export_end(PngExportQueue *q);
+
+#ifndef CANVAS_Y4M_WINDOW
+// size of the file window y4m_start_mapped keeps mapped (and grows the file by)
+#define CANVAS_Y4M_WINDOW (64u << 20)
+#endif
 
 typedef struct {
     FILE *f;
@@ -64,13 +493,135 @@ typedef struct {
     uint8_t *y_plane;
     uint8_t *u_plane;
     uint8_t *v_plane;
+    // y4m_start_mapped: frames are converted straight into a mapped window of the file
+    int fd;
+    uint8_t *map;       // NULL when writing through stdio
+    uint64_t map_off;   // file offset of the window, page aligned
+    size_t map_len;
+    uint64_t pos;       // bytes written so far
+    uint64_t reserved;  // current file size
+    int failed;         // set once a mapped write failed, later frames are dropped
 } Y4MWriter;
 
 
 CANVASDEF Y4MWriter *y4m_start(const char *filename, size_t width, size_t height, int fps);
+CANVASDEF Y4MWriter *y4m_start_mapped(const char *filename, size_t width, size_t height, int fps, size_t frames);
 CANVASDEF void y4m_write_frame(Y4MWriter *w, const Canvas *c);
 CANVASDEF void y4m_end(Y4MWriter *w);
 
+/* YUV4MPEG2 input: 8-bit 444, 422, 420 (any siting) and mono streams. Regular files are
+   mapped and the plane pointers point straight into the mapping; pipes and other
+   streams read each frame with one block read into a reused buffer. Planes are tightly
+   packed: y is width x height, u and v are chroma_width x chroma_height (NULL for mono),
+   and stay valid until the next y4m_read_frame or y4m_close. */
+typedef enum {
+    Y4M_444,
+    Y4M_422,
+    Y4M_420,
+    Y4M_MONO,
+} Y4MChroma;
+
+typedef struct {
+    size_t width, height;
+    size_t chroma_width, chroma_height;
+    Y4MChroma chroma;
+    int fps_num, fps_den;
+    const uint8_t *y, *u, *v;   // current frame
+    size_t frame_bytes;         // all planes of one frame
+    size_t frames;              // frames read so far
+    FILE *f;                    // streamed input, NULL when mapped
+    int close_f;                // f was opened by y4m_open
+    uint8_t *buf;               // streamed frame data
+    const uint8_t *map;         // mapped file, NULL when streamed
+    size_t map_len, pos;
+} Y4MReader;
+
+CANVASDEF Y4MReader *y4m_open(const char *filename);
+CANVASDEF Y4MReader *y4m_open_stream(FILE *f);  // e.g. stdin; f stays open after y4m_close
+CANVASDEF int y4m_read_frame(Y4MReader *r);    // 1 = next frame is ready, 0 = end of stream, -1 = error
+CANVASDEF int y4m_frame_to_canvas(const Y4MReader *r, Canvas *c);
+CANVASDEF void y4m_close(Y4MReader *r);
+
+/* Shared-memory frame ring for live preview and IPC (POSIX shm_open + mmap; opt in
+   with CANVAS_FRAME_RING, otherwise and on Windows create/open return NULL).
+   One producer renders straight into a slot and publishes it; any number of consumer
+   processes read published slots in place. Each slot carries a sequence counter that
+   is odd while the producer writes it, so a consumer that was lapped while reading can
+   tell with frame_ring_check and drop the frame. Names follow shm_open: "/name". */
+#ifndef CANVAS_FRAME_RING_MAX_SLOTS
+#define CANVAS_FRAME_RING_MAX_SLOTS 256
+#endif
+
+typedef struct {
+    uint8_t *map;
+    size_t map_len;
+    size_t width, height, slots;
+    size_t slot_bytes;
+    char *name;         // producer only: unlinked again by frame_ring_close
+    int writing;        // producer only: a slot was begun and not yet published
+} FrameRing;
+
+typedef struct {
+    Canvas canvas;      // pixels inside the shared mapping; read-only for consumers
+    uint64_t frame;     // producer frame number, from 0
+    uint64_t seq;       // slot sequence when the frame was taken
+} FrameRingFrame;
+
+CANVASDEF FrameRing *frame_ring_create(const char *name, size_t width, size_t height, size_t slots);
+CANVASDEF FrameRing *frame_ring_open(const char *name);
+CANVASDEF int frame_ring_begin(FrameRing *r, Canvas *out);     // out draws into the next slot (holding an old frame), empty on failure
+CANVASDEF int frame_ring_publish(FrameRing *r);
+CANVASDEF int frame_ring_next(const FrameRing *r, uint64_t *cursor, FrameRingFrame *out);
+CANVASDEF int frame_ring_latest(const FrameRing *r, FrameRingFrame *out);
+CANVASDEF int frame_ring_check(const FrameRing *r, const FrameRingFrame *f);
+CANVASDEF void frame_ring_close(FrameRing *r);
+
+/* Out-of-core tiled canvas for images that do not fit in memory. Tiles are
+   allocated on first write, kept in an LRU cache of `cache_tiles` tiles and
+   spilled to a scratch file when evicted. Coordinates are 64-bit; lines and
+   circles are clipped to the canvas first, so any int64_t ends or radius work. */
+#ifndef CANVAS_TILE_SIZE
+#define CANVAS_TILE_SIZE 256
+#endif
+
+typedef struct {
+    uint32_t *pixels;   // CANVAS_TILE_SIZE^2 pixels, NULL while not resident
+    uint64_t last_use;
+    uint8_t dirty;      // resident copy is newer than the scratch file
+    uint8_t spilled;    // the scratch file holds this tile
+} TiledCanvasTile;
+
+typedef struct {
+    uint64_t width, height;
+    uint64_t tiles_x, tiles_y;
+    uint32_t background;     // colour of tiles that were never drawn to
+    TiledCanvasTile *tiles;
+    uint64_t *resident;      // indices of the resident tiles
+    size_t resident_count, max_resident;
+    uint64_t clock;
+    uint64_t last_index;     // one-entry lookup cache for pixel-at-a-time drawing
+    uint32_t *last_pixels;
+    FILE *scratch;
+    int failed;              // set on allocation or scratch I/O errors
+} TiledCanvas;
+
+// Called per tile with a TILE x TILE canvas whose (0, 0) is image pixel (ox, oy).
+typedef void (*TiledDrawFn)(Canvas *tile, int64_t ox, int64_t oy, void *user);
+
+CANVASDEF TiledCanvas *tiled_canvas_create(uint64_t width, uint64_t height, uint32_t background, size_t cache_tiles);
+CANVASDEF void tiled_canvas_destroy(TiledCanvas *tc);
+CANVASDEF void tiled_clear_background(TiledCanvas *tc, uint32_t color);
+CANVASDEF void tiled_putpixel(TiledCanvas *tc, int64_t x, int64_t y, uint32_t color);
+CANVASDEF uint32_t tiled_getpixel(TiledCanvas *tc, int64_t x, int64_t y, uint32_t fallback);
+CANVASDEF void tiled_hline(TiledCanvas *tc, int64_t x0, int64_t x1, int64_t y, uint32_t color);
+CANVASDEF void tiled_vline(TiledCanvas *tc, int64_t x, int64_t y0, int64_t y1, uint32_t color);
+CANVASDEF void tiled_line(TiledCanvas *tc, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t color);
+CANVASDEF void tiled_rect_fill(TiledCanvas *tc, Rectangle rec, uint32_t color);
+CANVASDEF void tiled_circle_fill(TiledCanvas *tc, int64_t cx, int64_t cy, int64_t r, uint32_t color);
+CANVASDEF void tiled_canvas_draw(TiledCanvas *tc, Rectangle bounds, TiledDrawFn draw, void *user);
+CANVASDEF int tiled_canvas_read_row(TiledCanvas *tc, uint64_t y, uint32_t *row);
+CANVASDEF int tiled_canvas_write_png(TiledCanvas *tc, const char *filename, PngColorMode mode);
+
 #ifdef CANVAS_IMPLEMENTATION
 
 /* ---------- helpers (internal) ---------- */
@@ -85,13 +636,82 @@ CANVASDEF void canvas__swap_int(int *a, int *b) {
     *a = *b;
     *b = t;
 }
+// saturates a size_t coordinate into the int range the primitives take
+CANVASDEF int canvas__clamp_int(size_t v) {
+    return v > 0x7FFFFFFF ? 0x7FFFFFFF : (int)v;
+}
+// clamps to +-lim, mapping NaN to -lim
+CANVASDEF double canvas__clamp_coord(double v, double lim) {
+    if (!(v > -lim)) return -lim;
+    return v > lim ? lim : v;
+}
+CANVASDEF int canvas__ceil_int(double v) {
+    int i = (int)v;
+    return i < v ? i + 1 : i;
+}
+// exact round(x / 255) for x <= 255 * 255
+CANVASDEF uint32_t canvas__div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+// lerps `dst` towards `src` by `a` (0..255); alpha composites source-over
+CANVASDEF uint32_t canvas__blend(uint32_t dst, uint32_t src, uint32_t a) {
+    uint32_t ia = 255 - a;
+    uint32_t r = canvas__div255((src >> 24) * a + (dst >> 24) * ia);
+    uint32_t g = canvas__div255(((src >> 16) & 0xFF) * a + ((dst >> 16) & 0xFF) * ia);
+    uint32_t b = canvas__div255(((src >> 8) & 0xFF) * a + ((dst >> 8) & 0xFF) * ia);
+    uint32_t al = a + canvas__div255((dst & 0xFF) * ia);
+    return (r << 24) | (g << 16) | (b << 8) | al;
+}
+
+// square root without libm: bit-level estimate plus two Newton steps
+CANVASDEF float canvas__sqrtf(float v) {
+    uint32_t bits;
+    float r;
+    if (v <= 0) return 0;
+    memcpy(&bits, &v, sizeof(bits));
+    bits = 0x1FBD1DF5u + (bits >> 1);
+    memcpy(&r, &bits, sizeof(r));
+    r = 0.5f * (r + v / r);
+    return 0.5f * (r + v / r);
+}
+
+// Liang-Barsky against [0, w] x [0, h]; returns 0 when nothing is left
+CANVASDEF int canvas__clip_segment(float *x0, float *y0, float *x1, float *y1, float w, float h) {
+    // rejects NaN and infinities
+    if (!(*x0 - *x0 == 0 && *y0 - *y0 == 0 && *x1 - *x1 == 0 && *y1 - *y1 == 0)) return 0;
+    // in double: far-away ends would otherwise lose the in-canvas part to cancellation
+    double sx = *x0, sy = *y0, dx = *x1 - sx, dy = *y1 - sy;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {sx, w - sx, sy, h - sy};
+    double t0 = 0, t1 = 1;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0) {
+            if (q[i] < 0) return 0;
+            continue;
+        }
+        double r = q[i] / p[i];
+        if (p[i] < 0) {
+            if (r > t1) return 0;
+            if (r > t0) t0 = r;
+        } else {
+            if (r < t0) return 0;
+            if (r < t1) t1 = r;
+        }
+    }
+    *x0 = (float)(sx + t0 * dx);
+    *y0 = (float)(sy + t0 * dy);
+    *x1 = (float)(sx + t1 * dx);
+    *y1 = (float)(sy + t1 * dy);
+    return 1;
+}
 
 CANVASDEF Canvas create_canvas(size_t width, size_t height, uint32_t *pixels) {
-    return (Canvas) {
-        .width = width,
-        .height = height,
-        .pixels = pixels
-    };
+    Canvas c;
+    c.width = width;
+    c.height = height;
+    c.pixels = pixels;
+    return c;
 }
 
 CANVASDEF void free_canvas(Canvas *c) {
@@ -100,11 +720,9 @@ CANVASDEF void free_canvas(Canvas *c) {
 }
 
 CANVASDEF void clear_background(Canvas *c, uint32_t color) {
-    for (size_t y = 0; y < c->height; ++y) {
-        for (size_t x = 0; x < c->width; ++x) {
-            canvas_putpixel(c, (int)x, (int)y, color);
-        }
-    }
+    if (!c || !c->pixels) return;
+    size_t n = c->width * c->height;
+    for (size_t i = 0; i < n; ++i) c->pixels[i] = color;
 }
 
 CANVASDEF int32_t RGB(uint8_t r, uint8_t g, uint8_t b) {
@@ -117,23 +735,23 @@ CANVASDEF int32_t RGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
 
 CANVASDEF void canvas_putpixel(Canvas *c, int x, int y, uint32_t color) {
     if (!c || !c->pixels) return;
-    if (x < 0 || y < 0 || x >= (int)c->width || y >= (int)c->height) return;
+    if (x < 0 || y < 0 || (size_t)x >= c->width || (size_t)y >= c->height) return;
     c->pixels[(size_t)y * c->width + (size_t)x] = color;
 }
 
 CANVASDEF uint32_t canvas_getpixel(const Canvas *c, int x, int y, uint32_t fallback) {
     if (!c || !c->pixels) return fallback;
-    if (x < 0 || y < 0 || x >= (int)c->width || y >= (int)c->height) return fallback;
+    if (x < 0 || y < 0 || (size_t)x >= c->width || (size_t)y >= c->height) return fallback;
     return c->pixels[(size_t)y * c->width + (size_t)x];
 }
 
 CANVASDEF void canvas_hline(Canvas *c, int x0, int x1, int y, uint32_t color) {
     if (!c || !c->pixels) return;
-    if (y < 0 || y >= (int)c->height) return;
+    if (y < 0 || (size_t)y >= c->height) return;
     if (x0 > x1) canvas__swap_int(&x0, &x1);
-    if (x1 < 0 || x0 >= (int)c->width) return;
+    if (x1 < 0 || (x0 >= 0 && (size_t)x0 >= c->width)) return;
     if (x0 < 0) x0 = 0;
-    if (x1 >= (int)c->width) x1 = (int)c->width - 1;
+    if ((size_t)x1 >= c->width) x1 = (int)(c->width - 1);
 
     uint32_t *row = c->pixels + (size_t)y * c->width + (size_t)x0;
     for (int x = x0; x <= x1; ++x) *row++ = color;
@@ -141,11 +759,11 @@ CANVASDEF void canvas_hline(Canvas *c, int x0, int x1, int y, uint32_t color) {
 
 CANVASDEF void canvas_vline(Canvas *c, int x, int y0, int y1, uint32_t color) {
     if (!c || !c->pixels) return;
-    if (x < 0 || x >= (int)c->width) return;
+    if (x < 0 || (size_t)x >= c->width) return;
     if (y0 > y1) canvas__swap_int(&y0, &y1);
-    if (y1 < 0 || y0 >= (int)c->height) return;
+    if (y1 < 0 || (y0 >= 0 && (size_t)y0 >= c->height)) return;
     if (y0 < 0) y0 = 0;
-    if (y1 >= (int)c->height) y1 = (int)c->height - 1;
+    if ((size_t)y1 >= c->height) y1 = (int)(c->height - 1);
 
     uint32_t *p = c->pixels + (size_t)y0 * c->width + (size_t)x;
     for (int y = y0; y <= y1; ++y) {
@@ -156,41 +774,44 @@ CANVASDEF void canvas_vline(Canvas *c, int x, int y0, int y1, uint32_t color) {
 
 CANVASDEF void canvas_line(Canvas *c, int x0, int y0, int x1, int y1, uint32_t color) {
     if (!c || !c->pixels) return;
-    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
+    // 64-bit error terms: differences of far-apart int endpoints overflow int
+    int64_t dx = x1 > x0 ? (int64_t)x1 - x0 : (int64_t)x0 - x1, sx = x0 < x1 ? 1 : -1;
+    int64_t dy = y1 > y0 ? (int64_t)y0 - y1 : (int64_t)y1 - y0, sy = y0 < y1 ? 1 : -1;
+    int64_t err = dx + dy;
     while (1) {
         canvas_putpixel(c, (int)x0, (int)y0, color);
         if (x0 == x1 && y0 == y1) break;
-        int e2 = 2 * err;
+        int64_t e2 = 2 * err;
         if (e2 >= dy) {
             err += dy;
-            x0 += sx;
+            x0 += (int)sx;
         }
         if (e2 <= dx) {
             err += dx;
-            y0 += sy;
+            y0 += (int)sy;
         }
     }
 }
 
 CANVASDEF void canvas_rect(Canvas *c, Rectangle rec, uint32_t color) {
     if (rec.w <= 0 || rec.h <= 0) return;
-    size_t x0 = rec.x, y0 = rec.y, x1 = rec.x + rec.w - 1, y1 = rec.y + rec.h - 1;
-    canvas_hline(c, (int)x0, (int)x1, (int)y0, color);
-    canvas_hline(c, (int)x0, (int)x1, (int)y1, color);
-    canvas_vline(c, (int)x0, (int)y0, (int)y1, color);
-    canvas_vline(c, (int)x1, (int)y0, (int)y1, color);
+    if (rec.x > 0x7FFFFFFF || rec.y > 0x7FFFFFFF) return; // beyond what int coordinates reach
+    size_t right = rec.w - 1 > SIZE_MAX - rec.x ? SIZE_MAX : rec.x + rec.w - 1;
+    size_t bottom = rec.h - 1 > SIZE_MAX - rec.y ? SIZE_MAX : rec.y + rec.h - 1;
+    int x0 = (int)rec.x, y0 = (int)rec.y, x1 = canvas__clamp_int(right), y1 = canvas__clamp_int(bottom);
+    canvas_hline(c, x0, x1, y0, color);
+    if (bottom <= 0x7FFFFFFF) canvas_hline(c, x0, x1, y1, color);
+    canvas_vline(c, x0, y0, y1, color);
+    if (right <= 0x7FFFFFFF) canvas_vline(c, x1, y0, y1, color);
 
 }
 
 CANVASDEF void canvas_rect_fill(Canvas *c, Rectangle rec, uint32_t color) {
     if (!c || !c->pixels || rec.w == 0 || rec.h == 0) return;
-    size_t y_end = rec.y + rec.h;
-    size_t x_end = rec.x + rec.w;
     if (rec.y >= c->height || rec.x >= c->width) return;
-    if (y_end > c->height) y_end = c->height;
-    if (x_end > c->width)  x_end = c->width;
+    // compare against the remaining room instead of summing, which could wrap
+    size_t y_end = rec.h > c->height - rec.y ? c->height : rec.y + rec.h;
+    size_t x_end = rec.w > c->width - rec.x ? c->width : rec.x + rec.w;
 
     for (size_t y = rec.y; y < y_end; ++y) {
         uint32_t *row = c->pixels + y * c->width + rec.x;
@@ -225,18 +846,162 @@ CANVASDEF void canvas_circle_fill(Canvas *c, int cx, int cy, int r, uint32_t col
     if (!c || !c->pixels || r <= 0) return;
     int x = r, y = 0;
     int err = 1 - x;
+    /* Midpoint octant walk, one span per row: row cy +- y is x wide when first
+       reached, and row cy +- x is as wide as the last y before x steps in.
+       The two only meet at x == y, where both widths agree. */
     while (x >= y) {
-        /* draw spans across symmetrical rows */
-        canvas_hline(c, cx - x, cx + x, cy + y, color);
-        canvas_hline(c, cx - x, cx + x, cy - y, color);
-        canvas_hline(c, cx - y, cx + y, cy + x, color);
-        canvas_hline(c, cx - y, cx + y, cy - x, color);
+        if (y < x) {
+            canvas_hline(c, cx - x, cx + x, cy + y, color);
+            if (y > 0) canvas_hline(c, cx - x, cx + x, cy - y, color);
+        }
+        int last_x = x, last_y = y;
         ++y;
         if (err < 0) err += 2 * y + 1;
         else {
             --x;
             err += 2 * (y - x) + 1;
         }
+        if (x != last_x || x < y) {
+            canvas_hline(c, cx - last_y, cx + last_y, cy + last_x, color);
+            canvas_hline(c, cx - last_y, cx + last_y, cy - last_x, color);
+        }
+    }
+}
+
+/* ---------- anti-aliased primitives ---------- */
+CANVASDEF int canvas__floor_int(float v) {
+    int i = (int)v;
+    return i > v ? i - 1 : i;
+}
+
+// blends `color` over one pixel at `coverage` (0..1) of its alpha
+CANVASDEF void canvas__plot_aa(Canvas *c, int x, int y, uint32_t color, float coverage) {
+    if (x < 0 || y < 0 || (size_t)x >= c->width || (size_t)y >= c->height || coverage <= 0) return;
+    if (coverage > 1) coverage = 1;
+    uint32_t a = (uint32_t)(coverage * (float)(color & 0xFF) + 0.5f);
+    uint32_t *p = c->pixels + (size_t)y * c->width + (size_t)x;
+    if (a) *p = canvas__blend(*p, color, a);
+}
+
+// fully covered run x0..x1 (inclusive, unclipped): a plain fill unless the colour is translucent
+CANVASDEF void canvas__span_aa(Canvas *c, int x0, int x1, int y, uint32_t color) {
+    uint32_t a = color & 0xFF;
+    if (a == 255 || x0 > x1) {
+        canvas_hline(c, x0, x1, y, color);
+        return;
+    }
+    if (y < 0 || (size_t)y >= c->height || x1 < 0 || (x0 >= 0 && (size_t)x0 >= c->width) || a == 0) return;
+    if (x0 < 0) x0 = 0;
+    if ((size_t)x1 >= c->width) x1 = (int)(c->width - 1);
+    uint32_t *p = c->pixels + (size_t)y * c->width;
+    for (int x = x0; x <= x1; ++x) p[x] = canvas__blend(p[x], color, a);
+}
+
+CANVASDEF void canvas_line_aa(Canvas *c, float x0, float y0, float x1, float y1, uint32_t color) {
+    if (!c || !c->pixels) return;
+    // clip with one pixel of margin, then move pixel centres onto integers for Wu's algorithm
+    x0 += 1, y0 += 1, x1 += 1, y1 += 1;
+    if (!canvas__clip_segment(&x0, &y0, &x1, &y1, (float)c->width + 2, (float)c->height + 2)) return;
+    x0 -= 1.5f, y0 -= 1.5f, x1 -= 1.5f, y1 -= 1.5f;
+    float adx = x1 > x0 ? x1 - x0 : x0 - x1, ady = y1 > y0 ? y1 - y0 : y0 - y1;
+    int steep = ady > adx;
+    float t;
+    if (steep) {
+        t = x0, x0 = y0, y0 = t;
+        t = x1, x1 = y1, y1 = t;
+    }
+    if (x0 > x1) {
+        t = x0, x0 = x1, x1 = t;
+        t = y0, y0 = y1, y1 = t;
+    }
+    float dx = x1 - x0;
+    float gradient = dx > 0 ? (y1 - y0) / dx : 1.0f;
+
+    // each end covers the part of its pixel the segment actually reaches
+    int xs = canvas__floor_int(x0 + 0.5f), xe = canvas__floor_int(x1 + 0.5f);
+    float ys = y0 + gradient * ((float)xs - x0), ye = y1 + gradient * ((float)xe - x1);
+    float gap_s = (float)xs + 0.5f - x0, gap_e = x1 + 0.5f - (float)xe;
+    if (xs == xe) gap_s = gap_e = x1 - x0; // both ends in one column
+    for (int x = xs; x <= xe; ++x) {
+        float y = x == xe ? ye : ys + gradient * (float)(x - xs);
+        float gap = x == xs ? gap_s : x == xe ? gap_e : 1.0f;
+        int iy = canvas__floor_int(y);
+        float f = y - (float)iy;
+        if (steep) {
+            canvas__plot_aa(c, iy, x, color, (1 - f) * gap);
+            canvas__plot_aa(c, iy + 1, x, color, f * gap);
+        } else {
+            canvas__plot_aa(c, x, iy, color, (1 - f) * gap);
+            canvas__plot_aa(c, x, iy + 1, color, f * gap);
+        }
+    }
+}
+
+// rows of the canvas a disc of radius `reach` around cy can touch, or 0 when none
+CANVASDEF int canvas__aa_rows(const Canvas *c, float cy, float reach, int *y0, int *y1) {
+    float top = cy - reach, bottom = cy + reach;
+    if (!(bottom >= 0 && top < (float)c->height)) return 0;
+    *y0 = top > 0 ? (int)top : 0;
+    *y1 = bottom < (float)c->height - 1 ? (int)bottom : (int)c->height - 1;
+    return 1;
+}
+
+// keeps a column within one pixel of the canvas so it converts to int safely
+CANVASDEF float canvas__aa_clamp(const Canvas *c, float x) {
+    return x > -1 ? (x < (float)c->width ? x : (float)c->width) : -1;
+}
+
+// pixels whose centres lie within [lo, hi] of cx: first is *x0, last is *x1
+CANVASDEF void canvas__aa_inside(const Canvas *c, float cx, float lo, float hi, int *x0, int *x1) {
+    *x0 = canvas__ceil_int(canvas__aa_clamp(c, cx + lo - 0.5f));
+    *x1 = canvas__floor_int(canvas__aa_clamp(c, cx + hi - 0.5f));
+}
+
+CANVASDEF void canvas_circle_aa(Canvas *c, float cx, float cy, float r, uint32_t color) {
+    if (!c || !c->pixels || !(r > 0) || cx != cx) return;
+    int y0, y1;
+    if (!canvas__aa_rows(c, cy, r + 1, &y0, &y1)) return;
+    // a one pixel wide ring: coverage falls off linearly with the distance from the radius
+    for (int y = y0; y <= y1; ++y) {
+        float dy = (float)y + 0.5f - cy, dy2 = dy * dy;
+        float outer = canvas__sqrtf((r + 1) * (r + 1) - dy2);
+        float inner = r > 1 && (r - 1) * (r - 1) > dy2 ? canvas__sqrtf((r - 1) * (r - 1) - dy2) : 0;
+        // centres inside the inner arc are at least a pixel from the radius
+        int h0 = 0, h1 = -1;
+        if (inner > 0) canvas__aa_inside(c, cx, -inner, inner, &h0, &h1);
+        int x0 = canvas__floor_int(canvas__aa_clamp(c, cx - outer - 0.5f));
+        int x1 = canvas__ceil_int(canvas__aa_clamp(c, cx + outer - 0.5f));
+        for (int x = x0; x <= x1; ++x) {
+            if (x == h0 && h0 <= h1) x = h1 + 1;
+            float dx = (float)x + 0.5f - cx;
+            float d = canvas__sqrtf(dx * dx + dy2) - r;
+            canvas__plot_aa(c, x, y, color, 1 - (d < 0 ? -d : d));
+        }
+    }
+}
+
+CANVASDEF void canvas_circle_fill_aa(Canvas *c, float cx, float cy, float r, uint32_t color) {
+    if (!c || !c->pixels || !(r > 0) || cx != cx) return;
+    int y0, y1;
+    if (!canvas__aa_rows(c, cy, r + 0.5f, &y0, &y1)) return;
+    // coverage is r + 0.5 - distance: pixels at most r - 0.5 away are full and take the plain fill
+    float ri = r - 0.5f;
+    for (int y = y0; y <= y1; ++y) {
+        float dy = (float)y + 0.5f - cy, dy2 = dy * dy;
+        float outer = canvas__sqrtf((r + 0.5f) * (r + 0.5f) - dy2);
+        int s0 = 0, s1 = -1;
+        if (ri > 0 && ri * ri >= dy2) {
+            float inner = canvas__sqrtf(ri * ri - dy2);
+            canvas__aa_inside(c, cx, -inner, inner, &s0, &s1);
+            canvas__span_aa(c, s0, s1, y, color);
+        }
+        int x0 = canvas__floor_int(canvas__aa_clamp(c, cx - outer - 0.5f));
+        int x1 = canvas__ceil_int(canvas__aa_clamp(c, cx + outer - 0.5f));
+        for (int x = x0; x <= x1; ++x) {
+            if (x == s0 && s0 <= s1) x = s1 + 1;
+            float dx = (float)x + 0.5f - cx;
+            canvas__plot_aa(c, x, y, color, r + 0.5f - canvas__sqrtf(dx * dx + dy2));
+        }
     }
 }
 
@@ -322,272 +1087,4094 @@ CANVASDEF void canvas_triangle_fill(Canvas *c, int x0, int y0, int x1, int y1, i
     }
 }
 
-CANVASDEF void make_crc32_table(void) {
-    for (uint32_t i = 0; i < 256; ++i) {
-        uint32_t c = i;
-        for (int k = 0; k < 8; ++k) {
-            if (c & 1) c = 0xEDB88320U ^ (c >> 1);
-            else       c = c >> 1;
-        }
-        crc32_table[i] = c;
-    }
+/* ---------- paints ---------- */
+CANVASDEF void paint_solid(Paint *p, uint32_t color) {
+    memset(p, 0, sizeof(*p));
+    p->type = PAINT_SOLID;
+    p->color = color;
 }
 
-CANVASDEF uint32_t crc32(const uint8_t *buf, size_t len) {
-    uint32_t c = 0xFFFFFFFFU;
-    for (size_t i = 0; i < len; ++i)
-        c = crc32_table[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
-    return c ^ 0xFFFFFFFFU;
+CANVASDEF void paint_pattern(Paint *p, const Canvas *pattern, int x, int y) {
+    memset(p, 0, sizeof(*p));
+    p->type = PAINT_PATTERN;
+    p->pattern = pattern;
+    p->x0 = (float)x;
+    p->y0 = (float)y;
 }
 
-CANVASDEF uint32_t adler32(const uint8_t *data, size_t len) {
-    const uint32_t MOD_ADLER = 65521U;
-    uint32_t a = 1, b = 0;
-    for (size_t i = 0; i < len; ++i) {
-        a = (a + data[i]) % MOD_ADLER;
-        b = (b + a) % MOD_ADLER;
+// entry i of an n-entry ramp samples the gradient at (i + 0.5) / n, or at
+// i / (n - 1) when `ends` asks for the first and last entries to be exact
+CANVASDEF int canvas__gradient_lut(uint32_t *lut, size_t n, int ends, const GradientStop *stops, size_t count) {
+    if (!stops || count == 0) return -1;
+    for (size_t i = 1; i < count; ++i) {
+        if (!(stops[i].offset >= stops[i - 1].offset)) return -1;
     }
-    return (b << 16) | a;
+    size_t s = 0;
+    for (size_t i = 0; i < n; ++i) {
+        float t = ends ? (float)i / (float)(n - 1) : ((float)i + 0.5f) / (float)n;
+        while (s < count && stops[s].offset <= t) ++s;
+        if (s == 0) {
+            lut[i] = stops[0].color;
+        } else if (s == count) {
+            lut[i] = stops[count - 1].color;
+        } else {
+            const GradientStop *a = &stops[s - 1], *b = &stops[s];
+            uint32_t w = (uint32_t)((t - a->offset) / (b->offset - a->offset) * 255.0f + 0.5f);
+            uint32_t color = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t ca = (a->color >> shift) & 0xFF, cb = (b->color >> shift) & 0xFF;
+                color |= canvas__div255(ca * (255 - w) + cb * w) << shift;
+            }
+            lut[i] = color;
+        }
+    }
+    return 0;
 }
 
-CANVASDEF int write_be32(FILE *f, uint32_t v) {
-    uint8_t b[4];
-    b[0] = (v >> 24) & 0xFF;
-    b[1] = (v >> 16) & 0xFF;
-    b[2] = (v >> 8) & 0xFF;
-    b[3] = v & 0xFF;
-    return (fwrite(b, 1, 4, f) == 4) ? 0 : -1;
+CANVASDEF int paint_linear(Paint *p, float x0, float y0, float x1, float y1, const GradientStop *stops, size_t count, PaintSpread spread) {
+    memset(p, 0, sizeof(*p));
+    if (canvas__gradient_lut(p->lut, CANVAS_GRADIENT_LUT, 0, stops, count) != 0) return -1;
+    p->type = PAINT_LINEAR;
+    p->spread = spread;
+    p->x0 = x0;
+    p->y0 = y0;
+    p->x1 = x1;
+    p->y1 = y1;
+    return 0;
 }
 
-CANVASDEF int write_chunk(FILE *f, const char type[4], const uint8_t *data, uint32_t len) {
-    if (write_be32(f, len) != 0) return -1;
-    if (fwrite(type, 1, 4, f) != 4) return -1;
-    if (len > 0 && fwrite(data, 1, len, f) != len) return -1;
-
-    // compute CRC over type + data
-    uint8_t *crc_buf = (uint8_t*)malloc(4 + len);
-    if (!crc_buf) return -1;
-    memcpy(crc_buf, type, 4);
-    if (len) memcpy(crc_buf + 4, data, len);
-    uint32_t crc = crc32(crc_buf, 4 + len);
-    free(crc_buf);
-
-    if (write_be32(f, crc) != 0) return -1;
+CANVASDEF int paint_radial(Paint *p, float cx, float cy, float radius, const GradientStop *stops, size_t count, PaintSpread spread) {
+    memset(p, 0, sizeof(*p));
+    if (!(radius > 0) || canvas__gradient_lut(p->lut, CANVAS_GRADIENT_LUT, 0, stops, count) != 0) return -1;
+    p->type = PAINT_RADIAL;
+    p->spread = spread;
+    p->x0 = cx;
+    p->y0 = cy;
+    p->radius = radius;
     return 0;
 }
 
-CANVASDEF int write_png_from_rgba32(const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height) {
-    if (!filename || !pixels || width == 0 || height == 0) return -1;
-#if defined(_MSC_VER)
-    FILE *f = NULL;
-    if (fopen_s(&f, filename, "wb") != 0 || !f) {
-        perror("Cannot open file");
-        return -1;
+// maps a possibly out-of-range ramp index according to the spread mode
+CANVASDEF uint32_t canvas__ramp(const Paint *p, int64_t i) {
+    const int64_t n = CANVAS_GRADIENT_LUT;
+    switch (p->spread) {
+    case SPREAD_REPEAT:
+        return p->lut[i & (n - 1)];
+    case SPREAD_REFLECT:
+        i &= 2 * n - 1;
+        return p->lut[i < n ? i : 2 * n - 1 - i];
+    default:
+        return p->lut[i < 0 ? 0 : i >= n ? n - 1 : i];
     }
-#else
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        perror("Cannot open file");
-        return -1;
+}
+
+// writes pixels x0..x1 (inclusive, already clipped) of row y
+CANVASDEF void canvas__paint_span(Canvas *c, int x0, int x1, int y, const Paint *p) {
+    uint32_t *dst = c->pixels + (size_t)y * c->width + (size_t)x0;
+    size_t n = (size_t)(x1 - x0) + 1;
+    const double scale = CANVAS_GRADIENT_LUT;
+    switch (p->type) {
+    case PAINT_LINEAR: {
+        // t is linear in x, so the 16.16 ramp position steps by a constant
+        double dx = (double)p->x1 - p->x0, dy = (double)p->y1 - p->y0;
+        double len2 = dx * dx + dy * dy;
+        if (!(len2 > 1e-12)) len2 = 1e-12;
+        double t = (((double)x0 + 0.5 - p->x0) * dx + ((double)y + 0.5 - p->y0) * dy) / len2;
+        // bounded so that u cannot overflow over a span of up to 2^31 pixels
+        int64_t u = (int64_t)canvas__clamp_coord(t * scale * 65536.0, 1125899906842624.0);
+        int64_t du = (int64_t)canvas__clamp_coord(dx / len2 * scale * 65536.0, 2147483648.0);
+        if (p->spread == SPREAD_PAD) {
+            const int64_t last = CANVAS_GRADIENT_LUT - 1;
+            for (size_t i = 0; i < n; ++i, u += du) {
+                int64_t k = u >> 16;
+                dst[i] = p->lut[k < 0 ? 0 : k > last ? last : k];
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i, u += du) dst[i] = canvas__ramp(p, u >> 16);
+        }
+        break;
     }
-#endif
+    case PAINT_RADIAL: {
+        // squared ramp position by forward differences, one square root per pixel
+        double k = scale / p->radius;
+        double px = ((double)x0 + 0.5 - p->x0) * k, py = ((double)y + 0.5 - p->y0) * k;
+        double q = px * px + py * py;
+        double dq = 2.0 * px * k + k * k, ddq = 2.0 * k * k;
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = canvas__ramp(p, (int64_t)canvas__sqrtf((float)(q < 1e30 ? q : 1e30)));
+            q += dq;
+            dq += ddq;
+        }
+        break;
+    }
+    case PAINT_PATTERN: {
+        const Canvas *pat = p->pattern;
+        if (!pat || !pat->pixels || pat->width == 0 || pat->height == 0) return;
+        int64_t sy = ((int64_t)y - (int64_t)p->y0) % (int64_t)pat->height;
+        int64_t sx = ((int64_t)x0 - (int64_t)p->x0) % (int64_t)pat->width;
+        if (sy < 0) sy += (int64_t)pat->height;
+        if (sx < 0) sx += (int64_t)pat->width;
+        const uint32_t *src = pat->pixels + (size_t)sy * pat->width;
+        // copy whole runs of the pattern row; memmove because the pattern may be the target itself
+        while (n > 0) {
+            size_t run = pat->width - (size_t)sx;
+            if (run > n) run = n;
+            memmove(dst, src + sx, run * sizeof(uint32_t));
+            dst += run;
+            n -= run;
+            sx = 0;
+        }
+        break;
+    }
+    default:
+        for (size_t i = 0; i < n; ++i) dst[i] = p->color;
+        break;
+    }
+}
 
+CANVASDEF void canvas_hline_paint(Canvas *c, int x0, int x1, int y, const Paint *p) {
+    if (!c || !c->pixels || !p) return;
+    if (y < 0 || (size_t)y >= c->height) return;
+    if (x0 > x1) canvas__swap_int(&x0, &x1);
+    if (x1 < 0 || (x0 >= 0 && (size_t)x0 >= c->width)) return;
+    if (x0 < 0) x0 = 0;
+    if ((size_t)x1 >= c->width) x1 = (int)(c->width - 1);
+    canvas__paint_span(c, x0, x1, y, p);
+}
 
-    make_crc32_table();
+CANVASDEF void canvas_rect_fill_paint(Canvas *c, Rectangle rec, const Paint *p) {
+    if (!c || !c->pixels || !p || rec.w == 0 || rec.h == 0) return;
+    if (rec.y >= c->height || rec.x >= c->width) return;
+    size_t y_end = rec.h > c->height - rec.y ? c->height : rec.y + rec.h;
+    size_t x_end = rec.w > c->width - rec.x ? c->width : rec.x + rec.w;
+    for (size_t y = rec.y; y < y_end; ++y)
+        canvas__paint_span(c, (int)rec.x, (int)(x_end - 1), (int)y, p);
+}
 
-    // PNG signature
-    const uint8_t png_sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
-    if (fwrite(png_sig, 1, 8, f) != 8) goto fail;
+/* ---------- polygons ---------- */
+typedef struct {
+    int64_t x;      // 32.32 fixed-point crossing at the current scanline centre
+    int64_t dx;     // change of x per scanline
+    int y0, y1;     // first and one-past-last scanline
+    int winding;
+} canvas__Edge;
 
-    // ---- IHDR chunk data (13 bytes) ----
-    uint8_t ihdr[13];
-    ihdr[0] = (width >> 24) & 0xFF;
-    ihdr[1] = (width >> 16) & 0xFF;
-    ihdr[2] = (width >> 8) & 0xFF;
-    ihdr[3] = width & 0xFF;
-    ihdr[4] = (height >> 24) & 0xFF;
-    ihdr[5] = (height >> 16) & 0xFF;
-    ihdr[6] = (height >> 8) & 0xFF;
-    ihdr[7] = height & 0xFF;
-    ihdr[8] = 8;    // bit depth
-    ihdr[9] = 6;    // color type = 6 (RGBA)
-    ihdr[10] = 0;   // compression
-    ihdr[11] = 0;   // filter
-    ihdr[12] = 0;   // interlace
+CANVASDEF int canvas__edge_cmp(const void *a, const void *b) {
+    const canvas__Edge *ea = (const canvas__Edge *)a, *eb = (const canvas__Edge *)b;
+    return (ea->y0 > eb->y0) - (ea->y0 < eb->y0);
+}
 
-    if (write_chunk(f, "IHDR", ihdr, 13) != 0) goto fail;
+// the span kernel shared by polygons and the shapes built on them: pixels x0..x1 of row y, already clipped
+CANVASDEF void canvas__fill_span(Canvas *c, int x0, int x1, int y, const Paint *paint, uint32_t color) {
+    if (paint) {
+        canvas__paint_span(c, x0, x1, y, paint);
+    } else {
+        uint32_t *row = c->pixels + (size_t)y * c->width;
+        for (int x = x0; x <= x1; ++x) row[x] = color;
+    }
+}
 
-    // ---- Create raw scanline data: each row: [filter=0][R][G][B][A] * width ----
-    // raw_size = height * (1 + width*4)
-    size_t row_bytes = 1 + (size_t)width * 4;
-    size_t raw_size = (size_t)height * row_bytes;
+CANVASDEF int canvas__polygon_fill(Canvas *c, const Vector2 *points, const size_t *counts, size_t contours, FillRule rule, const Paint *paint, uint32_t color) {
+    if (!c || !c->pixels || !points || !counts) return 0;
+    if (c->width == 0 || c->height == 0) return 0;
+    const double lim = 67108864.0;  // 2^26 keeps stepped 32.32 x values inside int64
+    const int height = canvas__clamp_int(c->height);
+    size_t total = 0;
+    for (size_t i = 0; i < contours; ++i) total += counts[i];
+    if (total == 0) return 0;
 
-    uint8_t *raw = (uint8_t*)malloc(raw_size);
-    if (!raw) {
-        perror("malloc raw");
-        goto fail;
+    canvas__Edge *edges = (canvas__Edge *)malloc(total * sizeof(canvas__Edge));
+    canvas__Edge **active = (canvas__Edge **)malloc(total * sizeof(canvas__Edge *));
+    if (!edges || !active) {
+        free(edges);
+        free(active);
+        return -1;
     }
-    for (uint32_t y = 0; y < height; ++y) {
+
+    // edge table: every non-horizontal edge that crosses a scanline centre
+    size_t n = 0;
+    const Vector2 *contour = points;
+    for (size_t i = 0; i < contours; contour += counts[i], ++i) {
+        if (counts[i] < 2) continue;
+        for (size_t k = 0; k < counts[i]; ++k) {
+            Vector2 a = contour[k], b = contour[k + 1 < counts[i] ? k + 1 : 0];
+            double ax = canvas__clamp_coord(a.x, lim), ay = canvas__clamp_coord(a.y, lim);
+            double bx = canvas__clamp_coord(b.x, lim), by = canvas__clamp_coord(b.y, lim);
+            int winding = 1;
+            if (ay == by) continue;
+            if (ay > by) {
+                double t = ax; ax = bx; bx = t;
+                t = ay; ay = by; by = t;
+                winding = -1;
+            }
+            // scanline y samples at y + 0.5; the edge owns [ay, by)
+            int y0 = canvas__ceil_int(canvas__clamp_coord(ay - 0.5, 1.0 + height));
+            int y1 = canvas__ceil_int(canvas__clamp_coord(by - 0.5, 1.0 + height));
+            if (y0 < 0) y0 = 0;
+            if (y1 > height) y1 = height;
+            if (y0 >= y1) continue;
+            double slope = canvas__clamp_coord((bx - ax) / (by - ay), lim);
+            double x = canvas__clamp_coord(ax + ((double)y0 + 0.5 - ay) * slope, lim);
+            edges[n].x = (int64_t)(x * 4294967296.0);
+            edges[n].dx = (int64_t)(slope * 4294967296.0);
+            edges[n].y0 = y0;
+            edges[n].y1 = y1;
+            edges[n].winding = winding;
+            ++n;
+        }
+    }
+    qsort(edges, n, sizeof(canvas__Edge), canvas__edge_cmp);
+
+    const int64_t half = (int64_t)1 << 31;
+    const int64_t max_x = (int64_t)canvas__clamp_int(c->width) - 1;
+    size_t next = 0, count = 0;
+    int y = n ? edges[0].y0 : height;
+    while (y < height) {
+        // drop finished edges, skip empty scanlines, then pick up the edges starting here
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (active[i]->y1 > y) active[kept++] = active[i];
+        }
+        count = kept;
+        if (count == 0) {
+            if (next == n) break;
+            y = edges[next].y0;
+        }
+        while (next < n && edges[next].y0 == y) active[count++] = &edges[next++];
+        // insertion sort by x: the order barely changes between scanlines
+        for (size_t i = 1; i < count; ++i) {
+            canvas__Edge *e = active[i];
+            size_t j = i;
+            while (j > 0 && active[j - 1]->x > e->x) {
+                active[j] = active[j - 1];
+                --j;
+            }
+            active[j] = e;
+        }
+        // walk crossings left to right; each run of inside-ness is one span
+        int wind = 0;
+        int64_t span_start = 0;
+        for (size_t i = 0; i < count; ++i) {
+            int was_inside = rule == FILL_EVEN_ODD ? (wind & 1) : wind != 0;
+            wind += active[i]->winding;
+            int inside = rule == FILL_EVEN_ODD ? (wind & 1) : wind != 0;
+            // first pixel whose centre is at or right of the crossing
+            int64_t px = (active[i]->x - half + ((int64_t)1 << 32) - 1) >> 32;
+            if (!was_inside && inside) {
+                span_start = px;
+            } else if (was_inside && !inside) {
+                int64_t x0 = span_start < 0 ? 0 : span_start;
+                int64_t x1 = px - 1 > max_x ? max_x : px - 1;
+                if (x0 > x1) continue;
+                canvas__fill_span(c, (int)x0, (int)x1, y, paint, color);
+            }
+        }
+        for (size_t i = 0; i < count; ++i) active[i]->x += active[i]->dx;
+        ++y;
+    }
+
+    free(edges);
+    free(active);
+    return 0;
+}
+
+CANVASDEF int canvas_polygon_fill(Canvas *c, const Vector2 *points, const size_t *counts, size_t contours, FillRule rule, uint32_t color) {
+    return canvas__polygon_fill(c, points, counts, contours, rule, NULL, color);
+}
+
+CANVASDEF int canvas_polygon_fill_paint(Canvas *c, const Vector2 *points, const size_t *counts, size_t contours, FillRule rule, const Paint *p) {
+    if (!p) return 0;
+    return canvas__polygon_fill(c, points, counts, contours, rule, p, 0);
+}
+
+/* ---------- strokes and rounded shapes ---------- */
+// Ellipse (r = 0) or rounded rectangle: centre, half extents and corner radius.
+typedef struct {
+    float cx, cy, hx, hy, r;
+    int ellipse;
+} canvas__Round;
+
+// Pixels of row y whose centres are inside the shape, or 0 when the row misses it.
+CANVASDEF int canvas__round_span(const canvas__Round *s, const Canvas *c, int y, int *x0, int *x1) {
+    float dy = (float)y + 0.5f - s->cy;
+    float ady = dy < 0 ? -dy : dy;
+    float hw;
+    if (s->hx <= 0 || s->hy <= 0) return 0;
+    if (dy < -s->hy || dy >= s->hy) return 0;
+    if (s->ellipse) {
+        float t = ady / s->hy;
+        hw = s->hx * canvas__sqrtf(1 - t * t);
+    } else if (ady <= s->hy - s->r) {
+        hw = s->hx;
+    } else {
+        float e = ady - (s->hy - s->r);
+        hw = s->hx - s->r + canvas__sqrtf(s->r * s->r - e * e);
+    }
+    // centres in [cx - hw, cx + hw), the same rule as canvas_polygon_fill
+    double lim = (double)c->width + 1;
+    *x0 = canvas__ceil_int(canvas__clamp_coord((double)s->cx - hw - 0.5, lim));
+    *x1 = canvas__ceil_int(canvas__clamp_coord((double)s->cx + hw - 0.5, lim)) - 1;
+    return *x0 <= *x1;
+}
+
+// Fills `outer` minus `inner` (when not NULL): one pass down the rows, at most two spans each.
+CANVASDEF void canvas__fill_round(Canvas *c, const canvas__Round *outer, const canvas__Round *inner, const Paint *paint, uint32_t color) {
+    if (!c || !c->pixels || c->width == 0 || c->height == 0) return;
+    if (!(outer->hx > 0 && outer->hy > 0) || outer->cx != outer->cx || outer->cy != outer->cy) return;
+    double lim = (double)c->height + 1;
+    int y0 = canvas__ceil_int(canvas__clamp_coord((double)outer->cy - outer->hy - 0.5, lim));
+    int y1 = canvas__ceil_int(canvas__clamp_coord((double)outer->cy + outer->hy - 0.5, lim));
+    if (y0 < 0) y0 = 0;
+    if (y1 > (int)c->height) y1 = (int)c->height;
+    const int max_x = canvas__clamp_int(c->width) - 1;
+    for (int y = y0; y < y1; ++y) {
+        int o0, o1, i0, i1;
+        if (!canvas__round_span(outer, c, y, &o0, &o1)) continue;
+        if (o0 < 0) o0 = 0;
+        if (o1 > max_x) o1 = max_x;
+        if (inner && canvas__round_span(inner, c, y, &i0, &i1)) {
+            if (o0 <= i0 - 1) canvas__fill_span(c, o0, canvas__imin(i0 - 1, o1), y, paint, color);
+            if (i1 + 1 <= o1) canvas__fill_span(c, canvas__imax(i1 + 1, o0), o1, y, paint, color);
+        } else if (o0 <= o1) {
+            canvas__fill_span(c, o0, o1, y, paint, color);
+        }
+    }
+}
+
+CANVASDEF canvas__Round canvas__ellipse_shape(float cx, float cy, float rx, float ry) {
+    canvas__Round s;
+    s.cx = cx;
+    s.cy = cy;
+    s.hx = rx;
+    s.hy = ry;
+    s.r = 0;
+    s.ellipse = 1;
+    return s;
+}
+
+// rec inset by d on every side, its corner radius shrinking to match
+CANVASDEF canvas__Round canvas__rounded_rect_shape(Rectangle rec, float radius, float d) {
+    canvas__Round s;
+    s.hx = (float)rec.w * 0.5f - d;
+    s.hy = (float)rec.h * 0.5f - d;
+    s.cx = (float)rec.x + (float)rec.w * 0.5f;
+    s.cy = (float)rec.y + (float)rec.h * 0.5f;
+    s.r = radius - d;
+    if (!(s.r > 0)) s.r = 0;
+    if (s.r > s.hx) s.r = s.hx;
+    if (s.r > s.hy) s.r = s.hy;
+    s.ellipse = 0;
+    return s;
+}
+
+CANVASDEF void canvas_ellipse_fill(Canvas *c, float cx, float cy, float rx, float ry, uint32_t color) {
+    canvas__Round s = canvas__ellipse_shape(cx, cy, rx, ry);
+    canvas__fill_round(c, &s, NULL, NULL, color);
+}
+
+CANVASDEF void canvas_ellipse(Canvas *c, float cx, float cy, float rx, float ry, float width, uint32_t color) {
+    if (!(width > 0)) return;
+    float h = width * 0.5f;
+    canvas__Round outer = canvas__ellipse_shape(cx, cy, rx + h, ry + h);
+    canvas__Round inner = canvas__ellipse_shape(cx, cy, rx - h, ry - h);
+    canvas__fill_round(c, &outer, &inner, NULL, color);
+}
+
+CANVASDEF void canvas_annulus(Canvas *c, float cx, float cy, float r_inner, float r_outer, uint32_t color) {
+    canvas__Round outer = canvas__ellipse_shape(cx, cy, r_outer, r_outer);
+    canvas__Round inner = canvas__ellipse_shape(cx, cy, r_inner, r_inner);
+    canvas__fill_round(c, &outer, &inner, NULL, color);
+}
+
+CANVASDEF void canvas_rounded_rect_fill(Canvas *c, Rectangle rec, float radius, uint32_t color) {
+    canvas__Round s = canvas__rounded_rect_shape(rec, radius, 0);
+    canvas__fill_round(c, &s, NULL, NULL, color);
+}
+
+CANVASDEF void canvas_rounded_rect(Canvas *c, Rectangle rec, float radius, float width, uint32_t color) {
+    if (!(width > 0)) return;
+    canvas__Round outer = canvas__rounded_rect_shape(rec, radius, 0);
+    canvas__Round inner = canvas__rounded_rect_shape(rec, radius, width);
+    canvas__fill_round(c, &outer, &inner, NULL, color);
+}
+
+#define CANVAS__ARC_MAX 1024
+
+// vertices for a circle of radius r that strays at most 0.1px from the true arc
+CANVASDEF size_t canvas__arc_steps(float r) {
+    float step = 2 * canvas__sqrtf(0.2f / r);  // chord error r * (1 - cos(step / 2))
+    float n = 6.2831853f / step;
+    if (!(n < CANVAS__ARC_MAX)) return CANVAS__ARC_MAX;
+    return n < 8 ? 8 : (size_t)n + 1;
+}
+
+CANVASDEF void canvas__circle_points(Vector2 *out, size_t n, float cx, float cy, float r) {
+    // rotate (r, 0) by 2pi/n each step; sin and cos of at most pi/4 from their series
+    double t = 6.283185307179586 / (double)n, t2 = t * t;
+    double cs = 1 - t2 / 2 * (1 - t2 / 12 * (1 - t2 / 30 * (1 - t2 / 56)));
+    double sn = t * (1 - t2 / 6 * (1 - t2 / 20 * (1 - t2 / 42 * (1 - t2 / 72))));
+    double x = r, y = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[i].x = cx + (float)x;
+        out[i].y = cy + (float)y;
+        double nx = x * cs - y * sn;
+        y = x * sn + y * cs;
+        x = nx;
+    }
+}
+
+typedef struct {
+    Vector2 *points;
+    size_t *counts;
+    size_t n_points, n_contours;
+} canvas__Outline;
+
+// closes the contour started at `first`, flipping it so every piece winds the same way
+CANVASDEF void canvas__outline_close(canvas__Outline *o, size_t first) {
+    Vector2 *p = o->points + first;
+    size_t n = o->n_points - first;
+    double area = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Vector2 a = p[i], b = p[i + 1 < n ? i + 1 : 0];
+        area += (double)a.x * b.y - (double)b.x * a.y;
+    }
+    if (area < 0) {
+        for (size_t i = 0; i < n / 2; ++i) {
+            Vector2 t = p[i];
+            p[i] = p[n - 1 - i];
+            p[n - 1 - i] = t;
+        }
+    }
+    o->counts[o->n_contours++] = n;
+}
+
+CANVASDEF void canvas__outline_point(canvas__Outline *o, float x, float y) {
+    o->points[o->n_points].x = x;
+    o->points[o->n_points].y = y;
+    o->n_points++;
+}
+
+CANVASDEF void canvas__outline_circle(canvas__Outline *o, Vector2 at, float r, size_t steps) {
+    size_t first = o->n_points;
+    canvas__circle_points(o->points + first, steps, at.x, at.y, r);
+    o->n_points += steps;
+    canvas__outline_close(o, first);
+}
+
+CANVASDEF int canvas_polyline(Canvas *c, const Vector2 *points, size_t count, int closed, float width, LineCap cap, LineJoin join, uint32_t color) {
+    if (!c || !c->pixels || !points || count == 0 || !(width > 0)) return 0;
+    const float hw = width * 0.5f;
+    const size_t steps = canvas__arc_steps(hw);
+    // every piece is convex: 4 points per segment and square cap, at most `steps` per join or round cap
+    size_t per_piece = steps > 4 ? steps : 4;
+    size_t pieces = 2 * count + 2;
+    canvas__Outline o;
+    o.points = (Vector2 *)malloc(pieces * per_piece * sizeof(Vector2));
+    o.counts = (size_t *)malloc(pieces * sizeof(size_t));
+    o.n_points = o.n_contours = 0;
+    int *keep = (int *)malloc(count * sizeof(int));
+    if (!o.points || !o.counts || !keep) {
+        free(o.points);
+        free(o.counts);
+        free(keep);
+        return -1;
+    }
+
+    // drop repeated points so every segment has a direction
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (n == 0 || points[i].x != points[keep[n - 1]].x || points[i].y != points[keep[n - 1]].y) keep[n++] = (int)i;
+    }
+    if (closed && n > 1 && points[keep[0]].x == points[keep[n - 1]].x && points[keep[0]].y == points[keep[n - 1]].y) --n;
+    if (n < 3) closed = 0;
+
+    if (n == 1) {
+        // a single point: a dot for round caps, a square for square caps
+        Vector2 p = points[keep[0]];
+        if (cap == CAP_ROUND) canvas__outline_circle(&o, p, hw, steps);
+        if (cap == CAP_SQUARE) {
+            canvas__outline_point(&o, p.x - hw, p.y - hw);
+            canvas__outline_point(&o, p.x + hw, p.y - hw);
+            canvas__outline_point(&o, p.x + hw, p.y + hw);
+            canvas__outline_point(&o, p.x - hw, p.y + hw);
+            canvas__outline_close(&o, 0);
+        }
+    }
+    size_t segments = n < 2 ? 0 : closed ? n : n - 1;
+    for (size_t i = 0; i < segments; ++i) {
+        Vector2 a = points[keep[i]], b = points[keep[(i + 1) % n]];
+        float dx = b.x - a.x, dy = b.y - a.y;
+        float len = canvas__sqrtf(dx * dx + dy * dy);
+        if (!(len > 0)) continue;
+        dx /= len;
+        dy /= len;
+        float nx = -dy * hw, ny = dx * hw;
+        if (!closed && cap == CAP_SQUARE) {
+            if (i == 0) a.x -= dx * hw, a.y -= dy * hw;
+            if (i == segments - 1) b.x += dx * hw, b.y += dy * hw;
+        }
+        size_t first = o.n_points;
+        canvas__outline_point(&o, a.x + nx, a.y + ny);
+        canvas__outline_point(&o, b.x + nx, b.y + ny);
+        canvas__outline_point(&o, b.x - nx, b.y - ny);
+        canvas__outline_point(&o, a.x - nx, a.y - ny);
+        canvas__outline_close(&o, first);
+
+        // join with the next segment on the outside of the turn
+        if (!closed && i == segments - 1) break;
+        Vector2 v = points[keep[(i + 1) % n]], next = points[keep[(i + 2) % n]];
+        float ex = next.x - v.x, ey = next.y - v.y;
+        float elen = canvas__sqrtf(ex * ex + ey * ey);
+        if (!(elen > 0)) continue;
+        ex /= elen;
+        ey /= elen;
+        float cross = dx * ey - dy * ex, dot = dx * ex + dy * ey;
+        if (join == JOIN_ROUND) {
+            canvas__outline_circle(&o, v, hw, steps);
+            continue;
+        }
+        if (cross == 0 && dot > 0) continue;   // straight on
+        float side = cross > 0 ? -1.0f : 1.0f;
+        float ax = v.x + side * nx, ay = v.y + side * ny;
+        float bx = v.x + side * -ey * hw, by = v.y + side * ex * hw;
+        first = o.n_points;
+        canvas__outline_point(&o, v.x, v.y);
+        canvas__outline_point(&o, ax, ay);
+        // miter tip along the bisector, hw / cos(half the turn) out, unless that is too far
+        float half_cos = canvas__sqrtf((1 + dot) * 0.5f);
+        if (join == JOIN_MITER && half_cos * CANVAS_MITER_LIMIT > 1) {
+            float mx = ax + bx - 2 * v.x, my = ay + by - 2 * v.y;
+            float mlen = canvas__sqrtf(mx * mx + my * my);
+            float reach = hw / half_cos;
+            canvas__outline_point(&o, v.x + mx / mlen * reach, v.y + my / mlen * reach);
+        }
+        canvas__outline_point(&o, bx, by);
+        canvas__outline_close(&o, first);
+    }
+    if (!closed && n > 1 && cap == CAP_ROUND) {
+        canvas__outline_circle(&o, points[keep[0]], hw, steps);
+        canvas__outline_circle(&o, points[keep[n - 1]], hw, steps);
+    }
+
+    // the non-zero union of the pieces covers every pixel once, row by row
+    int rc = canvas__polygon_fill(c, o.points, o.counts, o.n_contours, FILL_NONZERO, NULL, color);
+    free(o.points);
+    free(o.counts);
+    free(keep);
+    return rc;
+}
+
+CANVASDEF int canvas_thick_line(Canvas *c, float x0, float y0, float x1, float y1, float width, LineCap cap, uint32_t color) {
+    Vector2 ends[2];
+    ends[0].x = x0;
+    ends[0].y = y0;
+    ends[1].x = x1;
+    ends[1].y = y1;
+    return canvas_polyline(c, ends, 2, 0, width, cap, JOIN_MITER, color);
+}
+
+/* ---------- shaded triangles ---------- */
+#define CANVAS__TRI_ATTRS 7     // r, g, b, a, u, v (in texels, Q16), z (Q32)
+
+CANVASDEF int depth_buffer_init(DepthBuffer *d, size_t width, size_t height, DepthFormat format) {
+    memset(d, 0, sizeof(*d));
+    d->values = malloc((width * height + 1) * (format == DEPTH_16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+    if (!d->values) return -1;
+    d->width = width;
+    d->height = height;
+    d->format = format;
+    depth_buffer_clear(d);
+    return 0;
+}
+
+CANVASDEF void depth_buffer_free(DepthBuffer *d) {
+    free(d->values);
+    memset(d, 0, sizeof(*d));
+}
+
+CANVASDEF void depth_buffer_clear(DepthBuffer *d) {
+    if (d->values) memset(d->values, 0xFF, d->width * d->height * (d->format == DEPTH_16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+}
+
+typedef struct {
+    Canvas *c;
+    const Texture *tex;
+    DepthBuffer *depth;
+    int modulate;               // any vertex colour other than opaque white
+    double ox, oy;              // vertex 0, where the planes are anchored
+    double a[CANVAS__TRI_ATTRS], dx[CANVAS__TRI_ATTRS], dy[CANVAS__TRI_ATTRS];
+} canvas__Tri;
+
+CANVASDEF int64_t canvas__fixed(double v) {
+    if (v != v) return 0;
+    v = canvas__clamp_coord(v, 4611686018427387904.0);
+    return (int64_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+CANVASDEF int32_t canvas__clamp_q16(int32_t v) {
+    v = v < 0 ? 0 : v;
+    return v > (255 << 16) ? (255 << 16) : v;
+}
+
+CANVASDEF int64_t canvas__texel_index(int64_t i, int64_t n, TextureWrap wrap) {
+    if (wrap == TEXTURE_CLAMP) return i < 0 ? 0 : i >= n ? n - 1 : i;
+    if ((n & (n - 1)) == 0) return i & (n - 1);
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+// per-channel a + (b - a) * f / 256, two channels per 32-bit multiply
+CANVASDEF uint32_t canvas__lerp_rgba(uint32_t a, uint32_t b, uint32_t f) {
+    uint32_t rb = ((a & 0x00FF00FF) * (256 - f) + (b & 0x00FF00FF) * f) >> 8;
+    uint32_t ga = (((a >> 8) & 0x00FF00FF) * (256 - f) + ((b >> 8) & 0x00FF00FF) * f) >> 8;
+    return (rb & 0x00FF00FF) | ((ga & 0x00FF00FF) << 8);
+}
+
+// u, v are Q16 texel coordinates with texel centres on integers
+CANVASDEF uint32_t canvas__sample(const Texture *t, int64_t u, int64_t v) {
+    const Canvas *img = t->image;
+    int64_t w = (int64_t)img->width, h = (int64_t)img->height;
+    if (t->filter == TEXTURE_NEAREST) {
+        int64_t x = canvas__texel_index((u + 32768) >> 16, w, t->wrap);
+        int64_t y = canvas__texel_index((v + 32768) >> 16, h, t->wrap);
+        return img->pixels[(size_t)y * img->width + (size_t)x];
+    }
+    int64_t x0 = canvas__texel_index(u >> 16, w, t->wrap), x1 = canvas__texel_index((u >> 16) + 1, w, t->wrap);
+    int64_t y0 = canvas__texel_index(v >> 16, h, t->wrap), y1 = canvas__texel_index((v >> 16) + 1, h, t->wrap);
+    uint32_t fx = (uint32_t)(u >> 8) & 0xFF, fy = (uint32_t)(v >> 8) & 0xFF;
+    const uint32_t *r0 = img->pixels + (size_t)y0 * img->width, *r1 = img->pixels + (size_t)y1 * img->width;
+    return canvas__lerp_rgba(canvas__lerp_rgba(r0[x0], r0[x1], fx), canvas__lerp_rgba(r1[x0], r1[x1], fx), fy);
+}
+
+CANVASDEF void canvas__tri_span(const canvas__Tri *t, int y, int x0, int x1) {
+    double px = (double)x0 + 0.5 - t->ox, py = (double)y + 0.5 - t->oy;
+    const int32_t n = x1 - x0 + 1;
+    int32_t col[4], dcol[4];
+    for (int k = 0; k < 4; ++k) {
+        // inside the triangle a channel moves at most 255 along a span; larger values only
+        // come from rounding on slivers, and bounding them keeps col + i * dcol in range
+        col[k] = (int32_t)canvas__fixed(canvas__clamp_coord(t->a[k] + t->dx[k] * px + t->dy[k] * py, 1024.0) * 65536.0 + 32768.0);
+        dcol[k] = (int32_t)canvas__fixed(canvas__clamp_coord(t->dx[k], 512.0 / n) * 65536.0);
+    }
+    uint32_t *dst = t->c->pixels + (size_t)y * t->c->width + x0;
+
+    if (!t->tex && !t->depth) {
+        // independent lanes, clamps as min/max: compilers evaluate several pixels per step
+        for (int32_t i = 0; i < n; ++i) {
+            uint32_t r = (uint32_t)canvas__clamp_q16(col[0] + i * dcol[0]) >> 16;
+            uint32_t g = (uint32_t)canvas__clamp_q16(col[1] + i * dcol[1]) >> 16;
+            uint32_t b = (uint32_t)canvas__clamp_q16(col[2] + i * dcol[2]) >> 16;
+            uint32_t a = (uint32_t)canvas__clamp_q16(col[3] + i * dcol[3]) >> 16;
+            dst[i] = r << 24 | g << 16 | b << 8 | a;
+        }
+        return;
+    }
+
+    int64_t u = 0, v = 0, du = 0, dv = 0, z = 0, dz = 0;
+    if (t->tex) {
+        u = canvas__fixed((t->a[4] + t->dx[4] * px + t->dy[4] * py) * 65536.0);
+        v = canvas__fixed((t->a[5] + t->dx[5] * px + t->dy[5] * py) * 65536.0);
+        du = canvas__fixed(t->dx[4] * 65536.0);
+        dv = canvas__fixed(t->dx[5] * 65536.0);
+    }
+    uint16_t *z16 = NULL;
+    uint32_t *z32 = NULL;
+    if (t->depth) {
+        size_t at = (size_t)y * t->depth->width + (size_t)x0;
+        if (t->depth->format == DEPTH_16) z16 = (uint16_t *)t->depth->values + at;
+        else z32 = (uint32_t *)t->depth->values + at;
+        z = canvas__fixed((t->a[6] + t->dx[6] * px + t->dy[6] * py) * 4294967295.0);
+        dz = canvas__fixed(t->dx[6] * 4294967295.0);
+    }
+    for (int32_t i = 0; i < n; ++i, u += du, v += dv, z += dz) {
+        if (t->depth) {
+            uint32_t zi = z < 0 ? 0 : z > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)z;
+            if (z16) {
+                if ((zi >> 16) >= z16[i]) continue;
+                z16[i] = (uint16_t)(zi >> 16);
+            } else {
+                if (zi >= z32[i]) continue;
+                z32[i] = zi;
+            }
+        }
+        uint32_t r = (uint32_t)canvas__clamp_q16(col[0] + i * dcol[0]) >> 16;
+        uint32_t g = (uint32_t)canvas__clamp_q16(col[1] + i * dcol[1]) >> 16;
+        uint32_t b = (uint32_t)canvas__clamp_q16(col[2] + i * dcol[2]) >> 16;
+        uint32_t a = (uint32_t)canvas__clamp_q16(col[3] + i * dcol[3]) >> 16;
+        if (!t->tex) {
+            dst[i] = r << 24 | g << 16 | b << 8 | a;
+            continue;
+        }
+        uint32_t s = canvas__sample(t->tex, u, v);
+        if (t->modulate) {
+            s = canvas__div255((s >> 24) * r) << 24 | canvas__div255(((s >> 16) & 0xFF) * g) << 16 |
+                canvas__div255(((s >> 8) & 0xFF) * b) << 8 | canvas__div255((s & 0xFF) * a);
+        }
+        dst[i] = s;
+    }
+}
+
+CANVASDEF int canvas__triangle_shade(Canvas *c, const Vertex *v, const Texture *tex, DepthBuffer *depth) {
+    if (!c || !c->pixels || !v) return -1;
+    if (depth && (!depth->values || depth->width != c->width || depth->height != c->height)) return -1;
+    if (tex && (!tex->image || !tex->image->pixels || tex->image->width == 0 || tex->image->height == 0)) return -1;
+
+    const double lim = 67108864.0;  // 2^26, as for polygons
+    double x[3], y[3], attr[3][CANVAS__TRI_ATTRS];
+    canvas__Tri t;
+    t.c = c;
+    t.tex = tex;
+    t.depth = depth;
+    t.modulate = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (v[i].x != v[i].x || v[i].y != v[i].y) return 0;
+        x[i] = canvas__clamp_coord(v[i].x, lim);
+        y[i] = canvas__clamp_coord(v[i].y, lim);
+        attr[i][0] = (double)(v[i].color >> 24);
+        attr[i][1] = (double)((v[i].color >> 16) & 0xFF);
+        attr[i][2] = (double)((v[i].color >> 8) & 0xFF);
+        attr[i][3] = (double)(v[i].color & 0xFF);
+        // texel space with centres on integers: u = 0 is the left edge of texel 0
+        attr[i][4] = tex ? (double)v[i].u * (double)tex->image->width - 0.5 : 0.0;
+        attr[i][5] = tex ? (double)v[i].v * (double)tex->image->height - 0.5 : 0.0;
+        attr[i][6] = v[i].z < 0 ? 0.0 : v[i].z > 1 ? 1.0 : (double)v[i].z;
+        if (v[i].color != 0xFFFFFFFF) t.modulate = 1;
+    }
+
+    // plane gradients of every attribute, anchored at vertex 0
+    double e1x = x[1] - x[0], e1y = y[1] - y[0], e2x = x[2] - x[0], e2y = y[2] - y[0];
+    double area = e1x * e2y - e2x * e1y;
+    if (!(area > 0 || area < 0)) return 0;
+    t.ox = x[0];
+    t.oy = y[0];
+    for (int k = 0; k < CANVAS__TRI_ATTRS; ++k) {
+        double d1 = attr[1][k] - attr[0][k], d2 = attr[2][k] - attr[0][k];
+        t.a[k] = attr[0][k];
+        t.dx[k] = (d1 * e2y - d2 * e1y) / area;
+        t.dy[k] = (d2 * e1x - d1 * e2x) / area;
+    }
+
+    // sort by y; the long edge 0-2 bounds one side of every row
+    int o[3] = {0, 1, 2};
+    if (y[o[1]] < y[o[0]]) canvas__swap_int(&o[0], &o[1]);
+    if (y[o[2]] < y[o[0]]) canvas__swap_int(&o[0], &o[2]);
+    if (y[o[2]] < y[o[1]]) canvas__swap_int(&o[1], &o[2]);
+    double x0 = x[o[0]], y0 = y[o[0]], x1 = x[o[1]], y1 = y[o[1]], x2 = x[o[2]], y2 = y[o[2]];
+
+    const int height = canvas__clamp_int(c->height), max_x = canvas__clamp_int(c->width) - 1;
+    int row0 = canvas__imax(canvas__ceil_int(y0 - 0.5), 0);
+    int row1 = canvas__imin(canvas__ceil_int(y2 - 0.5), height);
+    for (int row = row0; row < row1; ++row) {
+        double yc = (double)row + 0.5;
+        double xl = x0 + (yc - y0) * (x2 - x0) / (y2 - y0);
+        double xr = yc < y1 ? x0 + (yc - y0) * (x1 - x0) / (y1 - y0) : x1 + (yc - y1) * (x2 - x1) / (y2 - y1);
+        if (xr < xl) {
+            double tmp = xl;
+            xl = xr;
+            xr = tmp;
+        }
+        int s0 = canvas__imax(canvas__ceil_int(xl - 0.5), 0);
+        int s1 = canvas__imin(canvas__ceil_int(xr - 0.5) - 1, max_x);
+        if (s0 <= s1) canvas__tri_span(&t, row, s0, s1);
+    }
+    return 0;
+}
+
+CANVASDEF int canvas_triangle_gouraud(Canvas *c, const Vertex v[3], DepthBuffer *depth) {
+    return canvas__triangle_shade(c, v, NULL, depth);
+}
+
+CANVASDEF int canvas_triangle_textured(Canvas *c, const Vertex v[3], const Texture *tex, DepthBuffer *depth) {
+    if (!tex) return -1;
+    return canvas__triangle_shade(c, v, tex, depth);
+}
+
+/* ---------- flood fill ---------- */
+typedef struct {
+    Canvas *c;
+    uint32_t target, color;
+    int tolerance;
+    int check_visited;      // the fill colour itself matches, so painted pixels must be skipped
+    size_t reach;           // 1 for 8-connected: neighbour rows are scanned one pixel wider
+    uint8_t *visited;       // one bit per pixel
+    FloodStack *stack;
+    int overflow;           // a span was dropped because the stack was full
+    size_t min_y, max_y;
+} canvas__Flood;
+
+CANVASDEF int flood_stack_init(FloodStack *s, size_t capacity) {
+    s->count = 0;
+    s->capacity = capacity ? capacity : 1;
+    s->spans = (FloodSpan *)malloc(s->capacity * sizeof(FloodSpan));
+    if (!s->spans) {
+        s->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+CANVASDEF void flood_stack_free(FloodStack *s) {
+    free(s->spans);
+    s->spans = NULL;
+    s->capacity = s->count = 0;
+}
+
+// |a - b| <= tolerance on every channel, two channels per 16-bit lane
+CANVASDEF int canvas__color_within(uint32_t a, uint32_t b, int tolerance) {
+    const uint32_t t = (uint32_t)tolerance * 0x00010001u, high = 0x80008000u;
+    uint32_t ea = a & 0x00FF00FFu, oa = (a >> 8) & 0x00FF00FFu;
+    uint32_t eb = b & 0x00FF00FFu, ob = (b >> 8) & 0x00FF00FFu;
+    // each lane holds 256 + a - b + tolerance, which must land in [256, 256 + 2 * tolerance]
+    uint32_t ye = ea + 0x01000100u - eb + t, yo = oa + 0x01000100u - ob + t;
+    uint32_t over = ((ye + 0x7EFF7EFFu - 2 * t) | (yo + 0x7EFF7EFFu - 2 * t)) & high;
+    uint32_t under = ~((ye + 0x7F007F00u) & (yo + 0x7F007F00u)) & high;
+    return (over | under) == 0;
+}
+
+CANVASDEF int canvas__flood_match(const canvas__Flood *f, size_t i) {
+    if (f->check_visited && (f->visited[i >> 3] >> (i & 7) & 1)) return 0;
+    return canvas__color_within(f->c->pixels[i], f->target, f->tolerance);
+}
+
+// first x in [x, end) of row y that does not match
+CANVASDEF size_t canvas__flood_scan_right(const canvas__Flood *f, size_t y, size_t x, size_t end) {
+    const size_t base = y * f->c->width;
+    if (f->tolerance == 0 && !f->check_visited) {
+        // exact match: compare four pixels per step
+        const uint32_t *row = f->c->pixels + base, t = f->target;
+        while (x + 4 <= end && ((row[x] ^ t) | (row[x + 1] ^ t) | (row[x + 2] ^ t) | (row[x + 3] ^ t)) == 0) x += 4;
+        while (x < end && row[x] == t) ++x;
+        return x;
+    }
+    while (x < end && canvas__flood_match(f, base + x)) ++x;
+    return x;
+}
+
+// first x of the matching run that ends at x (which matches) in row y
+CANVASDEF size_t canvas__flood_scan_left(const canvas__Flood *f, size_t y, size_t x) {
+    const size_t base = y * f->c->width;
+    if (f->tolerance == 0 && !f->check_visited) {
+        const uint32_t *row = f->c->pixels + base, t = f->target;
+        while (x >= 4 && ((row[x - 1] ^ t) | (row[x - 2] ^ t) | (row[x - 3] ^ t) | (row[x - 4] ^ t)) == 0) x -= 4;
+        while (x > 0 && row[x - 1] == t) --x;
+        return x;
+    }
+    while (x > 0 && canvas__flood_match(f, base + x - 1)) --x;
+    return x;
+}
+
+// paints x0..x1 of row y and queues the run; a full stack only sets f->overflow
+CANVASDEF void canvas__flood_span(canvas__Flood *f, size_t x0, size_t x1, size_t y) {
+    uint32_t *row = f->c->pixels + y * f->c->width;
+    size_t base = y * f->c->width;
+    for (size_t x = x0; x <= x1; ++x) {
+        row[x] = f->color;
+        f->visited[(base + x) >> 3] |= (uint8_t)(1u << ((base + x) & 7));
+    }
+    if (y < f->min_y) f->min_y = y;
+    if (y > f->max_y) f->max_y = y;
+    FloodStack *s = f->stack;
+    if (s->count == s->capacity) {
+        f->overflow = 1;
+        return;
+    }
+    s->spans[s->count].x0 = x0;
+    s->spans[s->count].x1 = x1;
+    s->spans[s->count].y = y;
+    s->count++;
+}
+
+// fills every matching run in the rows above and below a filled span
+CANVASDEF void canvas__flood_expand(canvas__Flood *f, FloodSpan span) {
+    const size_t w = f->c->width;
+    size_t lo = span.x0 >= f->reach ? span.x0 - f->reach : 0;
+    size_t hi = span.x1 + f->reach < w ? span.x1 + f->reach : w - 1;
+    for (int side = 0; side < 2; ++side) {
+        if (side == 0 && span.y == 0) continue;
+        if (side == 1 && span.y + 1 >= f->c->height) continue;
+        size_t y = side == 0 ? span.y - 1 : span.y + 1;
+        size_t x = lo;
+        while (x <= hi) {
+            if (!canvas__flood_match(f, y * w + x)) {
+                ++x;
+                continue;
+            }
+            size_t x0 = canvas__flood_scan_left(f, y, x);
+            size_t x1 = canvas__flood_scan_right(f, y, x, w) - 1;
+            canvas__flood_span(f, x0, x1, y);
+            x = x1 + 2;
+        }
+    }
+}
+
+CANVASDEF void canvas__flood_drain(canvas__Flood *f) {
+    while (f->stack->count > 0) canvas__flood_expand(f, f->stack->spans[--f->stack->count]);
+}
+
+CANVASDEF int canvas_flood_fill_ex(Canvas *c, int x, int y, uint32_t color, uint8_t tolerance, FloodConnectivity conn, FloodStack *stack) {
+    if (!c || !c->pixels || !stack || !stack->spans || stack->capacity == 0) return -1;
+    if (x < 0 || y < 0 || (size_t)x >= c->width || (size_t)y >= c->height) return 0;
+    canvas__Flood f;
+    memset(&f, 0, sizeof(f));
+    f.c = c;
+    f.target = c->pixels[(size_t)y * c->width + (size_t)x];
+    f.color = color;
+    f.tolerance = tolerance;
+    f.reach = conn == FLOOD_8 ? 1 : 0;
+    f.stack = stack;
+    f.min_y = f.max_y = (size_t)y;
+    if (tolerance == 0 && color == f.target) return 0;
+    // calloc'd pages are zero-filled on first touch, so small fills stay cheap on huge canvases
+    f.visited = (uint8_t *)calloc((c->width * c->height + 7) / 8, 1);
+    if (!f.visited) return -1;
+    // painted pixels only need skipping when the fill colour itself still matches
+    f.check_visited = canvas__color_within(color, f.target, tolerance);
+    stack->count = 0;
+
+    size_t x0 = canvas__flood_scan_left(&f, (size_t)y, (size_t)x);
+    size_t x1 = canvas__flood_scan_right(&f, (size_t)y, (size_t)x, c->width) - 1;
+    canvas__flood_span(&f, x0, x1, (size_t)y);
+    canvas__flood_drain(&f);
+    // spans dropped on overflow border the filled area: expand every filled run
+    // again until a pass completes without dropping anything
+    while (f.overflow) {
+        f.overflow = 0;
+        for (size_t ry = f.min_y; ry <= f.max_y; ++ry) {
+            size_t base = ry * c->width;
+            for (size_t rx = 0; rx < c->width; ++rx) {
+                if (!(f.visited[(base + rx) >> 3] >> ((base + rx) & 7) & 1)) continue;
+                FloodSpan span;
+                span.x0 = rx;
+                while (rx + 1 < c->width && (f.visited[(base + rx + 1) >> 3] >> ((base + rx + 1) & 7) & 1)) ++rx;
+                span.x1 = rx;
+                span.y = ry;
+                canvas__flood_expand(&f, span);
+                canvas__flood_drain(&f);
+            }
+        }
+    }
+    free(f.visited);
+    return 0;
+}
+
+CANVASDEF int canvas_flood_fill(Canvas *c, int x, int y, uint32_t color, uint8_t tolerance) {
+    FloodStack stack;
+    if (flood_stack_init(&stack, CANVAS_FLOOD_STACK) != 0) return -1;
+    int result = canvas_flood_fill_ex(c, x, y, color, tolerance, FLOOD_4, &stack);
+    flood_stack_free(&stack);
+    return result;
+}
+
+/* ---------- threads ---------- */
+// worker is the chunk index in [0, CANVAS__WORKERS); chunk 0 runs on the calling thread
+typedef void (*canvas__RangeFn)(void *ctx, size_t worker, size_t begin, size_t end);
+
+#ifdef CANVAS_HAS_THREADS
+typedef struct {
+    canvas__RangeFn fn;
+    void *ctx;
+    size_t worker, begin, end;
+} canvas__RangeJob;
+
+CANVASDEF void *canvas__range_thread(void *arg) {
+    canvas__RangeJob *job = (canvas__RangeJob *)arg;
+    job->fn(job->ctx, job->worker, job->begin, job->end);
+    return NULL;
+}
+#endif // CANVAS_HAS_THREADS
+
+// runs fn over [0, n) in up to CANVAS_THREADS contiguous chunks
+CANVASDEF void canvas__parallel_for(size_t n, canvas__RangeFn fn, void *ctx) {
+#ifdef CANVAS_HAS_THREADS
+    pthread_t threads[CANVAS__WORKERS];
+    canvas__RangeJob jobs[CANVAS__WORKERS];
+    int started[CANVAS__WORKERS];
+    size_t workers = n < (size_t)CANVAS__WORKERS ? n : (size_t)CANVAS__WORKERS;
+    for (size_t i = 1; i < workers; ++i) {
+        jobs[i].fn = fn;
+        jobs[i].ctx = ctx;
+        jobs[i].worker = i;
+        jobs[i].begin = n * i / workers;
+        jobs[i].end = n * (i + 1) / workers;
+        started[i] = pthread_create(&threads[i], NULL, canvas__range_thread, &jobs[i]) == 0;
+        if (!started[i]) fn(ctx, i, jobs[i].begin, jobs[i].end);
+    }
+    if (workers > 0) fn(ctx, 0, 0, n / workers);
+    for (size_t i = 1; i < workers; ++i) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+#else
+    if (n > 0) fn(ctx, 0, 0, n);
+#endif // CANVAS_HAS_THREADS
+}
+
+/* ---------- blur ---------- */
+#define CANVAS__BLUR_STRIP 64   // columns whose vertical sums are carried together
+
+typedef struct {
+    const uint32_t *src;
+    uint32_t *dst;
+    size_t src_stride, dst_stride;
+    size_t w, h;
+    size_t radius;
+    uint64_t scale;             // 2^32 / (2 * radius + 1), rounded up
+} canvas__BoxPass;
+
+CANVASDEF uint32_t canvas__box_pack(const uint32_t sum[4], uint64_t scale) {
+    const uint64_t half = (uint64_t)1 << 31;
+    return (uint32_t)((sum[0] * scale + half) >> 32) << 24 |
+           (uint32_t)((sum[1] * scale + half) >> 32) << 16 |
+           (uint32_t)((sum[2] * scale + half) >> 32) << 8 |
+           (uint32_t)((sum[3] * scale + half) >> 32);
+}
+
+// adds `count` copies of pixel v to the channel sums
+CANVASDEF void canvas__box_add(uint32_t sum[4], uint32_t v, uint32_t count) {
+    for (int ch = 0; ch < 4; ++ch) sum[ch] += count * ((v >> (24 - 8 * ch)) & 0xFF);
+}
+
+// horizontal pass over rows [begin, end): a running sum slides along each row
+CANVASDEF void canvas__box_rows(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    const canvas__BoxPass *p = (const canvas__BoxPass *)ctx;
+    const size_t w = p->w, r = p->radius;
+    for (size_t y = begin; y < end; ++y) {
+        const uint32_t *src = p->src + y * p->src_stride;
+        uint32_t *dst = p->dst + y * p->dst_stride;
+        uint32_t sum[4] = {0, 0, 0, 0};
+        // window for x = 0 is src[-r..r] with both edges repeated: r copies of the first
+        // pixel, src[0..inner], then the last pixel for whatever overhangs the row
+        size_t inner = r < w - 1 ? r : w - 1;
+        canvas__box_add(sum, src[0], (uint32_t)r);
+        canvas__box_add(sum, src[w - 1], (uint32_t)(r - inner));
+        for (size_t i = 0; i <= inner; ++i) canvas__box_add(sum, src[i], 1);
+        for (size_t x = 0; x < w; ++x) {
+            dst[x] = canvas__box_pack(sum, p->scale);
+            uint32_t in = src[x + r + 1 < w ? x + r + 1 : w - 1];
+            uint32_t out = src[x >= r ? x - r : 0];
+            sum[0] += (in >> 24) - (out >> 24);
+            sum[1] += ((in >> 16) & 0xFF) - ((out >> 16) & 0xFF);
+            sum[2] += ((in >> 8) & 0xFF) - ((out >> 8) & 0xFF);
+            sum[3] += (in & 0xFF) - (out & 0xFF);
+        }
+    }
+}
+
+/* vertical pass over columns [begin, end). Rows are streamed top to bottom
+   while the sums of a strip of columns ride along, so memory is read in row
+   order instead of striding down single columns. */
+CANVASDEF void canvas__box_cols(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    const canvas__BoxPass *p = (const canvas__BoxPass *)ctx;
+    const size_t h = p->h, r = p->radius;
+    uint32_t sums[CANVAS__BLUR_STRIP][4];
+    for (size_t x0 = begin; x0 < end; x0 += CANVAS__BLUR_STRIP) {
+        size_t n = end - x0 < CANVAS__BLUR_STRIP ? end - x0 : CANVAS__BLUR_STRIP;
+        memset(sums, 0, sizeof(sums));
+        // seeded like the rows: edge rows counted once per repeat, so the cost follows h, not r
+        size_t inner = r < h - 1 ? r : h - 1;
+        const uint32_t *first = p->src + x0, *last = p->src + (h - 1) * p->src_stride + x0;
+        for (size_t k = 0; k < n; ++k) {
+            canvas__box_add(sums[k], first[k], (uint32_t)r);
+            canvas__box_add(sums[k], last[k], (uint32_t)(r - inner));
+        }
+        for (size_t i = 0; i <= inner; ++i) {
+            const uint32_t *row = p->src + i * p->src_stride + x0;
+            for (size_t k = 0; k < n; ++k) canvas__box_add(sums[k], row[k], 1);
+        }
+        for (size_t y = 0; y < h; ++y) {
+            uint32_t *dst = p->dst + y * p->dst_stride + x0;
+            const uint32_t *in = p->src + (y + r + 1 < h ? y + r + 1 : h - 1) * p->src_stride + x0;
+            const uint32_t *out = p->src + (y >= r ? y - r : 0) * p->src_stride + x0;
+            for (size_t k = 0; k < n; ++k) {
+                dst[k] = canvas__box_pack(sums[k], p->scale);
+                sums[k][0] += (in[k] >> 24) - (out[k] >> 24);
+                sums[k][1] += ((in[k] >> 16) & 0xFF) - ((out[k] >> 16) & 0xFF);
+                sums[k][2] += ((in[k] >> 8) & 0xFF) - ((out[k] >> 8) & 0xFF);
+                sums[k][3] += (in[k] & 0xFF) - (out[k] & 0xFF);
+            }
+        }
+    }
+}
+
+// clips `region` to the canvas; returns 0 when nothing is left
+CANVASDEF int canvas__clip_region(const Canvas *c, Rectangle *region) {
+    if (!c || !c->pixels || region->w == 0 || region->h == 0) return 0;
+    if (region->x >= c->width || region->y >= c->height) return 0;
+    if (region->w > c->width - region->x) region->w = c->width - region->x;
+    if (region->h > c->height - region->y) region->h = c->height - region->y;
+    return 1;
+}
+
+// one box blur per radius: rows from the canvas into scratch, columns back
+CANVASDEF int canvas__box_blur_passes(Canvas *c, Rectangle region, const size_t *radii, int passes) {
+    if (!canvas__clip_region(c, &region)) return 0;
+    uint32_t *scratch = (uint32_t *)malloc(region.w * region.h * sizeof(uint32_t));
+    if (!scratch) return -1;
+    uint32_t *pixels = c->pixels + region.y * c->width + region.x;
+    for (int i = 0; i < passes; ++i) {
+        if (radii[i] == 0) continue;
+        canvas__BoxPass p;
+        p.radius = radii[i];
+        p.scale = (((uint64_t)1 << 32) + 2 * p.radius) / (2 * p.radius + 1);
+        p.w = region.w;
+        p.h = region.h;
+        p.src = pixels;
+        p.src_stride = c->width;
+        p.dst = scratch;
+        p.dst_stride = region.w;
+        canvas__parallel_for(region.h, canvas__box_rows, &p);
+        p.src = scratch;
+        p.src_stride = region.w;
+        p.dst = pixels;
+        p.dst_stride = c->width;
+        canvas__parallel_for(region.w, canvas__box_cols, &p);
+    }
+    free(scratch);
+    return 0;
+}
+
+CANVASDEF int canvas_box_blur(Canvas *c, Rectangle region, int radius) {
+    if (radius <= 0) return 0;
+    size_t r = (size_t)(radius < (1 << 20) ? radius : (1 << 20));
+    return canvas__box_blur_passes(c, region, &r, 1);
+}
+
+/* Three box blurs approximate a Gaussian. Box widths follow "Fastest Gaussian
+   blur" (I. Kutskir): two sizes straddling the ideal width, mixed so the
+   total variance matches sigma^2. */
+CANVASDEF int canvas_gaussian_blur(Canvas *c, Rectangle region, float sigma) {
+    if (!(sigma > 0)) return 0;
+    if (sigma > 100000.0f) sigma = 100000.0f;
+    const int n = 3;
+    float s2 = 12.0f * sigma * sigma;
+    int wl = (int)canvas__sqrtf(s2 / (float)n + 1.0f);
+    if (wl % 2 == 0) wl--;
+    int wu = wl + 2;
+    // in float: n * wl * wl overflows int for sigmas in the tens of thousands
+    float fn = (float)n, fw = (float)wl;
+    float m_ideal = (s2 - fn * fw * fw - 4.0f * fn * fw - 3.0f * fn) / (-4.0f * fw - 4.0f);
+    int m = (int)(m_ideal + 0.5f);
+    size_t radii[3];
+    for (int i = 0; i < n; ++i) radii[i] = (size_t)((i < m ? wl : wu) - 1) / 2;
+    if (radii[n - 1] == 0) return 0;
+    return canvas__box_blur_passes(c, region, radii, n);
+}
+
+/* ---------- colormaps ---------- */
+CANVASDEF int colormap_from_stops(Colormap *cm, const GradientStop *stops, size_t count, uint32_t flags) {
+    memset(cm, 0, sizeof(*cm));
+    cm->flags = flags;
+    if (canvas__gradient_lut(cm->lut, CANVAS_COLORMAP_SIZE, 1, stops, count) != 0) return -1;
+    if (flags & COLORMAP_REVERSE) {
+        for (size_t i = 0; i < CANVAS_COLORMAP_SIZE / 2; ++i) {
+            uint32_t t = cm->lut[i];
+            cm->lut[i] = cm->lut[CANVAS_COLORMAP_SIZE - 1 - i];
+            cm->lut[CANVAS_COLORMAP_SIZE - 1 - i] = t;
+        }
+    }
+    return 0;
+}
+
+// the matplotlib perceptual maps, sampled at 11 evenly spaced points
+CANVASDEF void colormap_builtin(Colormap *cm, ColormapName name, uint32_t flags) {
+    static const uint32_t maps[4][11] = {
+        {0x440154, 0x482475, 0x414487, 0x355F8D, 0x2A788E, 0x21918C, 0x22A884, 0x44BF70, 0x7AD151, 0xBDDF26, 0xFDE725}, // viridis
+        {0x000004, 0x140E36, 0x3B0F70, 0x641A80, 0x8C2981, 0xB73779, 0xDE4968, 0xF7705C, 0xFE9F6D, 0xFECF92, 0xFCFDBF}, // magma
+        {0x000004, 0x160B39, 0x420A68, 0x6A176E, 0x932667, 0xBC3754, 0xDD513A, 0xF37819, 0xFCA50A, 0xF6D746, 0xFCFFA4}, // inferno
+        {0x0D0887, 0x41049D, 0x6A00A8, 0x8F0DA4, 0xB12A90, 0xCC4778, 0xE16462, 0xF2844B, 0xFCA636, 0xFCCE25, 0xF0F921}, // plasma
+    };
+    GradientStop stops[11];
+    size_t count = 11;
+    if (name == COLORMAP_GRAY || (int)name < 0 || (int)name > COLORMAP_GRAY) {
+        stops[0].offset = 0.0f;
+        stops[0].color = 0x000000FFu;
+        stops[1].offset = 1.0f;
+        stops[1].color = 0xFFFFFFFFu;
+        count = 2;
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            stops[i].offset = (float)i / 10.0f;
+            stops[i].color = maps[name][i] << 8 | 0xFF;
+        }
+    }
+    colormap_from_stops(cm, stops, count, flags);
+}
+
+// log2 of a positive normal float without libm: exponent from the bits plus a
+// quartic fit of log2(1 + t) for the mantissa (error < 3e-4)
+CANVASDEF float canvas__log2f(float v) {
+    uint32_t bits;
+    float m;
+    memcpy(&bits, &v, sizeof(bits));
+    float e = (float)((int)((bits >> 23) & 0xFF) - 127);
+    bits = (bits & 0x007FFFFFu) | 0x3F800000u;
+    memcpy(&m, &bits, sizeof(m));
+    float t = m - 1.0f;
+    return e + 0.00020318f + t * (1.43610783f + t * (-0.66954228f + t * (0.31224097f - t * 0.07915816f)));
+}
+
+typedef struct {
+    Canvas *c;
+    const float *field;
+    size_t stride;
+    float offset, scale;    // index = (value - offset) * scale, after log2 when logarithmic
+    int logarithmic;
+    const Colormap *cm;
+} canvas__ColormapJob;
+
+CANVASDEF void canvas__colormap_rows(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    const canvas__ColormapJob *job = (const canvas__ColormapJob *)ctx;
+    const uint32_t *lut = job->cm->lut;
+    const float top = (float)(CANVAS_COLORMAP_SIZE - 1);
+    for (size_t y = begin; y < end; ++y) {
+        const float *src = job->field + y * job->stride;
+        uint32_t *dst = job->c->pixels + y * job->c->width;
+        if (job->logarithmic) {
+            for (size_t x = 0; x < job->c->width; ++x) {
+                float v = src[x];
+                float t = v > 0 ? (canvas__log2f(v) - job->offset) * job->scale : 0;
+                t = t < 0 ? 0 : t > top ? top : t;
+                dst[x] = v == v ? lut[(int)t] : job->cm->nan_color;
+            }
+        } else {
+            // straight-line normalise, clamp, gather: no branches besides the NaN select
+            for (size_t x = 0; x < job->c->width; ++x) {
+                float v = src[x];
+                float t = (v - job->offset) * job->scale;
+                t = t > 0 ? t : 0;
+                t = t < top ? t : top;
+                dst[x] = v == v ? lut[(int)t] : job->cm->nan_color;
+            }
+        }
+    }
+}
+
+CANVASDEF void canvas_colormap_apply(Canvas *c, const float *field, size_t stride, float vmin, float vmax, const Colormap *cm) {
+    if (!c || !c->pixels || !field || !cm) return;
+    canvas__ColormapJob job;
+    job.c = c;
+    job.field = field;
+    job.stride = stride ? stride : c->width;
+    job.cm = cm;
+    job.logarithmic = (cm->flags & COLORMAP_LOG) && vmin > 0 && vmax > 0;
+    if (job.logarithmic) {
+        vmin = canvas__log2f(vmin);
+        vmax = canvas__log2f(vmax);
+    }
+    job.offset = vmin;
+    // 256 equal-width bins; vmax itself clamps into the last one
+    job.scale = vmax != vmin ? (float)CANVAS_COLORMAP_SIZE / (vmax - vmin) : 0.0f;
+    canvas__parallel_for(c->height, canvas__colormap_rows, &job);
+}
+
+/* ---------- density ---------- */
+#define CANVAS__DENSITY_PARALLEL 65536  // smaller batches count on the calling thread
+#define CANVAS__DENSITY_BINS 65536      // equalization histogram size
+
+CANVASDEF int density_init(DensityCanvas *d, size_t width, size_t height) {
+    memset(d, 0, sizeof(*d));
+    d->counts = (uint32_t *)calloc(width * height + 1, sizeof(uint32_t));
+    d->scratch = (uint32_t **)calloc(CANVAS__WORKERS, sizeof(uint32_t *));
+    if (!d->counts || !d->scratch) {
+        density_free(d);
+        return -1;
+    }
+    d->workers = CANVAS__WORKERS;
+    d->width = width;
+    d->height = height;
+    return 0;
+}
+
+CANVASDEF void density_free(DensityCanvas *d) {
+    free(d->counts);
+    for (size_t i = 0; i < d->workers; ++i) free(d->scratch[i]);
+    free(d->scratch);
+    memset(d, 0, sizeof(*d));
+}
+
+CANVASDEF void density_clear(DensityCanvas *d) {
+    if (d->counts) memset(d->counts, 0, d->width * d->height * sizeof(uint32_t));
+}
+
+CANVASDEF void canvas__density_bump(uint32_t *cell) {
+    *cell += *cell != UINT32_MAX;
+}
+
+CANVASDEF void canvas__density_point(uint32_t *buf, size_t w, size_t h, float x, float y) {
+    // also rejects NaN
+    if (!(x >= 0 && y >= 0 && x < (float)w && y < (float)h)) return;
+    size_t cx = (size_t)x, cy = (size_t)y;
+    if (cx < w && cy < h) canvas__density_bump(&buf[cy * w + cx]);
+}
+
+CANVASDEF int canvas__density_cell(float v, size_t lim) {
+    int i = v > 0 ? (int)v : 0;
+    return i < (int)lim ? i : (int)lim - 1;
+}
+
+// Bresenham between the cells holding both (clipped) ends, each cell counted once
+CANVASDEF void canvas__density_line(uint32_t *buf, size_t w, size_t h, float fx0, float fy0, float fx1, float fy1) {
+    if (w == 0 || h == 0) return;
+    if (!canvas__clip_segment(&fx0, &fy0, &fx1, &fy1, (float)w, (float)h)) return;
+    int x0 = canvas__density_cell(fx0, w), y0 = canvas__density_cell(fy0, h);
+    int x1 = canvas__density_cell(fx1, w), y1 = canvas__density_cell(fy1, h);
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    for (;;) {
+        canvas__density_bump(&buf[(size_t)y0 * w + (size_t)x0]);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+CANVASDEF void density_add_point(DensityCanvas *d, float x, float y) {
+    canvas__density_point(d->counts, d->width, d->height, x, y);
+}
+
+CANVASDEF void density_add_line(DensityCanvas *d, float x0, float y0, float x1, float y1) {
+    canvas__density_line(d->counts, d->width, d->height, x0, y0, x1, y1);
+}
+
+typedef struct {
+    DensityCanvas *d;
+    const Vector2 *points;
+    int lines;
+    size_t workers;     // buffers to fold into counts when merging
+} canvas__DensityJob;
+
+CANVASDEF void canvas__density_batch(void *ctx, size_t worker, size_t begin, size_t end) {
+    const canvas__DensityJob *job = (const canvas__DensityJob *)ctx;
+    DensityCanvas *d = job->d;
+    uint32_t *buf = worker == 0 ? d->counts : d->scratch[worker];
+    if (job->lines) {
+        for (size_t i = begin; i < end; ++i) {
+            const Vector2 *s = &job->points[2 * i];
+            canvas__density_line(buf, d->width, d->height, s[0].x, s[0].y, s[1].x, s[1].y);
+        }
+    } else {
+        for (size_t i = begin; i < end; ++i) {
+            canvas__density_point(buf, d->width, d->height, job->points[i].x, job->points[i].y);
+        }
+    }
+}
+
+// folds the private buffers into counts row by row and zeroes them for the next batch
+CANVASDEF void canvas__density_merge(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    const canvas__DensityJob *job = (const canvas__DensityJob *)ctx;
+    DensityCanvas *d = job->d;
+    size_t lo = begin * d->width, hi = end * d->width;
+    for (size_t k = 1; k < job->workers; ++k) {
+        uint32_t *src = d->scratch[k];
+        for (size_t i = lo; i < hi; ++i) {
+            uint32_t sum = d->counts[i] + src[i];
+            d->counts[i] = sum < src[i] ? UINT32_MAX : sum;
+            src[i] = 0;
+        }
+    }
+}
+
+CANVASDEF int canvas__density_add(DensityCanvas *d, const Vector2 *points, size_t count, int lines) {
+    if (!d->counts || !points || count == 0) return 0;
+    canvas__DensityJob job;
+    job.d = d;
+    job.points = points;
+    job.lines = lines;
+    // a canvas set up with fewer workers than this build splits into counts on the calling thread
+    job.workers = count < CANVAS__DENSITY_PARALLEL || d->workers < CANVAS__WORKERS ? 1 : CANVAS__WORKERS;
+    for (size_t k = 1; k < job.workers; ++k) {
+        if (d->scratch[k]) continue;
+        d->scratch[k] = (uint32_t *)calloc(d->width * d->height + 1, sizeof(uint32_t));
+        if (!d->scratch[k]) return -1;
+    }
+    if (job.workers == 1) {
+        canvas__density_batch(&job, 0, 0, count);
+        return 0;
+    }
+    canvas__parallel_for(count, canvas__density_batch, &job);
+    canvas__parallel_for(d->height, canvas__density_merge, &job);
+    return 0;
+}
+
+CANVASDEF int density_add_points(DensityCanvas *d, const Vector2 *points, size_t count) {
+    return canvas__density_add(d, points, count, 0);
+}
+
+CANVASDEF int density_add_lines(DensityCanvas *d, const Vector2 *points, size_t segments) {
+    return canvas__density_add(d, points, segments, 1);
+}
+
+typedef struct {
+    Canvas *c;
+    const DensityCanvas *d;
+    size_t w, h;            // overlap of the canvas and the density grid
+    DensityScale scale;
+    const uint32_t *lut;
+    float norm;             // LUT index per count (linear) or per log2(1 + count)
+    const uint32_t *bin_colors;
+    uint64_t bin_scale;     // 32.32 bins per count above one
+    size_t bins;
+} canvas__DensityRender;
+
+CANVASDEF void canvas__density_render_rows(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    const canvas__DensityRender *job = (const canvas__DensityRender *)ctx;
+    const float top = (float)(CANVAS_COLORMAP_SIZE - 1);
+    for (size_t y = begin; y < end; ++y) {
+        const uint32_t *src = job->d->counts + y * job->d->width;
+        uint32_t *dst = job->c->pixels + y * job->c->width;
+        for (size_t x = 0; x < job->w; ++x) {
+            uint32_t n = src[x];
+            if (n == 0) continue;
+            if (job->scale == DENSITY_EQ_HIST) {
+                size_t bin = (size_t)(((uint64_t)(n - 1) * job->bin_scale) >> 32);
+                dst[x] = job->bin_colors[bin < job->bins ? bin : job->bins - 1];
+            } else {
+                float t = job->scale == DENSITY_LOG ? canvas__log2f((float)n + 1.0f) : (float)n;
+                t *= job->norm;
+                dst[x] = job->lut[(int)(t < top ? t : top)];
+            }
+        }
+    }
+}
+
+CANVASDEF int canvas_density_render(Canvas *c, const DensityCanvas *d, DensityScale scale, const Colormap *cm) {
+    if (!c || !c->pixels || !d || !d->counts || !cm) return 0;
+    canvas__DensityRender job;
+    memset(&job, 0, sizeof(job));
+    job.c = c;
+    job.d = d;
+    job.w = c->width < d->width ? c->width : d->width;
+    job.h = c->height < d->height ? c->height : d->height;
+    job.scale = scale;
+    job.lut = cm->lut;
+    uint32_t max = 0;
+    for (size_t y = 0; y < job.h; ++y) {
+        const uint32_t *row = d->counts + y * d->width;
+        for (size_t x = 0; x < job.w; ++x) max = row[x] > max ? row[x] : max;
+    }
+    if (max == 0) return 0;
+    const float top = (float)(CANVAS_COLORMAP_SIZE - 1);
+    uint32_t *bin_colors = NULL;
+    if (scale == DENSITY_EQ_HIST) {
+        // linear bins over [1, max]; each maps to the fraction of non-empty cells below it
+        job.bins = max < CANVAS__DENSITY_BINS ? max : CANVAS__DENSITY_BINS;
+        job.bin_scale = ((uint64_t)job.bins << 32) / max;
+        uint64_t *cdf = (uint64_t *)calloc(job.bins, sizeof(uint64_t));
+        bin_colors = (uint32_t *)malloc(job.bins * sizeof(uint32_t));
+        if (!cdf || !bin_colors) {
+            free(cdf);
+            free(bin_colors);
+            return -1;
+        }
+        for (size_t y = 0; y < job.h; ++y) {
+            const uint32_t *row = d->counts + y * d->width;
+            for (size_t x = 0; x < job.w; ++x) {
+                if (row[x] == 0) continue;
+                size_t bin = (size_t)(((uint64_t)(row[x] - 1) * job.bin_scale) >> 32);
+                ++cdf[bin < job.bins ? bin : job.bins - 1];
+            }
+        }
+        for (size_t i = 1; i < job.bins; ++i) cdf[i] += cdf[i - 1];
+        size_t first = 0;
+        while (cdf[first] == 0) ++first;
+        uint64_t lowest = cdf[first], total = cdf[job.bins - 1];
+        for (size_t i = 0; i < job.bins; ++i) {
+            float t = total > lowest ? (float)(cdf[i] - lowest) / (float)(total - lowest) * top : top;
+            bin_colors[i] = cm->lut[cdf[i] < lowest ? 0 : (int)(t < top ? t : top)];
+        }
+        free(cdf);
+        job.bin_colors = bin_colors;
+    } else if (scale == DENSITY_LOG) {
+        job.norm = top / canvas__log2f((float)max + 1.0f);
+    } else {
+        job.norm = top / (float)max;
+    }
+    canvas__parallel_for(job.h, canvas__density_render_rows, &job);
+    free(bin_colors);
+    return 0;
+}
+
+/* ---------- compare ---------- */
+CANVASDEF int canvas__pixel_differs(uint32_t a, uint32_t b, int tolerance) {
+    return tolerance ? !canvas__color_within(a, b, tolerance) : a != b;
+}
+
+// Compares two w*h frames. Fills the bounding box of the pixels that differ by more than
+// `tolerance` on some channel, and their count, when asked; returns 0 when none do.
+CANVASDEF int canvas__diff(const uint32_t *a, const uint32_t *b, uint32_t w, uint32_t h, int tolerance, uint32_t box[4], size_t *count) {
+    uint32_t x0 = w, x1 = 0, y0 = h, y1 = 0;
+    size_t n = 0;
+    for (uint32_t y = 0; y < h; ++y) {
+        const uint32_t *ra = a + (size_t)y * w, *rb = b + (size_t)y * w;
+        // memcmp is vectorized by the C library, most rows of a mostly static scene stop here
+        if (memcmp(ra, rb, (size_t)w * sizeof(uint32_t)) == 0) continue;
+        if (tolerance == 0 && !box && !count) return 1;
+        // exact rows are known to differ, so only the part left of the box can widen it
+        uint32_t limit = tolerance || count ? w : x0, l = 0;
+        while (l < limit && !canvas__pixel_differs(ra[l], rb[l], tolerance)) ++l;
+        if (l == w) continue;
+        if (!box && !count) return 1;
+        if (y0 == h) y0 = y;
+        y1 = y;
+        if (l < x0) x0 = l;
+        if (count) {
+            for (uint32_t i = l; i < w; ++i) {
+                if (!canvas__pixel_differs(ra[i], rb[i], tolerance)) continue;
+                ++n;
+                if (i > x1) x1 = i;
+            }
+        } else {
+            uint32_t r = w - 1;
+            while (r > x1 && !canvas__pixel_differs(ra[r], rb[r], tolerance)) --r;
+            if (r > x1) x1 = r;
+        }
+    }
+    if (count) *count = n;
+    if (y0 == h) return 0;
+    if (box) {
+        box[0] = x0;
+        box[1] = y0;
+        box[2] = x1 - x0 + 1;
+        box[3] = y1 - y0 + 1;
+    }
+    return 1;
+}
+
+CANVASDEF int canvas_diff(const Canvas *a, const Canvas *b, uint8_t tolerance, Rectangle *bbox, size_t *count) {
+    if (bbox) bbox->x = bbox->y = bbox->w = bbox->h = 0;
+    if (count) *count = 0;
+    if (!a || !b || !a->pixels || !b->pixels || a->width != b->width || a->height != b->height) return -1;
+    if (a->width > 0xFFFFFFFF || a->height > 0xFFFFFFFF) return -1;
+    uint32_t box[4];
+    int differs = canvas__diff(a->pixels, b->pixels, (uint32_t)a->width, (uint32_t)a->height, tolerance, bbox ? box : NULL, count);
+    if (differs && bbox) {
+        bbox->x = box[0];
+        bbox->y = box[1];
+        bbox->w = box[2];
+        bbox->h = box[3];
+    }
+    return differs;
+}
+
+CANVASDEF uint64_t canvas__rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+// XXH64-style rounds over four independent lanes, fed with pixel pairs
+CANVASDEF uint64_t canvas_hash(const Canvas *c) {
+    const uint64_t p1 = 0x9E3779B185EBCA87ull, p2 = 0xC2B2AE3D27D4EB4Full, p3 = 0x165667B19E3779F9ull;
+    if (!c || !c->pixels) return 0;
+    const uint32_t *px = c->pixels;
+    size_t n = c->width * c->height, i = 0;
+    uint64_t lane[4] = {p1 + p2, p2, 0, (uint64_t)0 - p1};
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 4; ++k) {
+            uint64_t v = (uint64_t)px[i + 2 * k] | (uint64_t)px[i + 2 * k + 1] << 32;
+            lane[k] = canvas__rotl64(lane[k] + v * p2, 31) * p1;
+        }
+    }
+    uint64_t h = canvas__rotl64(lane[0], 1) + canvas__rotl64(lane[1], 7) + canvas__rotl64(lane[2], 12) + canvas__rotl64(lane[3], 18);
+    // the size goes in too, so a 2x8 and a 4x4 canvas of the same pixels differ
+    h ^= ((uint64_t)c->width << 32 | (uint64_t)(uint32_t)c->height) * p1;
+    for (; i < n; ++i) h = canvas__rotl64(h ^ (uint64_t)px[i] * p1, 23) * p2 + p3;
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+CANVASDEF int canvas_psnr(const Canvas *a, const Canvas *b, double *psnr) {
+    if (!a || !b || !a->pixels || !b->pixels || !psnr || a->width != b->width || a->height != b->height) return -1;
+    size_t n = a->width * a->height;
+    uint64_t sse = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t pa = a->pixels[i], pb = b->pixels[i];
+        if (pa == pb) continue;
+        for (int s = 8; s < 32; s += 8) {
+            int d = (int)((pa >> s) & 0xFF) - (int)((pb >> s) & 0xFF);
+            sse += (uint64_t)(d * d);
+        }
+    }
+    if (sse == 0 || n == 0) {
+        *psnr = CANVAS_PSNR_IDENTICAL;
+        return 0;
+    }
+    // 10 * log10(255^2 * samples / sse)
+    double ratio = 65025.0 * 3.0 * (double)n / (double)sse;
+    double db = 10.0 / 3.32192809 * canvas__log2f((float)ratio);
+    *psnr = db < CANVAS_PSNR_IDENTICAL ? db : CANVAS_PSNR_IDENTICAL;
+    return 0;
+}
+
+// BT.601 luma, 8-bit fixed point
+CANVASDEF uint32_t canvas__luma(uint32_t p) {
+    return (77 * (p >> 24) + 150 * ((p >> 16) & 0xFF) + 29 * ((p >> 8) & 0xFF)) >> 8;
+}
+
+#define CANVAS__SSIM_WINDOW 8
+#define CANVAS__SSIM_STEP 4
+
+// next window origin; the last window is pulled back flush with the edge so no pixel is skipped
+CANVASDEF size_t canvas__ssim_next(size_t at, size_t win, size_t lim) {
+    size_t next = at + CANVAS__SSIM_STEP;
+    return next + win <= lim ? next : lim - win;
+}
+
+CANVASDEF int canvas_ssim(const Canvas *a, const Canvas *b, double *ssim) {
+    if (!a || !b || !a->pixels || !b->pixels || !ssim || a->width != b->width || a->height != b->height) return -1;
+    size_t w = a->width, h = a->height;
+    size_t win_w = w < CANVAS__SSIM_WINDOW ? w : CANVAS__SSIM_WINDOW;
+    size_t win_h = h < CANVAS__SSIM_WINDOW ? h : CANVAS__SSIM_WINDOW;
+    if (win_w == 0 || win_h == 0) {
+        *ssim = 1.0;
+        return 0;
+    }
+    // per column sums over the window's rows: a, b, a^2, b^2, a*b
+    uint32_t *cols = (uint32_t *)malloc(5 * w * sizeof(uint32_t));
+    if (!cols) return -1;
+    const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+    const double count = (double)(win_w * win_h);
+    double total = 0;
+    size_t windows = 0;
+    for (size_t y = 0;; y = canvas__ssim_next(y, win_h, h)) {
+        memset(cols, 0, 5 * w * sizeof(uint32_t));
+        for (size_t r = y; r < y + win_h; ++r) {
+            const uint32_t *ra = a->pixels + r * w, *rb = b->pixels + r * w;
+            for (size_t x = 0; x < w; ++x) {
+                uint32_t la = canvas__luma(ra[x]), lb = canvas__luma(rb[x]);
+                uint32_t *s = cols + 5 * x;
+                s[0] += la;
+                s[1] += lb;
+                s[2] += la * la;
+                s[3] += lb * lb;
+                s[4] += la * lb;
+            }
+        }
+        for (size_t x = 0;; x = canvas__ssim_next(x, win_w, w)) {
+            uint32_t sum[5] = {0, 0, 0, 0, 0};
+            for (size_t i = x; i < x + win_w; ++i) {
+                for (int k = 0; k < 5; ++k) sum[k] += cols[5 * i + k];
+            }
+            double ma = sum[0] / count, mb = sum[1] / count;
+            double va = sum[2] / count - ma * ma, vb = sum[3] / count - mb * mb;
+            double cov = sum[4] / count - ma * mb;
+            total += (2 * ma * mb + c1) * (2 * cov + c2) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+            ++windows;
+            if (x + win_w == w) break;
+        }
+        if (y + win_h == h) break;
+    }
+    free(cols);
+    *ssim = total / (double)windows;
+    return 0;
+}
+
+/* ---------- text ---------- */
+#define CANVAS__GLYPHS 95
+
+typedef struct {
+    int scale;                  // 0 while the slot is empty
+    int glyph_w, glyph_h;
+    uint8_t *coverage;          // CANVAS__GLYPHS cells of glyph_w * glyph_h bytes
+    uint16_t *spans;            // per glyph row: first and one-past-last covered column
+    uint64_t last_use;
+} canvas__TextAtlas;
+
+static canvas__TextAtlas canvas__text_atlases[CANVAS_TEXT_ATLASES];
+static uint64_t canvas__text_clock;
+
+CANVASDEF int canvas__text_atlas_build(canvas__TextAtlas *a, int scale) {
+    // one byte per glyph row, bit 4 is the leftmost column
+    static const uint8_t font[CANVAS__GLYPHS][CANVAS_FONT_HEIGHT] = {
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+        {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // '!'
+        {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, // '"'
+        {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // '#'
+        {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, // '$'
+        {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // '%'
+        {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, // '&'
+        {0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // '\''
+        {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // '('
+        {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // ')'
+        {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // '*'
+        {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // '+'
+        {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, // ','
+        {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // '-'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // '.'
+        {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // '/'
+        {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // '0'
+        {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // '1'
+        {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // '2'
+        {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // '3'
+        {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // '4'
+        {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // '5'
+        {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // '6'
+        {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // '7'
+        {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // '8'
+        {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // '9'
+        {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // ':'
+        {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, // ';'
+        {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // '<'
+        {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // '='
+        {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // '>'
+        {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // '?'
+        {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, // '@'
+        {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}, // 'A'
+        {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // 'B'
+        {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // 'C'
+        {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, // 'D'
+        {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // 'E'
+        {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // 'F'
+        {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, // 'G'
+        {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // 'H'
+        {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 'I'
+        {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // 'J'
+        {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // 'K'
+        {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // 'L'
+        {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // 'M'
+        {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // 'N'
+        {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'O'
+        {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // 'P'
+        {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // 'Q'
+        {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // 'R'
+        {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // 'S'
+        {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // 'T'
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'U'
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // 'V'
+        {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // 'W'
+        {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // 'X'
+        {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, // 'Y'
+        {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // 'Z'
+        {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // '['
+        {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // '\\'
+        {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // ']'
+        {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // '^'
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // '_'
+        {0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, // '`'
+        {0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F}, // 'a'
+        {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, // 'b'
+        {0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E}, // 'c'
+        {0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F}, // 'd'
+        {0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E}, // 'e'
+        {0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08}, // 'f'
+        {0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // 'g'
+        {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}, // 'h'
+        {0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E}, // 'i'
+        {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C}, // 'j'
+        {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}, // 'k'
+        {0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 'l'
+        {0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11}, // 'm'
+        {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}, // 'n'
+        {0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E}, // 'o'
+        {0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10}, // 'p'
+        {0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01}, // 'q'
+        {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, // 'r'
+        {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E}, // 's'
+        {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, // 't'
+        {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D}, // 'u'
+        {0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04}, // 'v'
+        {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A}, // 'w'
+        {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, // 'x'
+        {0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // 'y'
+        {0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F}, // 'z'
+        {0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02}, // '{'
+        {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // '|'
+        {0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08}, // '}'
+        {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}, // '~'
+    };
+    size_t gw = (size_t)CANVAS_FONT_WIDTH * (size_t)scale;
+    size_t gh = (size_t)CANVAS_FONT_HEIGHT * (size_t)scale;
+    uint8_t *coverage = (uint8_t *)malloc(CANVAS__GLYPHS * gw * gh);
+    uint16_t *spans = (uint16_t *)malloc(CANVAS__GLYPHS * gh * 2 * sizeof(uint16_t));
+    if (!coverage || !spans) {
+        free(coverage);
+        free(spans);
+        return -1;
+    }
+    for (size_t g = 0; g < CANVAS__GLYPHS; ++g) {
+        for (size_t y = 0; y < gh; ++y) {
+            uint8_t bits = font[g][y / (size_t)scale];
+            uint8_t *row = coverage + (g * gh + y) * gw;
+            for (size_t x = 0; x < gw; ++x)
+                row[x] = (bits >> (CANVAS_FONT_WIDTH - 1 - x / (size_t)scale)) & 1 ? 255 : 0;
+            size_t x0 = 0, x1 = gw;
+            while (x0 < gw && !row[x0]) ++x0;
+            while (x1 > x0 && !row[x1 - 1]) --x1;
+            spans[(g * gh + y) * 2] = (uint16_t)x0;
+            spans[(g * gh + y) * 2 + 1] = (uint16_t)x1;
+        }
+    }
+    a->scale = scale;
+    a->glyph_w = (int)gw;
+    a->glyph_h = (int)gh;
+    a->coverage = coverage;
+    a->spans = spans;
+    return 0;
+}
+
+// returns the cached atlas for `scale`, building it over the least recently used slot
+CANVASDEF canvas__TextAtlas *canvas__text_atlas(int scale) {
+    canvas__TextAtlas *slot = &canvas__text_atlases[0];
+    for (int i = 0; i < CANVAS_TEXT_ATLASES; ++i) {
+        canvas__TextAtlas *a = &canvas__text_atlases[i];
+        if (a->scale == scale) {
+            a->last_use = ++canvas__text_clock;
+            return a;
+        }
+        if (a->last_use < slot->last_use) slot = a;
+    }
+    free(slot->coverage);
+    free(slot->spans);
+    memset(slot, 0, sizeof(*slot));
+    if (canvas__text_atlas_build(slot, scale) != 0) return NULL;
+    slot->last_use = ++canvas__text_clock;
+    return slot;
+}
+
+CANVASDEF void canvas_text_cache_free(void) {
+    for (int i = 0; i < CANVAS_TEXT_ATLASES; ++i) {
+        free(canvas__text_atlases[i].coverage);
+        free(canvas__text_atlases[i].spans);
+        memset(&canvas__text_atlases[i], 0, sizeof(canvas__text_atlases[i]));
+    }
+}
+
+// clamps the scale to 1..CANVAS_TEXT_MAX_SCALE
+CANVASDEF int canvas__text_scale(int scale) {
+    return scale < 1 ? 1 : scale > CANVAS_TEXT_MAX_SCALE ? CANVAS_TEXT_MAX_SCALE : scale;
+}
+
+// maps a byte to its glyph index; -1 for UTF-8 continuation bytes, which take no space
+CANVASDEF int canvas__glyph_index(unsigned char ch) {
+    if (ch >= 0x80 && ch < 0xC0) return -1;
+    if (ch < ' ' || ch > '~') ch = '?';
+    return ch - ' ';
+}
+
+CANVASDEF void canvas_text_measure(const char *text, int scale, int *width, int *height) {
+    scale = canvas__text_scale(scale);
+    size_t cols = 0, max_cols = 0, lines = 1;
+    for (const unsigned char *p = (const unsigned char *)text; text && *p; ++p) {
+        if (*p == '\n') {
+            ++lines;
+            cols = 0;
+        } else if (canvas__glyph_index(*p) >= 0 && ++cols > max_cols) {
+            max_cols = cols;
+        }
+    }
+    size_t w = max_cols ? (max_cols * CANVAS_FONT_ADVANCE - (CANVAS_FONT_ADVANCE - CANVAS_FONT_WIDTH)) * (size_t)scale : 0;
+    size_t h = text && *text ? (lines * CANVAS_FONT_LINE - (CANVAS_FONT_LINE - CANVAS_FONT_HEIGHT)) * (size_t)scale : 0;
+    if (width) *width = canvas__clamp_int(w);
+    if (height) *height = canvas__clamp_int(h);
+}
+
+CANVASDEF void canvas_text(Canvas *c, int x, int y, const char *text, int scale, uint32_t color) {
+    if (!c || !c->pixels || !text || c->width == 0 || c->height == 0) return;
+    scale = canvas__text_scale(scale);
+    uint32_t alpha = color & 0xFF;
+    if (alpha == 0) return;
+    canvas__TextAtlas *atlas = canvas__text_atlas(scale);
+    if (!atlas) return;
+    const int64_t gw = atlas->glyph_w, gh = atlas->glyph_h;
+    const int64_t advance = (int64_t)CANVAS_FONT_ADVANCE * scale;
+    const int64_t line_h = (int64_t)CANVAS_FONT_LINE * scale;
+    const int64_t cw = (int64_t)c->width, ch = (int64_t)c->height;
+    const unsigned char *p = (const unsigned char *)text;
+    int64_t pen_y = y;
+    while (*p) {
+        const unsigned char *end = p;
+        while (*end && *end != '\n') ++end;
+        // clip the line once: visible glyph rows, then glyphs per column range
+        int64_t row0 = pen_y < 0 ? -pen_y : 0;
+        int64_t row1 = ch - pen_y < gh ? ch - pen_y : gh;
+        if (row0 < row1) {
+            int64_t pen_x = x;
+            for (const unsigned char *q = p; q < end && pen_x < cw; ++q) {
+                int g = canvas__glyph_index(*q);
+                if (g < 0) continue;
+                int64_t gx = pen_x;
+                pen_x += advance;
+                if (gx + gw <= 0) continue;
+                int64_t col0 = gx < 0 ? -gx : 0;
+                int64_t col1 = cw - gx < gw ? cw - gx : gw;
+                const uint8_t *cell = atlas->coverage + (size_t)g * (size_t)(gw * gh);
+                const uint16_t *spans = atlas->spans + (size_t)g * (size_t)gh * 2;
+                for (int64_t r = row0; r < row1; ++r) {
+                    int64_t s0 = spans[r * 2] > col0 ? spans[r * 2] : col0;
+                    int64_t s1 = spans[r * 2 + 1] < col1 ? spans[r * 2 + 1] : col1;
+                    if (s0 >= s1) continue;
+                    const uint8_t *src = cell + r * gw + s0;
+                    uint32_t *dst = c->pixels + (size_t)(pen_y + r) * c->width + (size_t)(gx + s0);
+                    size_t n = (size_t)(s1 - s0);
+                    if (alpha == 255) {
+                        for (size_t i = 0; i < n; ++i) dst[i] = canvas__blend(dst[i], color, src[i]);
+                    } else {
+                        for (size_t i = 0; i < n; ++i) dst[i] = canvas__blend(dst[i], color, canvas__div255(src[i] * alpha));
+                    }
+                }
+            }
+        }
+        pen_y += line_h;
+        if (pen_y >= ch || !*end) break;
+        p = end + 1;
+    }
+}
+
+// filled into a local table so crc32_table never holds a partial result
+CANVASDEF void canvas__crc32_fill(void) {
+    uint32_t table[256];
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            if (c & 1) c = 0xEDB88320U ^ (c >> 1);
+            else       c = c >> 1;
+        }
+        table[i] = c;
+    }
+    memcpy(crc32_table, table, sizeof(table));
+}
+
+#ifdef CANVAS_HAS_THREADS
+static pthread_once_t canvas__crc32_once = PTHREAD_ONCE_INIT;
+#else
+static int canvas__crc32_built;
+#endif
+
+CANVASDEF void make_crc32_table(void) {
+#ifdef CANVAS_HAS_THREADS
+    // concurrent first calls wait for the one that builds the table
+    pthread_once(&canvas__crc32_once, canvas__crc32_fill);
+#else
+    if (canvas__crc32_built) return;
+    canvas__crc32_fill();
+    canvas__crc32_built = 1;
+#endif
+}
+
+CANVASDEF uint32_t crc32(const uint8_t *buf, size_t len) {
+    uint32_t c = 0xFFFFFFFFU;
+    for (size_t i = 0; i < len; ++i)
+        c = crc32_table[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFU;
+}
+
+CANVASDEF uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len) {
+    const uint32_t MOD_ADLER = 65521U;
+    // 5552 is the largest run whose sums cannot overflow 32 bits before the modulo
+    const size_t NMAX = 5552;
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (len > 0) {
+        size_t n = len < NMAX ? len : NMAX;
+        len -= n;
+        for (size_t i = 0; i < n; ++i) {
+            a += data[i];
+            b += a;
+        }
+        data += n;
+        a %= MOD_ADLER;
+        b %= MOD_ADLER;
+    }
+    return (b << 16) | a;
+}
+
+CANVASDEF uint32_t adler32(const uint8_t *data, size_t len) {
+    return adler32_update(1, data, len);
+}
+
+CANVASDEF int write_be32(FILE *f, uint32_t v) {
+    uint8_t b[4];
+    b[0] = (v >> 24) & 0xFF;
+    b[1] = (v >> 16) & 0xFF;
+    b[2] = (v >> 8) & 0xFF;
+    b[3] = v & 0xFF;
+    return (fwrite(b, 1, 4, f) == 4) ? 0 : -1;
+}
+
+CANVASDEF int write_chunk(FILE *f, const char type[4], const uint8_t *data, uint32_t len) {
+    if (write_be32(f, len) != 0) return -1;
+    if (fwrite(type, 1, 4, f) != 4) return -1;
+    if (len > 0 && fwrite(data, 1, len, f) != len) return -1;
+
+    // compute CRC over type + data
+    uint8_t *crc_buf = (uint8_t*)malloc(4 + len);
+    if (!crc_buf) return -1;
+    memcpy(crc_buf, type, 4);
+    if (len) memcpy(crc_buf + 4, data, len);
+    uint32_t crc = crc32(crc_buf, 4 + len);
+    free(crc_buf);
+
+    if (write_be32(f, crc) != 0) return -1;
+    return 0;
+}
+
+/* ---------- PNG colour analysis (internal) ---------- */
+CANVASDEF uint32_t canvas__color_hash(uint32_t color) {
+    // Fibonacci hashing, top 10 bits index the PNG_HASH_SIZE table
+    return (color * 2654435761U) >> 22;
+}
+
+// Returns the palette index of `color`, or -1 if it is not in the table.
+CANVASDEF int canvas__palette_find(const PngFormat *fmt, uint32_t color) {
+    uint32_t h = canvas__color_hash(color);
+    while (fmt->hash_vals[h]) {
+        if (fmt->hash_keys[h] == color) return fmt->hash_vals[h] - 1;
+        h = (h + 1) & (PNG_HASH_SIZE - 1);
+    }
+    return -1;
+}
+
+// Adds the distinct colours of a block of pixels to the palette; returns 0 once there are more than 256.
+CANVASDEF int canvas__palette_add(PngFormat *fmt, const uint32_t *pixels, size_t n) {
+    if (n == 0) return 1;
+    uint32_t last = ~pixels[0];
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = pixels[i];
+        if (p == last) continue; // runs are common in flat-shaded images
+        last = p;
+        uint32_t h = canvas__color_hash(p);
+        while (fmt->hash_vals[h] && fmt->hash_keys[h] != p) h = (h + 1) & (PNG_HASH_SIZE - 1);
+        if (fmt->hash_vals[h]) continue;
+        if (fmt->palette_size == 256) return 0;
+        fmt->hash_keys[h] = p;
+        fmt->hash_vals[h] = (uint16_t)(fmt->palette_size + 1);
+        fmt->palette[fmt->palette_size++] = p;
+    }
+    return 1;
+}
+
+// Moves translucent entries to the front so trailing opaque entries can be left out of tRNS.
+CANVASDEF void canvas__palette_order(PngFormat *fmt) {
+    uint32_t sorted[256];
+    uint8_t remap[256];
+    uint32_t n = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t i = 0; i < fmt->palette_size; ++i) {
+            int opaque = (fmt->palette[i] & 0xFF) == 0xFF;
+            if (opaque != pass) continue;
+            remap[i] = (uint8_t)n;
+            sorted[n++] = fmt->palette[i];
+        }
+    }
+    memcpy(fmt->palette, sorted, n * sizeof(uint32_t));
+
+    if (fmt->quant_lut) {
+        for (size_t k = 0; k < 65536; ++k) fmt->quant_lut[k] = remap[fmt->quant_lut[k]];
+    } else {
+        for (size_t h = 0; h < PNG_HASH_SIZE; ++h) {
+            if (fmt->hash_vals[h]) fmt->hash_vals[h] = (uint16_t)(remap[fmt->hash_vals[h] - 1] + 1);
+        }
+    }
+}
+
+CANVASDEF uint32_t canvas__palette_trns_len(const PngFormat *fmt) {
+    uint32_t n = 0;
+    while (n < fmt->palette_size && (fmt->palette[n] & 0xFF) != 0xFF) ++n;
+    return n;
+}
+
+CANVASDEF uint8_t canvas__palette_depth(uint32_t n) {
+    return n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+}
+
+/* Median-cut quantizer over an RGBA4444 histogram. The resulting 64K-entry
+   LUT maps any pixel to its palette index with one shift-and-mask. */
+typedef struct {
+    uint32_t count;
+    uint64_t sum[4];
+} canvas__QuantBin;
+
+typedef struct {
+    uint32_t start, end;
+    uint64_t count;
+    uint64_t score;
+    int channel;
+} canvas__QuantBox;
+
+CANVASDEF uint32_t canvas__quant_key(uint32_t p) {
+    return ((p >> 16) & 0xF000) | ((p >> 12) & 0x0F00) | ((p >> 8) & 0x00F0) | ((p >> 4) & 0x000F);
+}
+
+CANVASDEF uint32_t canvas__quant_channel(uint32_t key, int ch) {
+    return (key >> (12 - 4 * ch)) & 0xF;
+}
+
+CANVASDEF void canvas__quant_box_stats(canvas__QuantBox *box, const uint16_t *keys, const canvas__QuantBin *bins) {
+    uint32_t lo[4] = {15, 15, 15, 15}, hi[4] = {0, 0, 0, 0};
+    box->count = 0;
+    for (uint32_t i = box->start; i < box->end; ++i) {
+        box->count += bins[keys[i]].count;
+        for (int ch = 0; ch < 4; ++ch) {
+            uint32_t v = canvas__quant_channel(keys[i], ch);
+            if (v < lo[ch]) lo[ch] = v;
+            if (v > hi[ch]) hi[ch] = v;
+        }
+    }
+    box->channel = 0;
+    for (int ch = 1; ch < 4; ++ch) {
+        if (hi[ch] - lo[ch] > hi[box->channel] - lo[box->channel]) box->channel = ch;
+    }
+    uint32_t range = hi[box->channel] - lo[box->channel];
+    box->score = (box->end - box->start < 2 || range == 0) ? 0 : (uint64_t)range * box->count;
+}
+
+CANVASDEF int canvas__png_quantize(PngFormat *fmt, const uint32_t *pixels, size_t n) {
+    canvas__QuantBin *bins = (canvas__QuantBin*)calloc(65536, sizeof(canvas__QuantBin));
+    uint16_t *keys = (uint16_t*)malloc(65536 * sizeof(uint16_t));
+    uint16_t *tmp = (uint16_t*)malloc(65536 * sizeof(uint16_t));
+    fmt->quant_lut = (uint8_t*)calloc(65536, 1);
+    if (!bins || !keys || !tmp || !fmt->quant_lut) {
+        free(bins);
+        free(keys);
+        free(tmp);
+        free(fmt->quant_lut);
+        fmt->quant_lut = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = pixels[i];
+        canvas__QuantBin *bin = &bins[canvas__quant_key(p)];
+        bin->count++;
+        bin->sum[0] += (p >> 24) & 0xFF;
+        bin->sum[1] += (p >> 16) & 0xFF;
+        bin->sum[2] += (p >> 8) & 0xFF;
+        bin->sum[3] += p & 0xFF;
+    }
+    uint32_t nkeys = 0;
+    for (uint32_t k = 0; k < 65536; ++k) {
+        if (bins[k].count) keys[nkeys++] = (uint16_t)k;
+    }
+
+    canvas__QuantBox boxes[256];
+    uint32_t nboxes = 1;
+    boxes[0].start = 0;
+    boxes[0].end = nkeys;
+    canvas__quant_box_stats(&boxes[0], keys, bins);
+
+    while (nboxes < 256) {
+        uint32_t best = 0;
+        for (uint32_t b = 1; b < nboxes; ++b) {
+            if (boxes[b].score > boxes[best].score) best = b;
+        }
+        canvas__QuantBox *box = &boxes[best];
+        if (box->score == 0) break;
+
+        // counting sort of the box's keys along its widest channel
+        uint32_t start = box->start, end = box->end, hist[17] = {0};
+        for (uint32_t i = start; i < end; ++i) hist[canvas__quant_channel(keys[i], box->channel) + 1]++;
+        for (int v = 0; v < 16; ++v) hist[v + 1] += hist[v];
+        for (uint32_t i = start; i < end; ++i) {
+            tmp[start + hist[canvas__quant_channel(keys[i], box->channel)]++] = keys[i];
+        }
+        memcpy(keys + start, tmp + start, (end - start) * sizeof(uint16_t));
+
+        // split at the pixel-weighted median, keeping both halves non-empty
+        uint64_t acc = 0;
+        uint32_t split = start + 1;
+        for (uint32_t i = start; i < end - 1; ++i) {
+            acc += bins[keys[i]].count;
+            split = i + 1;
+            if (acc * 2 >= box->count) break;
+        }
+        boxes[nboxes].start = split;
+        boxes[nboxes].end = end;
+        box->end = split;
+        canvas__quant_box_stats(box, keys, bins);
+        canvas__quant_box_stats(&boxes[nboxes], keys, bins);
+        ++nboxes;
+    }
+
+    for (uint32_t b = 0; b < nboxes; ++b) {
+        uint64_t sum[4] = {0, 0, 0, 0}, count = 0;
+        for (uint32_t i = boxes[b].start; i < boxes[b].end; ++i) {
+            const canvas__QuantBin *bin = &bins[keys[i]];
+            count += bin->count;
+            for (int ch = 0; ch < 4; ++ch) sum[ch] += bin->sum[ch];
+            fmt->quant_lut[keys[i]] = (uint8_t)b;
+        }
+        uint32_t rgba[4] = {0, 0, 0, 0};
+        for (int ch = 0; count && ch < 4; ++ch) rgba[ch] = (uint32_t)((sum[ch] + count / 2) / count);
+        fmt->palette[b] = (rgba[0] << 24) | (rgba[1] << 16) | (rgba[2] << 8) | rgba[3];
+    }
+    fmt->palette_size = nboxes ? nboxes : 1;
+
+    free(bins);
+    free(keys);
+    free(tmp);
+    return 0;
+}
+
+/* Running colour analysis, fed a block of pixels at a time so streamed
+   images (see TiledCanvas) can be analysed row by row. */
+typedef struct {
+    uint32_t alpha_and;  // 0xFF when every alpha is 255
+    uint32_t chroma_or;  // 0 when r == g == b everywhere
+    uint32_t depth1_or, depth2_or, depth4_or; // 0 when every gray level fits that bit depth
+    int palette_ok;      // at most 256 distinct colours so far
+} canvas__PngScan;
+
+CANVASDEF void canvas__png_scan_init(PngFormat *fmt, canvas__PngScan *sc) {
+    fmt->quant_lut = NULL;
+    fmt->palette_size = 0;
+    memset(fmt->hash_vals, 0, sizeof(fmt->hash_vals));
+    sc->alpha_and = 0xFF;
+    sc->chroma_or = sc->depth1_or = sc->depth2_or = sc->depth4_or = 0;
+    sc->palette_ok = 1;
+}
+
+CANVASDEF void canvas__png_scan(PngFormat *fmt, canvas__PngScan *sc, const uint32_t *pixels, size_t n) {
+    /* branch-free, the OR/AND reductions vectorize well */
+    uint32_t alpha_and = sc->alpha_and, chroma_or = sc->chroma_or;
+    uint32_t depth1_or = sc->depth1_or, depth2_or = sc->depth2_or, depth4_or = sc->depth4_or;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = pixels[i];
+        uint32_t r = p >> 24, g = (p >> 16) & 0xFF, b = (p >> 8) & 0xFF;
+        alpha_and &= p;
+        chroma_or |= (r ^ g) | (g ^ b);
+        // a level fits in d bits when its d-bit groups repeat (0x55, 0x11, ...)
+        depth1_or |= (r ^ (r >> 1)) & 0x7F;
+        depth2_or |= (r ^ (r >> 2)) & 0x3F;
+        depth4_or |= (r ^ (r >> 4)) & 0x0F;
+    }
+    sc->alpha_and = alpha_and;
+    sc->chroma_or = chroma_or;
+    sc->depth1_or = depth1_or;
+    sc->depth2_or = depth2_or;
+    sc->depth4_or = depth4_or;
+    if (sc->palette_ok) sc->palette_ok = canvas__palette_add(fmt, pixels, n);
+}
+
+CANVASDEF uint32_t canvas__png_bits_per_pixel(const PngFormat *fmt) {
+    static const uint8_t channels[7] = {1, 0, 3, 1, 2, 0, 4};
+    return (uint32_t)fmt->bit_depth * channels[fmt->color_type];
+}
+
+CANVASDEF size_t canvas__png_image_bytes(uint32_t width, uint32_t height, uint32_t bits_per_pixel) {
+    return (size_t)height * (1 + ((size_t)width * bits_per_pixel + 7) / 8);
+}
+
+/* Picks the encoding once every pixel was scanned. `pixels` is only needed to
+   quantize in PNG_COLOR_INDEXED mode and may be NULL otherwise. */
+CANVASDEF int canvas__png_scan_finish(PngFormat *fmt, const canvas__PngScan *sc, const uint32_t *pixels, uint32_t width, uint32_t height, PngColorMode mode) {
+    fmt->bit_depth = 8;
+    fmt->color_type = 6;
+    if (mode == PNG_COLOR_RGBA) return 0;
+
+    if (mode == PNG_COLOR_AUTO) {
+        // cheapest lossless grayscale/truecolor form first, the palette has to beat it
+        int opaque = (sc->alpha_and & 0xFF) == 0xFF;
+        int gray = sc->chroma_or == 0;
+        if (gray && opaque) {
+            fmt->color_type = 0;
+            fmt->bit_depth = !sc->depth1_or ? 1 : !sc->depth2_or ? 2 : !sc->depth4_or ? 4 : 8;
+        } else if (gray) {
+            fmt->color_type = 4;
+        } else if (opaque) {
+            fmt->color_type = 2;
+        }
+    }
+    size_t best_size = canvas__png_image_bytes(width, height, canvas__png_bits_per_pixel(fmt));
+    uint8_t best_type = fmt->color_type, best_depth = fmt->bit_depth;
+
+    if (!sc->palette_ok) {
+        if (mode != PNG_COLOR_INDEXED) return 0;
+        if (!pixels || canvas__png_quantize(fmt, pixels, (size_t)width * height) != 0) return -1;
+    }
+
+    uint8_t depth = canvas__palette_depth(fmt->palette_size);
+    if (mode == PNG_COLOR_AUTO) {
+        // PLTE/tRNS cost up to ~1KB, which only pays off past a few hundred pixels
+        size_t pal_size = canvas__png_image_bytes(width, height, depth) + 12 + 3 * fmt->palette_size + 12 + fmt->palette_size;
+        if (pal_size >= best_size) {
+            fmt->color_type = best_type;
+            fmt->bit_depth = best_depth;
+            return 0;
+        }
+    }
+    canvas__palette_order(fmt);
+    fmt->bit_depth = depth;
+    fmt->color_type = 3;
+    return 0;
+}
+
+CANVASDEF int png_format_detect(PngFormat *fmt, const uint32_t *pixels, uint32_t width, uint32_t height, PngColorMode mode) {
+    canvas__PngScan sc;
+    canvas__png_scan_init(fmt, &sc);
+    if (mode != PNG_COLOR_RGBA) canvas__png_scan(fmt, &sc, pixels, (size_t)width * height);
+    return canvas__png_scan_finish(fmt, &sc, pixels, width, height, mode);
+}
+
+CANVASDEF void png_format_free(PngFormat *fmt) {
+    if (!fmt) return;
+    free(fmt->quant_lut);
+    fmt->quant_lut = NULL;
+}
+
+CANVASDEF size_t canvas__png_row_bytes(const PngFormat *fmt, uint32_t width) {
+    return ((size_t)width * canvas__png_bits_per_pixel(fmt) + 7) / 8;
+}
+
+// Packs one row of 0xRRGGBBAA pixels into PNG scanline bytes (without the filter byte).
+CANVASDEF void canvas__png_pack_row(const PngFormat *fmt, const uint32_t *src, uint32_t width, uint8_t *dst) {
+    switch (fmt->color_type) {
+    case 6:
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t p = src[x];
+            dst[x * 4 + 0] = (p >> 24) & 0xFF; // R
+            dst[x * 4 + 1] = (p >> 16) & 0xFF; // G
+            dst[x * 4 + 2] = (p >> 8) & 0xFF;  // B
+            dst[x * 4 + 3] = p & 0xFF;         // A
+        }
+        return;
+    case 2:
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t p = src[x];
+            dst[x * 3 + 0] = (p >> 24) & 0xFF; // R
+            dst[x * 3 + 1] = (p >> 16) & 0xFF; // G
+            dst[x * 3 + 2] = (p >> 8) & 0xFF;  // B
+        }
+        return;
+    case 4:
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t p = src[x];
+            dst[x * 2 + 0] = (p >> 24) & 0xFF; // gray
+            dst[x * 2 + 1] = p & 0xFF;         // A
+        }
+        return;
+    default:
+        break;
+    }
+
+    // colour types 0 and 3: MSB-first packing of 1/2/4/8-bit samples
+    const int depth = fmt->bit_depth;
+    const int per_byte = 8 / depth;
+    uint32_t last = width ? ~src[0] : 0;
+    uint8_t v = 0;
+    uint8_t acc = 0;
+    int filled = 0;
+    for (uint32_t x = 0; x < width; ++x) {
+        uint32_t p = src[x];
+        if (p != last) {
+            last = p;
+            if (fmt->color_type == 0) v = (uint8_t)((p >> 24) >> (8 - depth));
+            else if (fmt->quant_lut) v = fmt->quant_lut[canvas__quant_key(p)];
+            else v = (uint8_t)canvas__palette_find(fmt, p);
+        }
+        acc = (uint8_t)((acc << depth) | v);
+        if (++filled == per_byte) {
+            *dst++ = acc;
+            acc = 0;
+            filled = 0;
+        }
+    }
+    if (filled) *dst = (uint8_t)(acc << (depth * (per_byte - filled)));
+}
+
+CANVASDEF int write_png_from_rgba32(const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height) {
+    return write_png_from_rgba32_ex(filename, pixels, width, height, PNG_COLOR_AUTO);
+}
+
+// Writes the PNG signature, IHDR and, for indexed images, PLTE/tRNS.
+CANVASDEF int canvas__png_write_header(FILE *f, uint32_t width, uint32_t height, const PngFormat *fmt) {
+    make_crc32_table();
+
+    // PNG signature
+    const uint8_t png_sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (fwrite(png_sig, 1, 8, f) != 8) return -1;
+
+    // ---- IHDR chunk data (13 bytes) ----
+    uint8_t ihdr[13];
+    ihdr[0] = (width >> 24) & 0xFF;
+    ihdr[1] = (width >> 16) & 0xFF;
+    ihdr[2] = (width >> 8) & 0xFF;
+    ihdr[3] = width & 0xFF;
+    ihdr[4] = (height >> 24) & 0xFF;
+    ihdr[5] = (height >> 16) & 0xFF;
+    ihdr[6] = (height >> 8) & 0xFF;
+    ihdr[7] = height & 0xFF;
+    ihdr[8] = fmt->bit_depth;
+    ihdr[9] = fmt->color_type; // 0 gray, 2 RGB, 3 palette, 4 gray+alpha, 6 RGBA
+    ihdr[10] = 0;   // compression
+    ihdr[11] = 0;   // filter
+    ihdr[12] = 0;   // interlace
+
+    if (write_chunk(f, "IHDR", ihdr, 13) != 0) return -1;
+
+    // ---- PLTE + tRNS for indexed images ----
+    if (fmt->color_type == 3) {
+        uint8_t plte[256 * 3], trns[256];
+        for (uint32_t i = 0; i < fmt->palette_size; ++i) {
+            plte[i * 3 + 0] = (fmt->palette[i] >> 24) & 0xFF;
+            plte[i * 3 + 1] = (fmt->palette[i] >> 16) & 0xFF;
+            plte[i * 3 + 2] = (fmt->palette[i] >> 8) & 0xFF;
+            trns[i] = fmt->palette[i] & 0xFF;
+        }
+        if (write_chunk(f, "PLTE", plte, fmt->palette_size * 3) != 0) return -1;
+        uint32_t trns_len = canvas__palette_trns_len(fmt);
+        if (trns_len && write_chunk(f, "tRNS", trns, trns_len) != 0) return -1;
+    }
+    return 0;
+}
+
+// Packs a w*h block of pixels (rows `stride` pixels apart) into raw scanlines with filter bytes.
+CANVASDEF uint8_t *canvas__png_raw(const PngFormat *fmt, const uint32_t *pixels, size_t stride, uint32_t w, uint32_t h, size_t *raw_size) {
+    // raw_size = h * (1 + packed row bytes)
+    size_t row_bytes = 1 + canvas__png_row_bytes(fmt, w);
+    *raw_size = (size_t)h * row_bytes;
+
+    uint8_t *raw = (uint8_t*)malloc(*raw_size);
+    if (!raw) return NULL;
+    for (uint32_t y = 0; y < h; ++y) {
         uint8_t *row = raw + (size_t)y * row_bytes;
         row[0] = 0x00; // filter type 0 (None)
-        for (uint32_t x = 0; x < width; ++x) {
-            uint32_t p = pixels[(size_t)y * width + x];
-            // p assumed 0xRRGGBBAA
-            row[1 + x * 4 + 0] = (p >> 24) & 0xFF; // R
-            row[1 + x * 4 + 1] = (p >> 16) & 0xFF; // G
-            row[1 + x * 4 + 2] = (p >> 8) & 0xFF; // B
-            row[1 + x * 4 + 3] = p & 0xFF;       // A
+        canvas__png_pack_row(fmt, pixels + (size_t)y * stride, w, row + 1);
+    }
+    return raw;
+}
+
+/* Wraps raw bytes in a zlib stream of stored blocks, leaving `prefix` bytes free
+   at the front for the caller (fdAT puts its sequence number there). */
+CANVASDEF uint8_t *canvas__zlib_stored(const uint8_t *raw, size_t raw_size, size_t prefix, size_t *out_size) {
+    // zlib header: 0x78 0x01 (CM=8, CINFO=7, FCHECK/FDICT/FLEVEL appropriate for no preset)
+    // stored block format: [1 byte header][2 bytes LEN (LE)][2 bytes NLEN (LE)][data...]
+    // header byte: low 3 bits are BFINAL (bit0) and BTYPE (bits1-2). For stored and final -> 0x01
+    // For non-final stored blocks -> 0x00
+
+    // number of stored blocks:
+    const size_t MAX_STORED = 65535;
+    size_t nblocks = (raw_size + MAX_STORED - 1) / MAX_STORED;
+    if (nblocks == 0) nblocks = 1;
+
+    // size = 2 (zlib header) + raw_size + nblocks*5 (each stored block has 1 header byte + 2 LEN + 2 NLEN)
+    // plus 4 bytes Adler32
+    size_t size = prefix + 2 + raw_size + nblocks * 5 + 4;
+    uint8_t *z = (uint8_t*)malloc(size);
+    if (!z) return NULL;
+
+    size_t pos = prefix;
+    // zlib header
+    z[pos++] = 0x78;
+    z[pos++] = 0x01;
+
+    // stored blocks
+    size_t remaining = raw_size;
+    size_t offset = 0;
+    for (size_t bi = 0; bi < nblocks; ++bi) {
+        uint16_t this_len = (uint16_t)(remaining > MAX_STORED ? MAX_STORED : remaining);
+        uint16_t nlen = (uint16_t)(~this_len);
+
+        uint8_t header_byte = (bi == nblocks - 1) ? 0x01 : 0x00; // final? -> 1 : 0 ; BTYPE=00 so 0x01 or 0x00
+        z[pos++] = header_byte;
+
+        // write LEN and NLEN (little-endian)
+        z[pos++] = (uint8_t)(this_len & 0xFF);
+        z[pos++] = (uint8_t)((this_len >> 8) & 0xFF);
+        z[pos++] = (uint8_t)(nlen & 0xFF);
+        z[pos++] = (uint8_t)((nlen >> 8) & 0xFF);
+
+        // copy block data
+        if (this_len) memcpy(z + pos, raw + offset, this_len);
+        pos += this_len;
+        offset += this_len;
+        remaining -= this_len;
+    }
+
+    // adler32 (big-endian)
+    uint32_t adl = adler32(raw, raw_size);
+    z[pos++] = (adl >> 24) & 0xFF;
+    z[pos++] = (adl >> 16) & 0xFF;
+    z[pos++] = (adl >> 8) & 0xFF;
+    z[pos++] = adl & 0xFF;
+
+    *out_size = pos;
+    return z;
+}
+
+#define CANVAS__STORED_MAX 65535
+// room for the zlib header and a stored block header in front of the block data
+#define CANVAS__STORED_HEAD 7
+
+CANVASDEF int canvas__png_stream_flush(PngStream *s) {
+    int final = s->raw_left == 0;
+    uint8_t *start = s->block + CANVAS__STORED_HEAD - 5;
+    uint16_t len = (uint16_t)s->block_len;
+    uint16_t nlen = (uint16_t)(~len);
+    // stored block header: BFINAL bit, BTYPE=00, then LEN and NLEN (little-endian)
+    start[0] = final ? 0x01 : 0x00;
+    start[1] = (uint8_t)(len & 0xFF);
+    start[2] = (uint8_t)((len >> 8) & 0xFF);
+    start[3] = (uint8_t)(nlen & 0xFF);
+    start[4] = (uint8_t)((nlen >> 8) & 0xFF);
+    if (s->first) {
+        // zlib header: 0x78 0x01 (CM=8, CINFO=7, no preset dictionary)
+        start -= 2;
+        start[0] = 0x78;
+        start[1] = 0x01;
+        s->first = 0;
+    }
+    uint8_t *end = s->block + CANVAS__STORED_HEAD + s->block_len;
+    if (final) {
+        // adler32 (big-endian)
+        end[0] = (s->adler >> 24) & 0xFF;
+        end[1] = (s->adler >> 16) & 0xFF;
+        end[2] = (s->adler >> 8) & 0xFF;
+        end[3] = s->adler & 0xFF;
+        end += 4;
+    }
+    s->block_len = 0;
+    return write_chunk(s->f, "IDAT", start, (uint32_t)(end - start));
+}
+
+CANVASDEF int png_stream_begin(PngStream *s, const char *filename, uint32_t width, uint32_t height, const PngFormat *fmt) {
+    if (!s || !filename || !fmt || width == 0 || height == 0) return -1;
+    memset(s, 0, sizeof(*s));
+    s->fmt = fmt;
+    s->width = width;
+    s->height = height;
+    s->row_bytes = 1 + canvas__png_row_bytes(fmt, width);
+    s->raw_left = (uint64_t)height * s->row_bytes;
+    s->adler = 1;
+    s->first = 1;
+    s->row = (uint8_t*)malloc(s->row_bytes);
+    s->block = (uint8_t*)malloc(CANVAS__STORED_HEAD + CANVAS__STORED_MAX + 4);
+    if (!s->row || !s->block) goto fail;
+
+#if defined(_MSC_VER)
+    if (fopen_s(&s->f, filename, "wb") != 0 || !s->f) {
+        s->f = NULL;
+        perror("Cannot open file");
+        goto fail;
+    }
+#else
+    s->f = fopen(filename, "wb");
+    if (!s->f) {
+        perror("Cannot open file");
+        goto fail;
+    }
+#endif
+
+    if (canvas__png_write_header(s->f, width, height, fmt) != 0) goto fail;
+    return 0;
+
+fail:
+    if (s->f) fclose(s->f);
+    free(s->row);
+    free(s->block);
+    memset(s, 0, sizeof(*s));
+    return -1;
+}
+
+CANVASDEF int png_stream_write_row(PngStream *s, const uint32_t *row) {
+    if (!s->f || s->rows_written >= s->height) return -1;
+    s->row[0] = 0x00; // filter type 0 (None)
+    canvas__png_pack_row(s->fmt, row, s->width, s->row + 1);
+    s->adler = adler32_update(s->adler, s->row, s->row_bytes);
+    s->rows_written++;
+
+    const uint8_t *src = s->row;
+    size_t left = s->row_bytes;
+    while (left > 0) {
+        size_t n = CANVAS__STORED_MAX - s->block_len;
+        if (n > left) n = left;
+        memcpy(s->block + CANVAS__STORED_HEAD + s->block_len, src, n);
+        s->block_len += n;
+        s->raw_left -= n;
+        src += n;
+        left -= n;
+        if (s->block_len == CANVAS__STORED_MAX || s->raw_left == 0) {
+            if (canvas__png_stream_flush(s) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+CANVASDEF int png_stream_end(PngStream *s) {
+    if (!s->f) return -1;
+    int rc = s->rows_written == s->height ? 0 : -1;
+    // ---- IEND chunk (zero-length) ----
+    if (rc == 0) rc = write_chunk(s->f, "IEND", NULL, 0);
+    if (fclose(s->f) != 0) rc = -1;
+    free(s->row);
+    free(s->block);
+    memset(s, 0, sizeof(*s));
+    return rc;
+}
+
+CANVASDEF int write_png_from_rgba32_ex(const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height, PngColorMode mode) {
+    if (!filename || !pixels || width == 0 || height == 0) return -1;
+
+    PngFormat *fmt = (PngFormat*)malloc(sizeof(PngFormat));
+    if (!fmt) return -1;
+    if (png_format_detect(fmt, pixels, width, height, mode) != 0) {
+        free(fmt);
+        return -1;
+    }
+
+    PngStream s;
+    int rc = png_stream_begin(&s, filename, width, height, fmt);
+    for (uint32_t y = 0; rc == 0 && y < height; ++y) {
+        rc = png_stream_write_row(&s, pixels + (size_t)y * width);
+    }
+    if (s.f && png_stream_end(&s) != 0) rc = -1;
+
+    png_format_free(fmt);
+    free(fmt);
+    return rc;
+}
+
+/* ---------- APNG writer ---------- */
+
+CANVASDEF void canvas__put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+CANVASDEF int canvas__apng_write_fctl(ApngWriter *w, const uint32_t box[4]) {
+    uint8_t *d = w->fctl;
+    canvas__put_be32(d + 0, w->sequence++);
+    canvas__put_be32(d + 4, box[2]);
+    canvas__put_be32(d + 8, box[3]);
+    canvas__put_be32(d + 12, box[0]);
+    canvas__put_be32(d + 16, box[1]);
+    d[20] = 0; // delay_num, one frame at a time, bumped when frames repeat
+    d[21] = 1;
+    d[22] = (w->fps >> 8) & 0xFF; // delay_den
+    d[23] = w->fps & 0xFF;
+    d[24] = 0; // APNG_DISPOSE_OP_NONE: the next frame diffs against this one
+    d[25] = 0; // APNG_BLEND_OP_SOURCE: the sub-rectangle replaces what is there
+    w->fctl_pos = ftell(w->f);
+    return write_chunk(w->f, "fcTL", d, 26);
+}
+
+// Rewrites an already written chunk in place and returns to the end of the file.
+CANVASDEF int canvas__rewrite_chunk(FILE *f, long pos, const char type[4], const uint8_t *data, uint32_t len) {
+    if (fseek(f, pos, SEEK_SET) != 0) return -1;
+    int rc = write_chunk(f, type, data, len);
+    if (fseek(f, 0, SEEK_END) != 0) return -1;
+    return rc;
+}
+
+CANVASDEF ApngWriter *apng_start(const char *filename, size_t width, size_t height, int fps) {
+    if (!filename || width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF) return NULL;
+    if (fps <= 0 || fps > 0xFFFF) return NULL;
+    ApngWriter *w = (ApngWriter*)malloc(sizeof(*w));
+    if (!w) return NULL;
+
+#if defined(_MSC_VER)
+    if (fopen_s(&w->f, filename, "wb") != 0) {
+        free(w);
+        return NULL;
+    }
+#else
+    w->f = fopen(filename, "wb");
+    if (!w->f) {
+        free(w);
+        return NULL;
+    }
+#endif
+
+    w->width = (uint32_t)width;
+    w->height = (uint32_t)height;
+    w->fps = (uint16_t)fps;
+    w->num_frames = 0;
+    w->sequence = 0;
+    w->fctl_pos = 0;
+    w->prev = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+
+    // every frame shares the IHDR, so stay with 8-bit RGBA
+    PngFormat rgba;
+    rgba.bit_depth = 8;
+    rgba.color_type = 6;
+    uint8_t actl[8] = {0}; // num_frames is patched in apng_end, num_plays 0 loops forever
+    w->actl_pos = 0;
+    if (!w->prev || canvas__png_write_header(w->f, w->width, w->height, &rgba) != 0) goto fail;
+    w->actl_pos = ftell(w->f);
+    if (write_chunk(w->f, "acTL", actl, 8) != 0) goto fail;
+    return w;
+
+fail:
+    fclose(w->f);
+    free(w->prev);
+    free(w);
+    return NULL;
+}
+
+CANVASDEF int apng_write_frame(ApngWriter *w, const Canvas *c) {
+    if (!w || !c || !c->pixels || c->width != w->width || c->height != w->height) return -1;
+
+    uint32_t box[4] = {0, 0, w->width, w->height};
+    if (w->num_frames > 0 && !canvas__diff(w->prev, c->pixels, w->width, w->height, 0, box, NULL)) {
+        // identical frame: show the previous one longer instead of storing anything
+        uint32_t delay = ((uint32_t)w->fctl[20] << 8 | w->fctl[21]) + 1;
+        if (delay <= 0xFFFF) {
+            w->fctl[20] = (delay >> 8) & 0xFF;
+            w->fctl[21] = delay & 0xFF;
+            return canvas__rewrite_chunk(w->f, w->fctl_pos, "fcTL", w->fctl, 26);
+        }
+        box[2] = box[3] = 1;
+    }
+
+    PngFormat rgba;
+    rgba.bit_depth = 8;
+    rgba.color_type = 6;
+    size_t raw_size = 0, z_size = 0;
+    const uint32_t *origin = c->pixels + (size_t)box[1] * w->width + box[0];
+    uint8_t *raw = canvas__png_raw(&rgba, origin, w->width, box[2], box[3], &raw_size);
+    if (!raw) return -1;
+    // the first frame is the default image (IDAT), the rest carry a sequence number (fdAT)
+    size_t prefix = w->num_frames == 0 ? 0 : 4;
+    uint8_t *z = canvas__zlib_stored(raw, raw_size, prefix, &z_size);
+    free(raw);
+    if (!z) return -1;
+
+    int rc = canvas__apng_write_fctl(w, box);
+    if (rc == 0 && prefix) {
+        canvas__put_be32(z, w->sequence++);
+        rc = write_chunk(w->f, "fdAT", z, (uint32_t)z_size);
+    } else if (rc == 0) {
+        rc = write_chunk(w->f, "IDAT", z, (uint32_t)z_size);
+    }
+    free(z);
+    if (rc != 0) return -1;
+
+    for (uint32_t y = box[1]; y < box[1] + box[3]; ++y) {
+        size_t off = (size_t)y * w->width + box[0];
+        memcpy(w->prev + off, c->pixels + off, box[2] * sizeof(uint32_t));
+    }
+    w->num_frames++;
+    return 0;
+}
+
+CANVASDEF int apng_end(ApngWriter *w) {
+    if (!w) return -1;
+    uint8_t actl[8] = {0};
+    canvas__put_be32(actl, w->num_frames);
+    int rc = w->num_frames > 0 ? 0 : -1; // an APNG needs at least the default image
+    if (rc == 0) rc = canvas__rewrite_chunk(w->f, w->actl_pos, "acTL", actl, 8);
+    if (rc == 0) rc = write_chunk(w->f, "IEND", NULL, 0);
+    if (fclose(w->f) != 0) rc = -1;
+    free(w->prev);
+    free(w);
+    return rc;
+}
+
+/* ---------- PNG export queue ---------- */
+struct canvas__PngJob {
+    canvas__PngJob *next;
+    const uint32_t *pixels;
+    uint32_t width, height;
+    int owned;          // free the pixels when done
+    size_t bytes;
+    char *filename;     // stored right after the job
+};
+
+CANVASDEF int canvas__png_job_run(PngExportQueue *q, canvas__PngJob *job) {
+    int rc = write_png_from_rgba32_ex(job->filename, job->pixels, job->width, job->height, q->mode);
+    if (q->callback) q->callback(q->user, job->filename, rc);
+    if (job->owned) free((void *)job->pixels);
+    free(job);
+    return rc;
+}
+
+#ifdef CANVAS_HAS_THREADS
+CANVASDEF void *canvas__png_export_worker(void *arg) {
+    PngExportQueue *q = (PngExportQueue *)arg;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->head && !q->stopping) pthread_cond_wait(&q->changed, &q->lock);
+        canvas__PngJob *job = q->head;
+        if (!job) break;
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+        size_t bytes = job->bytes;
+        pthread_mutex_unlock(&q->lock);
+
+        int rc = canvas__png_job_run(q, job);
+
+        pthread_mutex_lock(&q->lock);
+        q->bytes -= bytes;
+        q->pending--;
+        if (rc != 0) q->failed = 1;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+#endif // CANVAS_HAS_THREADS
+
+CANVASDEF PngExportQueue *png_export_start(size_t max_bytes, PngColorMode mode, PngExportCallback callback, void *user) {
+    PngExportQueue *q = (PngExportQueue *)malloc(sizeof(*q));
+    if (!q) return NULL;
+    q->mode = mode;
+    q->callback = callback;
+    q->user = user;
+    q->max_bytes = max_bytes;
+    q->bytes = 0;
+    q->pending = 0;
+    q->failed = 0;
+    // built once here, so the workers only ever read it
+    make_crc32_table();
+#ifdef CANVAS_HAS_THREADS
+    q->workers = 0;
+    q->stopping = 0;
+    q->head = q->tail = NULL;
+    if (pthread_mutex_init(&q->lock, NULL) != 0) {
+        free(q);
+        return NULL;
+    }
+    if (pthread_cond_init(&q->changed, NULL) != 0) {
+        pthread_mutex_destroy(&q->lock);
+        free(q);
+        return NULL;
+    }
+    while (q->workers < CANVAS__WORKERS &&
+           pthread_create(&q->threads[q->workers], NULL, canvas__png_export_worker, q) == 0) {
+        q->workers++;
+    }
+#endif // CANVAS_HAS_THREADS
+    return q;
+}
+
+CANVASDEF int png_export_submit(PngExportQueue *q, const char *filename, const uint32_t *pixels, uint32_t width, uint32_t height, PngExportOwnership ownership) {
+    if (!q || !filename || !pixels || width == 0 || height == 0) return -1;
+    size_t name_len = strlen(filename) + 1;
+    size_t bytes = (size_t)width * height * sizeof(uint32_t);
+    canvas__PngJob *job = (canvas__PngJob *)malloc(sizeof(*job) + name_len);
+    if (!job) return -1;
+    job->next = NULL;
+    job->width = width;
+    job->height = height;
+    job->bytes = bytes;
+    job->filename = (char *)(job + 1);
+    memcpy(job->filename, filename, name_len);
+    job->pixels = pixels;
+    job->owned = ownership == PNG_EXPORT_TAKE;
+
+#ifdef CANVAS_HAS_THREADS
+    if (q->workers > 0) {
+        // wait for room before copying, so the copy itself stays within the budget
+        pthread_mutex_lock(&q->lock);
+        while (q->bytes > 0 && q->bytes + bytes > q->max_bytes) pthread_cond_wait(&q->changed, &q->lock);
+        q->bytes += bytes;
+        q->pending++;
+        pthread_mutex_unlock(&q->lock);
+
+        if (ownership == PNG_EXPORT_COPY) {
+            uint32_t *copy = (uint32_t *)malloc(bytes);
+            if (!copy) {
+                free(job);
+                pthread_mutex_lock(&q->lock);
+                q->bytes -= bytes;
+                q->pending--;
+                pthread_cond_broadcast(&q->changed);
+                pthread_mutex_unlock(&q->lock);
+                return -1;
+            }
+            memcpy(copy, pixels, bytes);
+            job->pixels = copy;
+            job->owned = 1;
+        }
+
+        pthread_mutex_lock(&q->lock);
+        if (q->tail) q->tail->next = job;
+        else q->head = job;
+        q->tail = job;
+        pthread_cond_broadcast(&q->changed);
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+#endif // CANVAS_HAS_THREADS
+
+    // no workers: the caller's buffer is only read before this returns, so nothing is copied
+    if (canvas__png_job_run(q, job) != 0) q->failed = 1;
+    return 0;
+}
+
+CANVASDEF int png_export_wait(PngExportQueue *q) {
+    if (!q) return -1;
+#ifdef CANVAS_HAS_THREADS
+    pthread_mutex_lock(&q->lock);
+    while (q->pending > 0) pthread_cond_wait(&q->changed, &q->lock);
+    int rc = q->failed ? -1 : 0;
+    q->failed = 0;
+    pthread_mutex_unlock(&q->lock);
+#else
+    int rc = q->failed ? -1 : 0;
+    q->failed = 0;
+#endif // CANVAS_HAS_THREADS
+    return rc;
+}
+
+CANVASDEF int png_export_end(PngExportQueue *q) {
+    if (!q) return -1;
+    int rc = png_export_wait(q);
+#ifdef CANVAS_HAS_THREADS
+    pthread_mutex_lock(&q->lock);
+    q->stopping = 1;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    for (size_t i = 0; i < q->workers; ++i) pthread_join(q->threads[i], NULL);
+    pthread_cond_destroy(&q->changed);
+    pthread_mutex_destroy(&q->lock);
+#endif // CANVAS_HAS_THREADS
+    free(q);
+    return rc;
+}
+
+CANVASDEF void canvas__rgb_to_yuv444(const uint32_t *pixels, size_t n, uint8_t *y_plane, uint8_t *u_plane, uint8_t *v_plane) {
+    for (size_t i = 0; i < n; i++) {
+        uint8_t r = (pixels[i] >> 24) & 0xFF;
+        uint8_t g = (pixels[i] >> 16) & 0xFF;
+        uint8_t b = (pixels[i] >> 8) & 0xFF;
+
+        y_plane[i] = (uint8_t)( 0.299 * r + 0.587 * g + 0.114 * b);
+        u_plane[i] = (uint8_t)(-0.169 * r - 0.331 * g + 0.5 * b + 128);
+        v_plane[i] = (uint8_t)( 0.5 * r - 0.419 * g - 0.081 * b + 128);
+    }
+}
+
+CANVASDEF Y4MWriter *y4m_start(const char *filename, size_t width, size_t height, int fps) {
+    Y4MWriter *w = (Y4MWriter*)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->fd = -1;
+
+#if defined(_MSC_VER)
+    if (fopen_s(&w->f, filename, "wb") != 0) {
+        free(w);
+        return NULL;
+    }
+#else
+    w->f = fopen(filename, "wb");
+    if (!w->f) {
+        free(w);
+        return NULL;
+    }
+#endif
+
+    w->width = width;
+    w->height = height;
+
+    // Allocate planes once
+    w->y_plane = (uint8_t*)malloc(width * height);
+    w->u_plane = (uint8_t*)malloc(width * height);
+    w->v_plane = (uint8_t*)malloc(width * height);
+    if (!w->y_plane || !w->u_plane || !w->v_plane) {
+        fclose(w->f);
+        free(w->y_plane);
+        free(w->u_plane);
+        free(w->v_plane);
+        free(w);
+        return NULL;
+    }
+
+    // Write YUV4MPEG2 header
+    fprintf(w->f, "YUV4MPEG2 W%lu H%lu F%d:1 Ip A1:1 C444\n", (unsigned long)width, (unsigned long)height, fps);
+    return w;
+}
+
+#ifdef CANVAS_HAS_MMAP
+// Makes [pos, pos + need) addressable, sliding the window and growing the file in CANVAS_Y4M_WINDOW extents.
+CANVASDEF int canvas__y4m_map(Y4MWriter *w, size_t need) {
+    if (w->map && w->pos + need <= w->map_off + w->map_len) return 0;
+    if (w->map) munmap(w->map, w->map_len);
+    w->map = NULL;
+
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t off = w->pos - w->pos % (uint64_t)(page > 0 ? page : 4096);
+    size_t len = (size_t)(w->pos - off) + need;
+    if (len < CANVAS_Y4M_WINDOW) len = CANVAS_Y4M_WINDOW;
+    if (off + len > w->reserved) {
+        if (ftruncate(w->fd, (off_t)(off + len)) != 0) return -1;
+        w->reserved = off + len;
+    }
+
+    void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, (off_t)off);
+    if (m == MAP_FAILED) return -1;
+#ifdef POSIX_MADV_SEQUENTIAL
+    posix_madvise(m, len, POSIX_MADV_SEQUENTIAL);
+#endif
+    w->map = (uint8_t*)m;
+    w->map_off = off;
+    w->map_len = len;
+    return 0;
+}
+#endif // CANVAS_HAS_MMAP
+
+/* Like y4m_start, but the file is preallocated for `frames` frames (0 = grow as needed)
+   and mapped, so each frame is converted directly into the page cache. Falls back to
+   y4m_start where mmap is unavailable. */
+CANVASDEF Y4MWriter *y4m_start_mapped(const char *filename, size_t width, size_t height, int fps, size_t frames) {
+#ifdef CANVAS_HAS_MMAP
+    if (!filename || width == 0 || height == 0) return NULL;
+    Y4MWriter *w = (Y4MWriter*)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->width = width;
+    w->height = height;
+    w->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        free(w);
+        return NULL;
+    }
+
+    char header[128];
+    int hlen = snprintf(header, sizeof header, "YUV4MPEG2 W%lu H%lu F%d:1 Ip A1:1 C444\n", (unsigned long)width, (unsigned long)height, fps);
+    uint64_t frame_size = 6 + 3 * (uint64_t)width * height;
+    if (frames > 0) {
+        uint64_t total = (uint64_t)hlen + frames * frame_size;
+        if (ftruncate(w->fd, (off_t)total) != 0) goto fail;
+#ifdef __linux__
+        // reserve the blocks up front; filesystems without support just keep the sparse file
+        posix_fallocate(w->fd, 0, (off_t)total);
+#endif
+        w->reserved = total;
+    }
+
+    if (canvas__y4m_map(w, (size_t)hlen) != 0) goto fail;
+    memcpy(w->map + (w->pos - w->map_off), header, (size_t)hlen);
+    w->pos += (uint64_t)hlen;
+    return w;
+
+fail:
+    if (w->map) munmap(w->map, w->map_len);
+    close(w->fd);
+    free(w);
+    return NULL;
+#else
+    (void)frames;
+    return y4m_start(filename, width, height, fps);
+#endif
+}
+
+CANVASDEF void y4m_write_frame(Y4MWriter *w, const Canvas *c) {
+    size_t n = w->width * w->height;
+#ifdef CANVAS_HAS_MMAP
+    if (w->fd >= 0) {
+        if (w->failed || canvas__y4m_map(w, 6 + 3 * n) != 0) {
+            w->failed = 1;
+            return;
+        }
+        uint8_t *dst = w->map + (w->pos - w->map_off);
+        memcpy(dst, "FRAME\n", 6);
+        canvas__rgb_to_yuv444(c->pixels, n, dst + 6, dst + 6 + n, dst + 6 + 2 * n);
+        w->pos += 6 + 3 * (uint64_t)n;
+        return;
+    }
+#endif
+    fprintf(w->f, "FRAME\n");
+
+    canvas__rgb_to_yuv444(c->pixels, n, w->y_plane, w->u_plane, w->v_plane);
+
+    fwrite(w->y_plane, 1, n, w->f);
+    fwrite(w->u_plane, 1, n, w->f);
+    fwrite(w->v_plane, 1, n, w->f);
+}
+
+CANVASDEF void y4m_end(Y4MWriter *w) {
+    if (!w) return;
+#ifdef CANVAS_HAS_MMAP
+    if (w->fd >= 0) {
+        if (w->map) munmap(w->map, w->map_len);
+        // drop the unused tail of the last extent or of an over-estimated frame count
+        if (ftruncate(w->fd, (off_t)w->pos) != 0) w->failed = 1;
+        close(w->fd);
+        free(w);
+        return;
+    }
+#endif
+    fclose(w->f);
+    free(w->y_plane);
+    free(w->u_plane);
+    free(w->v_plane);
+    free(w);
+}
+
+#define CANVAS__Y4M_LINE_MAX 4096   // longest stream or frame header accepted
+#define CANVAS__YUV_CHUNK 256       // pixels converted per stack-buffered chunk
+
+CANVASDEF int canvas__y4m_parse_header(Y4MReader *r, char *line) {
+    if (strncmp(line, "YUV4MPEG2 ", 10) != 0) return -1;
+    unsigned long w = 0, h = 0;
+    r->chroma = Y4M_420;        // the format's default when there is no C tag
+    r->fps_num = 0;
+    r->fps_den = 1;
+    for (char *tok = line + 10; *tok;) {
+        char *end = strchr(tok, ' ');
+        if (end) *end = '\0';
+        switch (tok[0]) {
+        case 'W': w = strtoul(tok + 1, NULL, 10); break;
+        case 'H': h = strtoul(tok + 1, NULL, 10); break;
+        case 'F': {
+            char *colon = NULL;
+            r->fps_num = (int)strtol(tok + 1, &colon, 10);
+            r->fps_den = *colon == ':' ? (int)strtol(colon + 1, NULL, 10) : 1;
+            break;
         }
+        case 'C':
+            if (strcmp(tok + 1, "444") == 0) r->chroma = Y4M_444;
+            else if (strcmp(tok + 1, "422") == 0) r->chroma = Y4M_422;
+            else if (strcmp(tok + 1, "420") == 0 || strcmp(tok + 1, "420jpeg") == 0 ||
+                     strcmp(tok + 1, "420mpeg2") == 0 || strcmp(tok + 1, "420paldv") == 0) r->chroma = Y4M_420;
+            else if (strcmp(tok + 1, "mono") == 0) r->chroma = Y4M_MONO;
+            else return -1;     // high bit depth, alpha and other layouts
+            break;
+        default: break;         // interlacing, aspect and X comments do not change the layout
+        }
+        if (!end) break;
+        tok = end + 1;
     }
+    if (w == 0 || h == 0 || w > SIZE_MAX / 3 / h) return -1;
+    r->width = w;
+    r->height = h;
+    r->chroma_width = r->chroma == Y4M_444 ? w : r->chroma == Y4M_MONO ? 0 : (w + 1) / 2;
+    r->chroma_height = r->chroma == Y4M_420 ? (h + 1) / 2 : r->chroma == Y4M_MONO ? 0 : h;
+    r->frame_bytes = w * h + 2 * r->chroma_width * r->chroma_height;
+    return 0;
+}
 
-    // ---- Build zlib stream (header + stored blocks + adler32) in a buffer ----
-    // zlib header: 0x78 0x01 (CM=8, CINFO=7, FCHECK/FDICT/FLEVEL appropriate for no preset)
-    // stored block format: [1 byte header][2 bytes LEN (LE)][2 bytes NLEN (LE)][data...]
-    // header byte: low 3 bits are BFINAL (bit0) and BTYPE (bits1-2). For stored and final -> 0x01
-    // For non-final stored blocks -> 0x00
+// Reads one '\n'-terminated line into line[CANVAS__Y4M_LINE_MAX]; -1 at end of stream or if too long.
+CANVASDEF int canvas__y4m_next_line(Y4MReader *r, char *line) {
+    size_t n = 0;
+    if (r->map) {
+        size_t left = r->map_len - r->pos;
+        const uint8_t *nl = (const uint8_t *)memchr(r->map + r->pos, '\n', left < CANVAS__Y4M_LINE_MAX ? left : CANVAS__Y4M_LINE_MAX);
+        if (!nl) return -1;
+        n = (size_t)(nl - (r->map + r->pos));
+        memcpy(line, r->map + r->pos, n);
+        r->pos += n + 1;
+    } else {
+        int ch;
+        while ((ch = getc(r->f)) != '\n') {
+            if (ch == EOF || n + 1 >= CANVAS__Y4M_LINE_MAX) return -1;
+            line[n++] = (char)ch;
+        }
+    }
+    line[n] = '\0';
+    return 0;
+}
 
-    // number of stored blocks:
-    const size_t MAX_STORED = 65535;
-    size_t nblocks = (raw_size + MAX_STORED - 1) / MAX_STORED;
+CANVASDEF Y4MReader *canvas__y4m_open(Y4MReader *r) {
+    char line[CANVAS__Y4M_LINE_MAX];
+    if (canvas__y4m_next_line(r, line) != 0 || canvas__y4m_parse_header(r, line) != 0) {
+        y4m_close(r);
+        return NULL;
+    }
+    if (!r->map) {
+        r->buf = (uint8_t*)malloc(r->frame_bytes);
+        if (!r->buf) {
+            y4m_close(r);
+            return NULL;
+        }
+    }
+    return r;
+}
 
-    // idat_size = 2 (zlib header) + raw_size + nblocks*5 (each stored block has 1 header byte + 2 LEN + 2 NLEN)
-    // plus 4 bytes Adler32
-    size_t idat_size = 2 + raw_size + nblocks * 5 + 4;
-    uint8_t *idat = (uint8_t*)malloc(idat_size);
-    if (!idat) {
-        perror("malloc idat");
-        free(raw);
-        goto fail;
+CANVASDEF Y4MReader *y4m_open_stream(FILE *f) {
+    if (!f) return NULL;
+    Y4MReader *r = (Y4MReader*)calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->f = f;
+    return canvas__y4m_open(r);
+}
+
+CANVASDEF Y4MReader *y4m_open(const char *filename) {
+    if (!filename) return NULL;
+#ifdef CANVAS_HAS_MMAP
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) return NULL;
+#ifdef POSIX_MADV_SEQUENTIAL
+        posix_madvise(m, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+        Y4MReader *r = (Y4MReader*)calloc(1, sizeof(*r));
+        if (!r) {
+            munmap(m, (size_t)st.st_size);
+            return NULL;
+        }
+        r->map = (const uint8_t*)m;
+        r->map_len = (size_t)st.st_size;
+        return canvas__y4m_open(r);
+    }
+    close(fd);  // a FIFO or device: stream it
+#endif // CANVAS_HAS_MMAP
+    FILE *f;
+#if defined(_MSC_VER)
+    if (fopen_s(&f, filename, "rb") != 0) return NULL;
+#else
+    f = fopen(filename, "rb");
+    if (!f) return NULL;
+#endif
+    Y4MReader *r = y4m_open_stream(f);
+    if (!r) {
+        fclose(f);
+        return NULL;
     }
+    r->close_f = 1;
+    return r;
+}
 
-    size_t pos = 0;
-    // zlib header
-    idat[pos++] = 0x78;
-    idat[pos++] = 0x01;
+CANVASDEF int y4m_read_frame(Y4MReader *r) {
+    if (!r) return -1;
+    if (r->map ? r->pos >= r->map_len : (ungetc(getc(r->f), r->f) == EOF)) return 0;
 
-    // stored blocks
-    size_t remaining = raw_size;
-    size_t offset = 0;
-    for (size_t bi = 0; bi < nblocks; ++bi) {
-        uint16_t this_len = (uint16_t)(remaining > MAX_STORED ? MAX_STORED : remaining);
-        uint16_t nlen = (uint16_t)(~this_len);
+    char line[CANVAS__Y4M_LINE_MAX];
+    if (canvas__y4m_next_line(r, line) != 0) return -1;
+    if (strncmp(line, "FRAME", 5) != 0 || (line[5] != '\0' && line[5] != ' ')) return -1;
 
-        uint8_t header_byte = (bi == nblocks - 1) ? 0x01 : 0x00; // final? -> 1 : 0 ; BTYPE=00 so 0x01 or 0x00
-        idat[pos++] = header_byte;
+    const uint8_t *data;
+    if (r->map) {
+        if (r->map_len - r->pos < r->frame_bytes) return -1;
+        data = r->map + r->pos;
+        r->pos += r->frame_bytes;
+    } else {
+        if (fread(r->buf, 1, r->frame_bytes, r->f) != r->frame_bytes) return -1;
+        data = r->buf;
+    }
+    size_t n = r->width * r->height, nc = r->chroma_width * r->chroma_height;
+    r->y = data;
+    r->u = nc ? data + n : NULL;
+    r->v = nc ? data + n + nc : NULL;
+    r->frames++;
+    return 1;
+}
 
-        // write LEN and NLEN (little-endian)
-        idat[pos++] = (uint8_t)(this_len & 0xFF);
-        idat[pos++] = (uint8_t)((this_len >> 8) & 0xFF);
-        idat[pos++] = (uint8_t)(nlen & 0xFF);
-        idat[pos++] = (uint8_t)((nlen >> 8) & 0xFF);
+/* Full-range BT.601, the inverse of canvas__rgb_to_yuv444, in Q14 fixed point. The
+   loop is branch-free integer arithmetic over contiguous bytes so the compiler can
+   vectorise it; subsampled chroma is widened into u, v first. */
+CANVASDEF void canvas__yuv444_to_rgb(const uint8_t *y, const uint8_t *u, const uint8_t *v, size_t n, uint32_t *out) {
+    const int32_t top = (256 << 14) - 1;
+    for (size_t i = 0; i < n; ++i) {
+        int32_t l = ((int32_t)y[i] << 14) + (1 << 13);
+        int32_t cu = (int32_t)u[i] - 128, cv = (int32_t)v[i] - 128;
+        int32_t r = l + 22970 * cv;
+        int32_t g = l - 5638 * cu - 11700 * cv;
+        int32_t b = l + 29032 * cu;
+        r = r < 0 ? 0 : r > top ? top : r;
+        g = g < 0 ? 0 : g > top ? top : g;
+        b = b < 0 ? 0 : b > top ? top : b;
+        out[i] = (uint32_t)(r >> 14) << 24 | (uint32_t)(g >> 14) << 16 | (uint32_t)(b >> 14) << 8 | 0xFF;
+    }
+}
 
-        // copy block data
-        memcpy(idat + pos, raw + offset, this_len);
-        pos += this_len;
-        offset += this_len;
-        remaining -= this_len;
+typedef struct {
+    const Y4MReader *r;
+    Canvas *c;
+} canvas__Y4MJob;
+
+CANVASDEF void canvas__y4m_rows(void *ctx, size_t worker, size_t begin, size_t end) {
+    (void)worker;
+    canvas__Y4MJob *job = (canvas__Y4MJob *)ctx;
+    const Y4MReader *r = job->r;
+    uint8_t us[CANVAS__YUV_CHUNK], vs[CANVAS__YUV_CHUNK];
+    if (r->chroma == Y4M_MONO) {
+        memset(us, 128, sizeof us);
+        memset(vs, 128, sizeof vs);
+    }
+    for (size_t row = begin; row < end; ++row) {
+        const uint8_t *yrow = r->y + row * r->width;
+        uint32_t *out = job->c->pixels + row * job->c->width;
+        size_t crow = (r->chroma == Y4M_420 ? row / 2 : row) * r->chroma_width;
+        if (r->chroma == Y4M_444) {
+            canvas__yuv444_to_rgb(yrow, r->u + crow, r->v + crow, r->width, out);
+            continue;
+        }
+        for (size_t x = 0; x < r->width; x += CANVAS__YUV_CHUNK) {
+            size_t n = r->width - x < CANVAS__YUV_CHUNK ? r->width - x : CANVAS__YUV_CHUNK;
+            if (r->chroma != Y4M_MONO) {
+                // nearest-sample upsampling: each chroma sample covers two luma columns
+                const uint8_t *uc = r->u + crow + x / 2, *vc = r->v + crow + x / 2;
+                for (size_t i = 0; i < n; ++i) {
+                    us[i] = uc[i / 2];
+                    vs[i] = vc[i / 2];
+                }
+            }
+            canvas__yuv444_to_rgb(yrow + x, us, vs, n, out + x);
+        }
     }
+}
 
-    // adler32 (big-endian)
-    uint32_t adl = adler32(raw, raw_size);
-    idat[pos++] = (adl >> 24) & 0xFF;
-    idat[pos++] = (adl >> 16) & 0xFF;
-    idat[pos++] = (adl >> 8) & 0xFF;
-    idat[pos++] = adl & 0xFF;
-
-    if (pos != idat_size) {
-        fprintf(stderr, "inconsistent idat size: pos=%lu idat_size=%lu\n", (unsigned long)pos, (unsigned long)idat_size);
-        free(idat);
-        free(raw);
-        goto fail;
+// Converts the current frame into c, which must have the stream's size. Rows are split across CANVAS_THREADS.
+CANVASDEF int y4m_frame_to_canvas(const Y4MReader *r, Canvas *c) {
+    if (!r || !r->y || !c || !c->pixels || c->width != r->width || c->height != r->height) return -1;
+    canvas__Y4MJob job;
+    job.r = r;
+    job.c = c;
+    canvas__parallel_for(r->height, canvas__y4m_rows, &job);
+    return 0;
+}
+
+CANVASDEF void y4m_close(Y4MReader *r) {
+    if (!r) return;
+#ifdef CANVAS_HAS_MMAP
+    if (r->map) munmap((void*)r->map, r->map_len);
+#endif
+    if (r->close_f) fclose(r->f);
+    free(r->buf);
+    free(r);
+}
+
+/* ---------- frame ring ---------- */
+/* Shared layout; every part starts on its own cache line so slots never share one:
+     [0, 64)                      canvas__RingHeader
+     [64, 64 + 64 * slots)        canvas__RingSlot per slot
+     then slots * slot_bytes      pixels, slot i holds frames i, i + slots, ... */
+#ifdef CANVAS_HAS_FRAME_RING
+#define CANVAS__RING_MAGIC 0x43565247u  // "CVRG"
+#define CANVAS__RING_VERSION 1u
+#define CANVAS__RING_LINE 64
+/* ThreadSanitizer rejects atomic_thread_fence. It only sees threads of one process, and
+   ring readers are other processes, so under it the reader's fence becomes an acquire load. */
+#if defined(__SANITIZE_THREAD__)
+#define CANVAS__TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CANVAS__TSAN 1
+#endif
+#endif
+
+typedef struct {
+    uint32_t magic;         // stored last with release: the ring is initialised once it matches
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t slots;
+    uint32_t closed;        // set by the producer's frame_ring_close
+    uint64_t slot_bytes;
+    uint64_t published;     // frames published so far; frame n lives in slot n % slots
+} canvas__RingHeader;
+
+typedef struct {
+    uint64_t seq;           // odd while the producer writes the slot
+    uint64_t frame;         // frame number of the slot's last published contents
+} canvas__RingSlot;
+
+CANVASDEF canvas__RingHeader *canvas__ring_header(const FrameRing *r) {
+    return (canvas__RingHeader *)r->map;
+}
+
+CANVASDEF canvas__RingSlot *canvas__ring_slot(const FrameRing *r, size_t i) {
+    return (canvas__RingSlot *)(r->map + CANVAS__RING_LINE * (1 + i));
+}
+
+CANVASDEF uint32_t *canvas__ring_pixels(const FrameRing *r, size_t i) {
+    return (uint32_t *)(r->map + CANVAS__RING_LINE * (1 + r->slots) + i * r->slot_bytes);
+}
+
+// Mapping size for the given geometry, 0 if it does not fit in size_t.
+CANVASDEF size_t canvas__ring_size(size_t width, size_t height, size_t slots, size_t *slot_bytes) {
+    if (width == 0 || height == 0 || width > SIZE_MAX / 4 / height) return 0;
+    size_t bytes = width * height * 4;
+    if (bytes > SIZE_MAX - CANVAS__RING_LINE) return 0;
+    bytes = (bytes + CANVAS__RING_LINE - 1) / CANVAS__RING_LINE * CANVAS__RING_LINE;
+    size_t head = CANVAS__RING_LINE * (1 + slots);
+    if (bytes > (SIZE_MAX - head) / slots) return 0;
+    *slot_bytes = bytes;
+    return head + slots * bytes;
+}
+
+/* Creates (replacing any stale ring of the same name) and maps a ring of `slots` frames,
+   at least 2 so consumers can read one slot while the next is drawn. */
+CANVASDEF FrameRing *frame_ring_create(const char *name, size_t width, size_t height, size_t slots) {
+    size_t slot_bytes = 0, len;
+    if (!name || slots < 2 || slots > CANVAS_FRAME_RING_MAX_SLOTS || width > 0xFFFFFFFF || height > 0xFFFFFFFF) return NULL;
+    if ((len = canvas__ring_size(width, height, slots, &slot_bytes)) == 0) return NULL;
+    // consumers still attached to an old ring keep their mapping; new ones see this one
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    void *m = MAP_FAILED;
+    if (ftruncate(fd, (off_t)len) == 0) m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    size_t name_len = strlen(name);
+    FrameRing *r = m != MAP_FAILED ? (FrameRing*)calloc(1, sizeof(*r)) : NULL;
+    if (r) r->name = (char*)malloc(name_len + 1);
+    if (!r || !r->name) {
+        if (m != MAP_FAILED) munmap(m, len);
+        free(r);
+        shm_unlink(name);
+        return NULL;
     }
+    memcpy(r->name, name, name_len + 1);
+    r->map = (uint8_t*)m;
+    r->map_len = len;
+    r->width = width;
+    r->height = height;
+    r->slots = slots;
+    r->slot_bytes = slot_bytes;
 
-    // ---- Write IDAT chunk ----
-    if (write_chunk(f, "IDAT", idat, (uint32_t)idat_size) != 0) {
-        free(idat);
-        free(raw);
-        goto fail;
+    // the new object is zero-filled: every slot is even (idle) with no frame yet
+    canvas__RingHeader *h = canvas__ring_header(r);
+    h->version = CANVAS__RING_VERSION;
+    h->width = (uint32_t)width;
+    h->height = (uint32_t)height;
+    h->slots = (uint32_t)slots;
+    h->slot_bytes = slot_bytes;
+    for (size_t i = 0; i < slots; ++i) canvas__ring_slot(r, i)->frame = UINT64_MAX;
+    __atomic_store_n(&h->magic, CANVAS__RING_MAGIC, __ATOMIC_RELEASE);
+    return r;
+}
+
+// Maps an existing ring read-only. NULL if it does not exist or is not initialised yet.
+CANVASDEF FrameRing *frame_ring_open(const char *name) {
+    if (!name) return NULL;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= CANVAS__RING_LINE && (uint64_t)st.st_size <= SIZE_MAX) {
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
     }
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
 
-    free(idat);
-    free(raw);
+    FrameRing *r = (FrameRing*)calloc(1, sizeof(*r));
+    if (!r) {
+        munmap(m, (size_t)st.st_size);
+        return NULL;
+    }
+    r->map = (uint8_t*)m;
+    r->map_len = (size_t)st.st_size;
+    const canvas__RingHeader *h = canvas__ring_header(r);
+    size_t slot_bytes = 0;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != CANVAS__RING_MAGIC || h->version != CANVAS__RING_VERSION ||
+        h->slots < 2 || h->slots > CANVAS_FRAME_RING_MAX_SLOTS ||
+        canvas__ring_size(h->width, h->height, h->slots, &slot_bytes) != r->map_len || slot_bytes != h->slot_bytes) {
+        frame_ring_close(r);
+        return NULL;
+    }
+    r->width = h->width;
+    r->height = h->height;
+    r->slots = h->slots;
+    r->slot_bytes = slot_bytes;
+    return r;
+}
 
-    // ---- IEND chunk (zero-length) ----
-    if (write_chunk(f, "IEND", NULL, 0) != 0) goto fail;
+CANVASDEF int frame_ring_begin(FrameRing *r, Canvas *out) {
+    if (!out) return -1;
+    *out = create_canvas(0, 0, NULL);
+    if (!r || !r->name) return -1;
+    canvas__RingHeader *h = canvas__ring_header(r);
+    size_t slot = (size_t)(h->published % r->slots);
+    if (!r->writing) {
+        canvas__RingSlot *s = canvas__ring_slot(r, slot);
+        // odd: readers holding this slot will see the change; as an acquire the increment
+        // also keeps the pixel stores that follow from moving ahead of it
+        __atomic_fetch_add(&s->seq, 1, __ATOMIC_ACQ_REL);
+        r->writing = 1;
+    }
+    *out = create_canvas(r->width, r->height, canvas__ring_pixels(r, slot));
+    return 0;
+}
 
-    fclose(f);
+CANVASDEF int frame_ring_publish(FrameRing *r) {
+    if (!r || !r->writing) return -1;
+    canvas__RingHeader *h = canvas__ring_header(r);
+    uint64_t n = h->published;
+    canvas__RingSlot *s = canvas__ring_slot(r, (size_t)(n % r->slots));
+    __atomic_store_n(&s->frame, n, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->published, n + 1, __ATOMIC_RELEASE);
+    r->writing = 0;
     return 0;
+}
 
-fail:
-    if (f) fclose(f);
+// Takes frame n if its slot still holds it and is not being rewritten.
+CANVASDEF int canvas__ring_take(const FrameRing *r, uint64_t n, FrameRingFrame *out) {
+    canvas__RingSlot *s = canvas__ring_slot(r, (size_t)(n % r->slots));
+    uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || __atomic_load_n(&s->frame, __ATOMIC_RELAXED) != n) return 0;
+    out->canvas = create_canvas(r->width, r->height, canvas__ring_pixels(r, (size_t)(n % r->slots)));
+    out->frame = n;
+    out->seq = seq;
+    return 1;
+}
+
+/* Next frame for a consumer that wants every frame, starting from *cursor (0 at first).
+   A consumer that fell more than slots - 1 frames behind skips to the oldest frame still
+   in the ring; out->frame tells how many were missed. Returns 1 and advances *cursor,
+   0 if nothing new has been published, -1 once the producer closed and all was read. */
+CANVASDEF int frame_ring_next(const FrameRing *r, uint64_t *cursor, FrameRingFrame *out) {
+    if (!r || !cursor || !out) return -1;
+    const canvas__RingHeader *h = canvas__ring_header(r);
+    for (;;) {
+        int closed = (int)__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE);
+        uint64_t published = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+        if (*cursor >= published) return closed ? -1 : 0;
+        // the slot of frame `published` may be mid-rewrite, so the oldest safe one is after it
+        uint64_t oldest = published >= r->slots ? published - r->slots + 1 : 0;
+        uint64_t n = *cursor < oldest ? oldest : *cursor;
+        if (canvas__ring_take(r, n, out)) {
+            *cursor = n + 1;
+            return 1;
+        }
+        *cursor = n + 1;    // lapped between the two loads: retry from the new head
+    }
+}
+
+// Newest published frame, for viewers that only ever show the latest one. 0 if none yet.
+CANVASDEF int frame_ring_latest(const FrameRing *r, FrameRingFrame *out) {
+    if (!r || !out) return -1;
+    const canvas__RingHeader *h = canvas__ring_header(r);
+    for (int tries = 0; tries < 4; ++tries) {
+        uint64_t published = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+        if (published == 0) return 0;
+        if (canvas__ring_take(r, published - 1, out)) return 1;
+    }
+    return 0;   // the producer is lapping the whole ring faster than we can look
+}
+
+/* 1 if f's pixels were not touched since it was taken, i.e. whatever was read from
+   them in between is a whole frame. Call after reading, before trusting the result. */
+CANVASDEF int frame_ring_check(const FrameRing *r, const FrameRingFrame *f) {
+    if (!r || !f) return 0;
+    const canvas__RingSlot *s = canvas__ring_slot(r, (size_t)(f->frame % r->slots));
+#ifdef CANVAS__TSAN
+    return __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == f->seq;
+#else
+    // the caller's plain pixel loads must finish before seq is re-read. An acquire load
+    // only orders what comes after it and the mapping is read-only, so no RMW either:
+    // this takes a fence, which ThreadSanitizer does not support (see CANVAS__TSAN)
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == f->seq;
+#endif
+}
+
+// Unmaps the ring; the producer also marks it closed and removes the name.
+CANVASDEF void frame_ring_close(FrameRing *r) {
+    if (!r) return;
+    if (r->name) {
+        __atomic_store_n(&canvas__ring_header(r)->closed, 1, __ATOMIC_RELEASE);
+        shm_unlink(r->name);
+    }
+    if (r->map) munmap(r->map, r->map_len);
+    free(r->name);
+    free(r);
+}
+#else
+// not opted in, or no shm_open and mmap: no ring can be created or opened, so nothing else is reachable
+CANVASDEF FrameRing *frame_ring_create(const char *name, size_t width, size_t height, size_t slots) {
+    (void)name; (void)width; (void)height; (void)slots;
+    return NULL;
+}
+
+CANVASDEF FrameRing *frame_ring_open(const char *name) {
+    (void)name;
+    return NULL;
+}
+
+CANVASDEF int frame_ring_begin(FrameRing *r, Canvas *out) {
+    (void)r;
+    if (out) *out = create_canvas(0, 0, NULL);
     return -1;
 }
 
-CANVASDEF Y4MWriter *y4m_start(const char *filename, size_t width, size_t height, int fps) {
-    Y4MWriter *w = malloc(sizeof(*w));
-    if (!w) return NULL;
+CANVASDEF int frame_ring_publish(FrameRing *r) {
+    (void)r;
+    return -1;
+}
+
+CANVASDEF int frame_ring_next(const FrameRing *r, uint64_t *cursor, FrameRingFrame *out) {
+    (void)r; (void)cursor; (void)out;
+    return -1;
+}
+
+CANVASDEF int frame_ring_latest(const FrameRing *r, FrameRingFrame *out) {
+    (void)r; (void)out;
+    return -1;
+}
+
+CANVASDEF int frame_ring_check(const FrameRing *r, const FrameRingFrame *f) {
+    (void)r; (void)f;
+    return 0;
+}
+
+CANVASDEF void frame_ring_close(FrameRing *r) {
+    (void)r;
+}
+#endif // CANVAS_HAS_FRAME_RING
 
+/* ---------- tiled canvas ---------- */
+#define CANVAS__TILE_PIXELS ((size_t)CANVAS_TILE_SIZE * CANVAS_TILE_SIZE)
+
+CANVASDEF int canvas__fseek64(FILE *f, uint64_t off) {
 #if defined(_MSC_VER)
-    if (fopen_s(&w->f, filename, "wb") != 0) {
-        free(w);
+    return _fseeki64(f, (__int64)off, SEEK_SET);
+#elif defined(CANVAS__POSIX)
+    // <stdio.h> declares fseeko and off_t wherever POSIX.1-2001 is visible, mmap or not
+    return fseeko(f, (off_t)off, SEEK_SET);
+#else
+    return (uint64_t)(long)off != off ? -1 : fseek(f, (long)off, SEEK_SET);
+#endif
+}
+
+CANVASDEF TiledCanvas *tiled_canvas_create(uint64_t width, uint64_t height, uint32_t background, size_t cache_tiles) {
+    if (width == 0 || height == 0 || cache_tiles == 0) return NULL;
+    TiledCanvas *tc = (TiledCanvas*)calloc(1, sizeof(*tc));
+    if (!tc) return NULL;
+    tc->width = width;
+    tc->height = height;
+    tc->tiles_x = (width + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+    tc->tiles_y = (height + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+    tc->background = background;
+    tc->max_resident = cache_tiles;
+    tc->last_index = UINT64_MAX;
+    uint64_t count = tc->tiles_x * tc->tiles_y;
+    if (count > SIZE_MAX / sizeof(TiledCanvasTile)) {
+        free(tc);
         return NULL;
     }
-#else
-    w->f = fopen(filename, "wb");
-    if (!w->f) {
-        free(w);
+    tc->tiles = (TiledCanvasTile*)calloc((size_t)count, sizeof(TiledCanvasTile));
+    tc->resident = (uint64_t*)malloc(cache_tiles * sizeof(uint64_t));
+    if (!tc->tiles || !tc->resident) {
+        tiled_canvas_destroy(tc);
         return NULL;
     }
-#endif
+    return tc;
+}
 
-    w->width = width;
-    w->height = height;
+CANVASDEF void tiled_canvas_destroy(TiledCanvas *tc) {
+    if (!tc) return;
+    for (size_t i = 0; tc->tiles && i < tc->resident_count; ++i) free(tc->tiles[tc->resident[i]].pixels);
+    if (tc->scratch) fclose(tc->scratch);
+    free(tc->tiles);
+    free(tc->resident);
+    free(tc);
+}
 
-    // Allocate planes once
-    w->y_plane = malloc(width * height);
-    w->u_plane = malloc(width * height);
-    w->v_plane = malloc(width * height);
-    if (!w->y_plane || !w->u_plane || !w->v_plane) {
-        fclose(w->f);
-        free(w->y_plane);
-        free(w->u_plane);
-        free(w->v_plane);
-        free(w);
-        return NULL;
+CANVASDEF void tiled_clear_background(TiledCanvas *tc, uint32_t color) {
+    if (!tc) return;
+    // every tile goes back to "never drawn", nothing is touched on disk
+    for (size_t i = 0; i < tc->resident_count; ++i) free(tc->tiles[tc->resident[i]].pixels);
+    memset(tc->tiles, 0, (size_t)(tc->tiles_x * tc->tiles_y) * sizeof(TiledCanvasTile));
+    tc->resident_count = 0;
+    tc->last_index = UINT64_MAX;
+    tc->last_pixels = NULL;
+    tc->background = color;
+}
+
+CANVASDEF int canvas__tiled_spill(TiledCanvas *tc, uint64_t index) {
+    TiledCanvasTile *t = &tc->tiles[index];
+    if (!tc->scratch) {
+        tc->scratch = tmpfile();
+        if (!tc->scratch) return -1;
+        setvbuf(tc->scratch, NULL, _IONBF, 0); // whole tiles or row slices, stdio buffering only adds copies
+    }
+    if (canvas__fseek64(tc->scratch, index * CANVAS__TILE_PIXELS * sizeof(uint32_t)) != 0) return -1;
+    if (fwrite(t->pixels, sizeof(uint32_t), CANVAS__TILE_PIXELS, tc->scratch) != CANVAS__TILE_PIXELS) return -1;
+    t->spilled = 1;
+    t->dirty = 0;
+    return 0;
+}
+
+/* Returns the pixels of a tile, loading it into the cache if needed. Reads of
+   tiles that were never drawn return NULL, meaning "all background". */
+CANVASDEF uint32_t *canvas__tiled_tile(TiledCanvas *tc, uint64_t tx, uint64_t ty, int write) {
+    uint64_t index = ty * tc->tiles_x + tx;
+    if (write && index == tc->last_index) return tc->last_pixels;
+    TiledCanvasTile *t = &tc->tiles[index];
+
+    if (!t->pixels) {
+        if (!write && !t->spilled) return NULL;
+        uint32_t *buf = NULL;
+        if (tc->resident_count < tc->max_resident) {
+            buf = (uint32_t*)malloc(CANVAS__TILE_PIXELS * sizeof(uint32_t));
+            if (!buf) {
+                tc->failed = 1;
+                return NULL;
+            }
+            tc->resident[tc->resident_count++] = index;
+        } else {
+            // evict the least recently used tile
+            size_t lru = 0;
+            for (size_t i = 1; i < tc->resident_count; ++i) {
+                if (tc->tiles[tc->resident[i]].last_use < tc->tiles[tc->resident[lru]].last_use) lru = i;
+            }
+            uint64_t victim = tc->resident[lru];
+            if (tc->tiles[victim].dirty && canvas__tiled_spill(tc, victim) != 0) {
+                tc->failed = 1;
+                return NULL;
+            }
+            buf = tc->tiles[victim].pixels;
+            tc->tiles[victim].pixels = NULL;
+            tc->resident[lru] = index;
+            tc->last_index = UINT64_MAX;
+            tc->last_pixels = NULL;
+        }
+
+        if (t->spilled) {
+            if (canvas__fseek64(tc->scratch, index * CANVAS__TILE_PIXELS * sizeof(uint32_t)) != 0 ||
+                fread(buf, sizeof(uint32_t), CANVAS__TILE_PIXELS, tc->scratch) != CANVAS__TILE_PIXELS) {
+                tc->failed = 1;
+            }
+        } else {
+            for (size_t i = 0; i < CANVAS__TILE_PIXELS; ++i) buf[i] = tc->background;
+        }
+        t->pixels = buf;
     }
 
-    // Write YUV4MPEG2 header
-    fprintf(w->f, "YUV4MPEG2 W%lu H%lu F%d:1 Ip A1:1 C444\n", (unsigned long)width, (unsigned long)height, fps);
-    return w;
+    t->last_use = ++tc->clock;
+    if (write) {
+        t->dirty = 1;
+        tc->last_index = index;
+        tc->last_pixels = t->pixels;
+    }
+    return t->pixels;
 }
 
-CANVASDEF void y4m_write_frame(Y4MWriter *w, const Canvas *c) {
-    fprintf(w->f, "FRAME\n");
+CANVASDEF void tiled_putpixel(TiledCanvas *tc, int64_t x, int64_t y, uint32_t color) {
+    if (!tc) return;
+    if (x < 0 || y < 0 || (uint64_t)x >= tc->width || (uint64_t)y >= tc->height) return;
+    uint32_t *px = canvas__tiled_tile(tc, (uint64_t)x / CANVAS_TILE_SIZE, (uint64_t)y / CANVAS_TILE_SIZE, 1);
+    if (px) px[(size_t)(y % CANVAS_TILE_SIZE) * CANVAS_TILE_SIZE + (size_t)(x % CANVAS_TILE_SIZE)] = color;
+}
+
+CANVASDEF uint32_t tiled_getpixel(TiledCanvas *tc, int64_t x, int64_t y, uint32_t fallback) {
+    if (!tc) return fallback;
+    if (x < 0 || y < 0 || (uint64_t)x >= tc->width || (uint64_t)y >= tc->height) return fallback;
+    uint32_t *px = canvas__tiled_tile(tc, (uint64_t)x / CANVAS_TILE_SIZE, (uint64_t)y / CANVAS_TILE_SIZE, 0);
+    if (!px) return tc->background;
+    return px[(size_t)(y % CANVAS_TILE_SIZE) * CANVAS_TILE_SIZE + (size_t)(x % CANVAS_TILE_SIZE)];
+}
 
-    for (size_t i = 0; i < w->width * w->height; i++) {
-        uint8_t r = (c->pixels[i] >> 24) & 0xFF;
-        uint8_t g = (c->pixels[i] >> 16) & 0xFF;
-        uint8_t b = (c->pixels[i] >> 8) & 0xFF;
+// Fills the clipped, inclusive box [x0, x1] x [y0, y1] one tile at a time.
+CANVASDEF void canvas__tiled_fill(TiledCanvas *tc, uint64_t x0, uint64_t y0, uint64_t x1, uint64_t y1, uint32_t color) {
+    for (uint64_t ty = y0 / CANVAS_TILE_SIZE; ty <= y1 / CANVAS_TILE_SIZE; ++ty) {
+        uint64_t ty0 = ty * CANVAS_TILE_SIZE;
+        size_t ry0 = (size_t)((y0 > ty0 ? y0 : ty0) - ty0);
+        size_t ry1 = (size_t)((y1 < ty0 + CANVAS_TILE_SIZE - 1 ? y1 : ty0 + CANVAS_TILE_SIZE - 1) - ty0);
+        for (uint64_t tx = x0 / CANVAS_TILE_SIZE; tx <= x1 / CANVAS_TILE_SIZE; ++tx) {
+            uint64_t tx0 = tx * CANVAS_TILE_SIZE;
+            size_t rx0 = (size_t)((x0 > tx0 ? x0 : tx0) - tx0);
+            size_t rx1 = (size_t)((x1 < tx0 + CANVAS_TILE_SIZE - 1 ? x1 : tx0 + CANVAS_TILE_SIZE - 1) - tx0);
+            uint32_t *px = canvas__tiled_tile(tc, tx, ty, 1);
+            if (!px) return;
+            for (size_t ry = ry0; ry <= ry1; ++ry) {
+                uint32_t *row = px + ry * CANVAS_TILE_SIZE;
+                for (size_t rx = rx0; rx <= rx1; ++rx) row[rx] = color;
+            }
+        }
+    }
+}
 
-        w->y_plane[i] = (uint8_t)( 0.299 * r + 0.587 * g + 0.114 * b);
-        w->u_plane[i] = (uint8_t)(-0.169 * r - 0.331 * g + 0.5 * b + 128);
-        w->v_plane[i] = (uint8_t)( 0.5 * r - 0.419 * g - 0.081 * b + 128);
+CANVASDEF void tiled_hline(TiledCanvas *tc, int64_t x0, int64_t x1, int64_t y, uint32_t color) {
+    if (!tc) return;
+    if (y < 0 || (uint64_t)y >= tc->height) return;
+    if (x0 > x1) {
+        int64_t t = x0;
+        x0 = x1;
+        x1 = t;
     }
+    if (x1 < 0 || (x0 >= 0 && (uint64_t)x0 >= tc->width)) return;
+    if (x0 < 0) x0 = 0;
+    if ((uint64_t)x1 >= tc->width) x1 = (int64_t)(tc->width - 1);
+    canvas__tiled_fill(tc, (uint64_t)x0, (uint64_t)y, (uint64_t)x1, (uint64_t)y, color);
+}
 
-    fwrite(w->y_plane, 1, w->width * w->height, w->f);
-    fwrite(w->u_plane, 1, w->width * w->height, w->f);
-    fwrite(w->v_plane, 1, w->width * w->height, w->f);
+CANVASDEF void tiled_vline(TiledCanvas *tc, int64_t x, int64_t y0, int64_t y1, uint32_t color) {
+    if (!tc) return;
+    if (x < 0 || (uint64_t)x >= tc->width) return;
+    if (y0 > y1) {
+        int64_t t = y0;
+        y0 = y1;
+        y1 = t;
+    }
+    if (y1 < 0 || (y0 >= 0 && (uint64_t)y0 >= tc->height)) return;
+    if (y0 < 0) y0 = 0;
+    if ((uint64_t)y1 >= tc->height) y1 = (int64_t)(tc->height - 1);
+    canvas__tiled_fill(tc, (uint64_t)x, (uint64_t)y0, (uint64_t)x, (uint64_t)y1, color);
 }
 
-CANVASDEF void y4m_end(Y4MWriter *w) {
-    if (!w) return;
-    fclose(w->f);
-    free(w->y_plane);
-    free(w->u_plane);
-    free(w->v_plane);
-    free(w);
+#define CANVAS__TILED_EXACT ((uint64_t)1 << 31)  // longest extent stepped in exact 64-bit Bresenham
+
+// floor(a * b / c + 1 / 2) through a 128-bit product; needs a <= c
+CANVASDEF uint64_t canvas__muldiv64(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t al = a & 0xFFFFFFFFu, ah = a >> 32, bl = b & 0xFFFFFFFFu, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl;
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFFu) + (hl & 0xFFFFFFFFu);
+    uint64_t lo = (ll & 0xFFFFFFFFu) | (mid << 32);
+    uint64_t hi = ah * bh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    // shift-subtract division; hi < c keeps the quotient within 64 bits
+    for (int i = 0; i < 64; ++i) {
+        uint64_t carry = hi >> 63;
+        hi = (hi << 1) | (lo >> 63);
+        lo <<= 1;
+        if (carry || hi >= c) {
+            hi -= c;
+            lo |= 1;
+        }
+    }
+    return hi >= c - hi ? lo + 1 : lo;
+}
+
+// the y of line (ax, ay)-(bx, by) at x, which lies between ax and bx; swap the axes for x at y
+CANVASDEF int64_t canvas__tiled_cut(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t x) {
+    uint64_t run = bx > ax ? (uint64_t)bx - (uint64_t)ax : (uint64_t)ax - (uint64_t)bx;
+    uint64_t rise = by > ay ? (uint64_t)by - (uint64_t)ay : (uint64_t)ay - (uint64_t)by;
+    uint64_t part = x > ax ? (uint64_t)x - (uint64_t)ax : (uint64_t)ax - (uint64_t)x;
+    uint64_t off = canvas__muldiv64(part, rise, run);
+    return (int64_t)(by > ay ? (uint64_t)ay + off : (uint64_t)ay - off);
+}
+
+CANVASDEF int canvas__tiled_outcode(int64_t x, int64_t y, int64_t xmax, int64_t ymax) {
+    return (x < -1) | (x > xmax) << 1 | (y < -1) << 2 | (y > ymax) << 3;
+}
+
+/* Cohen-Sutherland against [-1, xmax] x [-1, ymax]. Every cut is taken from the original
+   line in exact integers, so ends anywhere in int64_t land within half a pixel of it. */
+CANVASDEF int canvas__tiled_clip(int64_t *x0, int64_t *y0, int64_t *x1, int64_t *y1, int64_t xmax, int64_t ymax) {
+    int64_t ax = *x0, ay = *y0, bx = *x1, by = *y1;
+    for (int i = 0; i < 4; ++i) {
+        int c0 = canvas__tiled_outcode(*x0, *y0, xmax, ymax), c1 = canvas__tiled_outcode(*x1, *y1, xmax, ymax);
+        if (!(c0 | c1)) return 1;
+        if (c0 & c1) return 0;
+        int c = c0 ? c0 : c1;
+        int64_t *px = c0 ? x0 : x1, *py = c0 ? y0 : y1;
+        if (c & 3) {
+            *px = c & 1 ? -1 : xmax;
+            *py = canvas__tiled_cut(ax, ay, bx, by, *px);
+        } else {
+            *py = c & 4 ? -1 : ymax;
+            *px = canvas__tiled_cut(ay, ax, by, bx, *py);
+        }
+    }
+    // rounding can leave a corner-grazing end outside; such a line misses the canvas
+    return !(canvas__tiled_outcode(*x0, *y0, xmax, ymax) | canvas__tiled_outcode(*x1, *y1, xmax, ymax));
+}
+
+/* Bresenham from (x0, y0) to (x1, y1), both extents below CANVAS__TILED_EXACT. Only the
+   steps near the canvas are walked: after a steps along the major axis the minor offset
+   is a * minor / major rounded half up, which gives the state to start from. */
+CANVASDEF void canvas__tiled_segment(TiledCanvas *tc, int64_t x0, int64_t y0, int64_t x1, int64_t y1,
+                                     int64_t xmax, int64_t ymax, uint32_t color) {
+    int64_t dx = x1 > x0 ? x1 - x0 : x0 - x1, sx = x0 < x1 ? 1 : -1;
+    int64_t dy = y1 > y0 ? y1 - y0 : y0 - y1, sy = y0 < y1 ? 1 : -1;
+    int64_t n = dx > dy ? dx : dy;
+    int64_t cx0 = x0, cy0 = y0, cx1 = x1, cy1 = y1;
+    if (!canvas__tiled_clip(&cx0, &cy0, &cx1, &cy1, xmax, ymax)) return;
+    int64_t m0 = dx >= dy ? cx0 - x0 : cy0 - y0, m1 = dx >= dy ? cx1 - x0 : cy1 - y0;
+    // a step of margin on each side covers the rounding of the cuts
+    int64_t k0 = (m0 < 0 ? -m0 : m0) - 2, k1 = (m1 < 0 ? -m1 : m1) + 2;
+    if (k0 < 0) k0 = 0;
+    if (k1 > n) k1 = n;
+    int64_t a, b;
+    if (dx >= dy) {
+        a = k0;
+        b = dx ? (2 * dy * k0 + dx) / (2 * dx) : 0;
+    } else {
+        b = k0;
+        a = (2 * dx * k0 + dy) / (2 * dy);
+    }
+    int64_t x = x0 + sx * a, y = y0 + sy * b;
+    int64_t err = dx - dy + b * dx - a * dy;
+    for (int64_t k = k0;; ++k) {
+        tiled_putpixel(tc, x, y, color);
+        if (k >= k1) break;
+        int64_t e2 = 2 * err;
+        if (e2 >= -dy) {
+            err -= dy;
+            x += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y += sy;
+        }
+    }
+}
+
+CANVASDEF void tiled_line(TiledCanvas *tc, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t color) {
+    if (!tc) return;
+    int64_t xmax = tc->width > INT64_MAX ? INT64_MAX : (int64_t)tc->width;
+    int64_t ymax = tc->height > INT64_MAX ? INT64_MAX : (int64_t)tc->height;
+    // extents in uint64_t: the difference of far-apart int64_t ends overflows int64_t
+    uint64_t dx = x1 > x0 ? (uint64_t)x1 - (uint64_t)x0 : (uint64_t)x0 - (uint64_t)x1;
+    uint64_t dy = y1 > y0 ? (uint64_t)y1 - (uint64_t)y0 : (uint64_t)y0 - (uint64_t)y1;
+    if (dx < CANVAS__TILED_EXACT && dy < CANVAS__TILED_EXACT) {
+        canvas__tiled_segment(tc, x0, y0, x1, y1, xmax, ymax, color);
+        return;
+    }
+    // longer lines start from their clipped ends, split into pieces the exact walk can step
+    if (!canvas__tiled_clip(&x0, &y0, &x1, &y1, xmax, ymax)) return;
+    dx = x1 > x0 ? (uint64_t)x1 - (uint64_t)x0 : (uint64_t)x0 - (uint64_t)x1;
+    dy = y1 > y0 ? (uint64_t)y1 - (uint64_t)y0 : (uint64_t)y0 - (uint64_t)y1;
+    uint64_t pieces = (dx > dy ? dx : dy) / (CANVAS__TILED_EXACT / 2) + 1;
+    int64_t px = x0, py = y0;
+    for (uint64_t i = 1; i <= pieces; ++i) {
+        double t = (double)i / (double)pieces;
+        int64_t qx = i == pieces ? x1 : x0 + (int64_t)(t * (double)(x1 - x0));
+        int64_t qy = i == pieces ? y1 : y0 + (int64_t)(t * (double)(y1 - y0));
+        canvas__tiled_segment(tc, px, py, qx, qy, xmax, ymax, color);
+        px = qx;
+        py = qy;
+    }
+}
+
+CANVASDEF void tiled_rect_fill(TiledCanvas *tc, Rectangle rec, uint32_t color) {
+    if (!tc || rec.w == 0 || rec.h == 0) return;
+    if (rec.x >= tc->width || rec.y >= tc->height) return;
+    uint64_t x1 = rec.w > tc->width - rec.x ? tc->width - 1 : rec.x + rec.w - 1;
+    uint64_t y1 = rec.h > tc->height - rec.y ? tc->height - 1 : rec.y + rec.h - 1;
+    canvas__tiled_fill(tc, rec.x, rec.y, x1, y1, color);
+}
+
+CANVASDEF int64_t canvas__add_sat64(int64_t a, int64_t b) {
+    if (b > 0 && a > INT64_MAX - b) return INT64_MAX;
+    if (b < 0 && a < INT64_MIN - b) return INT64_MIN;
+    return a + b;
+}
+
+// floor(sqrt(v)), digit by digit
+CANVASDEF uint64_t canvas__isqrt64(uint64_t v) {
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+/* Half-width of the span d rows from the centre, matching canvas_circle_fill: its
+   midpoint walk keeps pixel (x, y) when a * (a - 1) + b * b < r * r, with a the larger
+   of |x| and |y| and b the smaller. Beyond CANVAS__TILED_EXACT the products leave 64
+   bits and the half-pixel terms are below double precision, so plain sqrt is used. */
+CANVASDEF int64_t canvas__tiled_circle_half(int64_t r, int64_t d) {
+    if ((uint64_t)r < CANVAS__TILED_EXACT) {
+        uint64_t rr = (uint64_t)r * (uint64_t)r, dd = (uint64_t)d * (uint64_t)d;
+        if (2 * dd - (uint64_t)d < rr) return (int64_t)((canvas__isqrt64(4 * (rr - dd) - 3) + 1) / 2);
+        return (int64_t)canvas__isqrt64(rr - (dd - (uint64_t)d) - 1);
+    }
+    double v = (double)(r - d) * ((double)r + (double)d);
+    double x = (double)canvas__sqrtf((float)v);
+    if (x <= 0) return 0;
+    x = 0.5 * (x + v / x);
+    x = 0.5 * (x + v / x);
+    return x < (double)r ? (int64_t)x : r;
+}
+
+CANVASDEF void tiled_circle_fill(TiledCanvas *tc, int64_t cx, int64_t cy, int64_t r, uint32_t color) {
+    if (!tc || r <= 0) return;
+    // only the rows on the canvas, one span each; sums saturate instead of overflowing
+    int64_t top = canvas__add_sat64(cy, -r), bottom = canvas__add_sat64(cy, r);
+    if (bottom < 0 || (top >= 0 && (uint64_t)top >= tc->height)) return;
+    if (top < 0) top = 0;
+    if ((uint64_t)bottom >= tc->height) bottom = (int64_t)(tc->height - 1);
+    for (int64_t y = top;; ++y) {
+        int64_t half = canvas__tiled_circle_half(r, y > cy ? y - cy : cy - y);
+        tiled_hline(tc, canvas__add_sat64(cx, -half), canvas__add_sat64(cx, half), y, color);
+        if (y == bottom) break;
+    }
+}
+
+/* Runs `draw` once per tile overlapping `bounds`, so any Canvas primitive can
+   render into a tiled canvas. Coordinates inside `draw` are tile-local. */
+CANVASDEF void tiled_canvas_draw(TiledCanvas *tc, Rectangle bounds, TiledDrawFn draw, void *user) {
+    if (!tc || !draw || bounds.w == 0 || bounds.h == 0) return;
+    if (bounds.x >= tc->width || bounds.y >= tc->height) return;
+    uint64_t x1 = bounds.w > tc->width - bounds.x ? tc->width - 1 : bounds.x + bounds.w - 1;
+    uint64_t y1 = bounds.h > tc->height - bounds.y ? tc->height - 1 : bounds.y + bounds.h - 1;
+    for (uint64_t ty = bounds.y / CANVAS_TILE_SIZE; ty <= y1 / CANVAS_TILE_SIZE; ++ty) {
+        for (uint64_t tx = bounds.x / CANVAS_TILE_SIZE; tx <= x1 / CANVAS_TILE_SIZE; ++tx) {
+            uint32_t *px = canvas__tiled_tile(tc, tx, ty, 1);
+            if (!px) return;
+            Canvas tile = create_canvas(CANVAS_TILE_SIZE, CANVAS_TILE_SIZE, px);
+            draw(&tile, (int64_t)(tx * CANVAS_TILE_SIZE), (int64_t)(ty * CANVAS_TILE_SIZE), user);
+        }
+    }
+}
+
+/* Copies one image row out without going through the cache, so streaming the
+   whole image does not evict the working set: resident tiles are copied,
+   spilled tiles are read straight from the scratch file. */
+CANVASDEF int tiled_canvas_read_row(TiledCanvas *tc, uint64_t y, uint32_t *row) {
+    if (!tc || !row || y >= tc->height) return -1;
+    uint64_t ty = y / CANVAS_TILE_SIZE;
+    size_t ry = (size_t)(y % CANVAS_TILE_SIZE);
+    for (uint64_t tx = 0; tx < tc->tiles_x; ++tx) {
+        uint64_t index = ty * tc->tiles_x + tx;
+        const TiledCanvasTile *t = &tc->tiles[index];
+        uint32_t *dst = row + tx * CANVAS_TILE_SIZE;
+        size_t n = (size_t)(tc->width - tx * CANVAS_TILE_SIZE < CANVAS_TILE_SIZE ? tc->width - tx * CANVAS_TILE_SIZE : CANVAS_TILE_SIZE);
+        if (t->pixels) {
+            memcpy(dst, t->pixels + ry * CANVAS_TILE_SIZE, n * sizeof(uint32_t));
+        } else if (t->spilled) {
+            uint64_t off = (index * CANVAS__TILE_PIXELS + ry * CANVAS_TILE_SIZE) * sizeof(uint32_t);
+            if (canvas__fseek64(tc->scratch, off) != 0 || fread(dst, sizeof(uint32_t), n, tc->scratch) != n) return -1;
+        } else {
+            for (size_t i = 0; i < n; ++i) dst[i] = tc->background;
+        }
+    }
+    return 0;
+}
+
+/* Streams the image out row by row. PNG_COLOR_AUTO reads the image twice (analysis,
+   then encoding); PNG_COLOR_INDEXED behaves like AUTO since quantizing would
+   need the whole image. */
+CANVASDEF int tiled_canvas_write_png(TiledCanvas *tc, const char *filename, PngColorMode mode) {
+    if (!tc || !filename || tc->failed || tc->width > 0x7FFFFFFF || tc->height > 0x7FFFFFFF) return -1;
+    uint32_t width = (uint32_t)tc->width, height = (uint32_t)tc->height;
+    uint32_t *row = (uint32_t*)malloc((size_t)width * sizeof(uint32_t));
+    PngFormat *fmt = (PngFormat*)malloc(sizeof(PngFormat));
+    if (!row || !fmt) {
+        free(row);
+        free(fmt);
+        return -1;
+    }
+
+    int rc = 0;
+    canvas__PngScan sc;
+    canvas__png_scan_init(fmt, &sc);
+    if (mode != PNG_COLOR_RGBA) {
+        for (uint32_t y = 0; rc == 0 && y < height; ++y) {
+            rc = tiled_canvas_read_row(tc, y, row);
+            if (rc == 0) canvas__png_scan(fmt, &sc, row, width);
+        }
+        mode = PNG_COLOR_AUTO;
+    }
+    if (rc == 0) rc = canvas__png_scan_finish(fmt, &sc, NULL, width, height, mode);
+
+    PngStream s;
+    if (rc == 0) rc = png_stream_begin(&s, filename, width, height, fmt);
+    if (rc == 0) {
+        for (uint32_t y = 0; rc == 0 && y < height; ++y) {
+            rc = tiled_canvas_read_row(tc, y, row);
+            if (rc == 0) rc = png_stream_write_row(&s, row);
+        }
+        if (png_stream_end(&s) != 0) rc = -1;
+    }
+
+    png_format_free(fmt);
+    free(fmt);
+    free(row);
+    return rc;
 }
 
 #endif // CANVAS_IMPLEMENTATION
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // CANVAS_H_
\ No newline at end of file
@@ -0,0 +1,220 @@
+#ifndef CANVAS_HPP_
+#define CANVAS_HPP_
+
+/*
+   C++17 wrapper over canvas.h. Include it wherever canvas.h would go (define
+   CANVAS_IMPLEMENTATION in one translation unit as usual).
+
+   canvas::Canvas owns or borrows a heap buffer, canvas::StaticCanvas keeps a
+   compile-time sized one inline (stack or static storage). Both take:
+     - Format: the channel layout, packed and unpacked with constexpr code.
+     - Access: Checked clips every put/get/hline, Unchecked trusts the caller,
+       so inner loops compile to bare stores.
+   begin()/end() are raw pixel pointers and work with the std::execution
+   algorithms. as_c() hands the buffer to the C API, which assumes RGBA8888.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "canvas.h"
+
+namespace canvas {
+
+// One 8-bit channel at each bit shift of a uint32_t pixel.
+template <int R, int G, int B, int A>
+struct PackedFormat {
+    static constexpr uint32_t pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+        return (uint32_t)r << R | (uint32_t)g << G | (uint32_t)b << B | (uint32_t)a << A;
+    }
+    static constexpr uint8_t r(uint32_t p) { return (uint8_t)(p >> R); }
+    static constexpr uint8_t g(uint32_t p) { return (uint8_t)(p >> G); }
+    static constexpr uint8_t b(uint32_t p) { return (uint8_t)(p >> B); }
+    static constexpr uint8_t a(uint32_t p) { return (uint8_t)(p >> A); }
+    // to and from the C API's 0xRRGGBBAA
+    static constexpr uint32_t to_rgba(uint32_t p) {
+        return (uint32_t)r(p) << 24 | (uint32_t)g(p) << 16 | (uint32_t)b(p) << 8 | a(p);
+    }
+    static constexpr uint32_t from_rgba(uint32_t p) {
+        return pack((uint8_t)(p >> 24), (uint8_t)(p >> 16), (uint8_t)(p >> 8), (uint8_t)p);
+    }
+};
+
+using RGBA8888 = PackedFormat<24, 16, 8, 0>;   // 0xRRGGBBAA, what canvas.h draws
+using ARGB8888 = PackedFormat<16, 8, 0, 24>;   // 0xAARRGGBB
+using ABGR8888 = PackedFormat<0, 8, 16, 24>;   // R, G, B, A bytes in memory on little-endian
+using BGRA8888 = PackedFormat<8, 16, 24, 0>;   // B, G, R, A bytes in memory on big-endian
+
+struct Checked {
+    static constexpr bool checked = true;
+};
+
+struct Unchecked {
+    static constexpr bool checked = false;
+};
+
+// A contiguous run of pixels, e.g. one row.
+struct PixelSpan {
+    uint32_t *first;
+    size_t count;
+
+    uint32_t *begin() const { return first; }
+    uint32_t *end() const { return first + count; }
+    size_t size() const { return count; }
+    uint32_t &operator[](size_t i) const { return first[i]; }
+};
+
+// Shared accessors; Derived provides pixels(), width() and height().
+template <class Derived, class Format, class Access>
+class CanvasBase {
+public:
+    using format = Format;
+    using access = Access;
+    using value_type = uint32_t;
+    using iterator = uint32_t *;
+    using const_iterator = const uint32_t *;
+
+    size_t size() const { return self().width() * self().height(); }
+    iterator begin() { return self().pixels(); }
+    iterator end() { return self().pixels() + size(); }
+    const_iterator begin() const { return self().pixels(); }
+    const_iterator end() const { return self().pixels() + size(); }
+
+    PixelSpan row(size_t y) { return PixelSpan{self().pixels() + y * self().width(), self().width()}; }
+
+    bool contains(int x, int y) const {
+        return x >= 0 && y >= 0 && (size_t)x < self().width() && (size_t)y < self().height();
+    }
+
+    void put(int x, int y, uint32_t color) {
+        if constexpr (Access::checked) {
+            if (!contains(x, y)) return;
+        }
+        self().pixels()[(size_t)y * self().width() + (size_t)x] = color;
+    }
+
+    uint32_t get(int x, int y, uint32_t fallback = 0) const {
+        if constexpr (Access::checked) {
+            if (!contains(x, y)) return fallback;
+        }
+        (void)fallback;
+        return self().pixels()[(size_t)y * self().width() + (size_t)x];
+    }
+
+    // inclusive of both ends, like canvas_hline
+    void hline(int x0, int x1, int y, uint32_t color) {
+        if (x0 > x1) std::swap(x0, x1);
+        if constexpr (Access::checked) {
+            if (y < 0 || (size_t)y >= self().height() || x1 < 0 || (x0 >= 0 && (size_t)x0 >= self().width())) return;
+            if (x0 < 0) x0 = 0;
+            if ((size_t)x1 >= self().width()) x1 = (int)(self().width() - 1);
+        }
+        std::fill_n(self().pixels() + (size_t)y * self().width() + (size_t)x0, (size_t)(x1 - x0 + 1), color);
+    }
+
+    void rect_fill(int x, int y, int w, int h, uint32_t color) {
+        if (w <= 0 || h <= 0) return;   // hline would swap the ends and paint x + w - 1 .. x
+        for (int j = y; j < y + h; ++j) hline(x, x + w - 1, j, color);
+    }
+
+    void fill(uint32_t color) { std::fill(begin(), end(), color); }
+
+    // Borrowed C view for the rest of canvas.h; its colours are RGBA8888.
+    ::Canvas as_c() const { return create_canvas(self().width(), self().height(), const_cast<uint32_t *>(self().pixels())); }
+
+    int write_png(const char *filename, PngColorMode mode = PNG_COLOR_AUTO) const {
+        if (self().width() > 0xFFFFFFFF || self().height() > 0xFFFFFFFF) return -1;
+        uint32_t w = (uint32_t)self().width(), h = (uint32_t)self().height();
+        if constexpr (std::is_same<Format, RGBA8888>::value) {
+            return write_png_from_rgba32_ex(filename, self().pixels(), w, h, mode);
+        } else {
+            std::unique_ptr<uint32_t[]> rgba(new uint32_t[size()]);
+            std::transform(begin(), end(), rgba.get(), Format::to_rgba);
+            return write_png_from_rgba32_ex(filename, rgba.get(), w, h, mode);
+        }
+    }
+
+private:
+    const Derived &self() const { return static_cast<const Derived &>(*this); }
+    Derived &self() { return static_cast<Derived &>(*this); }
+};
+
+template <class Format = RGBA8888, class Access = Checked>
+class Canvas : public CanvasBase<Canvas<Format, Access>, Format, Access> {
+public:
+    Canvas() = default;
+
+    // owning, cleared to 0
+    Canvas(size_t width, size_t height)
+        : owned_(new uint32_t[width * height]()), pixels_(owned_.get()), width_(width), height_(height) {}
+
+    static Canvas borrow(uint32_t *pixels, size_t width, size_t height) {
+        Canvas c;
+        c.pixels_ = pixels;
+        c.width_ = width;
+        c.height_ = height;
+        return c;
+    }
+
+    static Canvas borrow(const ::Canvas &c) { return borrow(c.pixels, c.width, c.height); }
+
+    Canvas(Canvas &&other) noexcept { *this = std::move(other); }
+
+    Canvas &operator=(Canvas &&other) noexcept {
+        owned_ = std::move(other.owned_);
+        pixels_ = std::exchange(other.pixels_, nullptr);
+        width_ = std::exchange(other.width_, 0);
+        height_ = std::exchange(other.height_, 0);
+        return *this;
+    }
+
+    bool owns() const { return owned_ != nullptr; }
+    uint32_t *pixels() { return pixels_; }
+    const uint32_t *pixels() const { return pixels_; }
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+
+private:
+    std::unique_ptr<uint32_t[]> owned_;
+    uint32_t *pixels_ = nullptr;
+    size_t width_ = 0, height_ = 0;
+};
+
+template <size_t W, size_t H, class Format = RGBA8888, class Access = Checked>
+class StaticCanvas : public CanvasBase<StaticCanvas<W, H, Format, Access>, Format, Access> {
+public:
+    static_assert(W > 0 && H > 0, "StaticCanvas needs a non-empty size");
+
+    uint32_t *pixels() { return pixels_; }
+    const uint32_t *pixels() const { return pixels_; }
+    static constexpr size_t width() { return W; }
+    static constexpr size_t height() { return H; }
+
+private:
+    uint32_t pixels_[W * H] = {};
+};
+
+// Copies the overlapping top-left area, repacking between formats.
+template <class Dst, class Src>
+void convert(Dst &dst, const Src &src) {
+    using From = typename Src::format;
+    using To = typename Dst::format;
+    size_t w = std::min(dst.width(), src.width()), h = std::min(dst.height(), src.height());
+    for (size_t y = 0; y < h; ++y) {
+        const uint32_t *s = src.pixels() + y * src.width();
+        uint32_t *d = dst.pixels() + y * dst.width();
+        if constexpr (std::is_same<From, To>::value) {
+            std::copy(s, s + w, d);
+        } else {
+            std::transform(s, s + w, d, [](uint32_t p) { return To::from_rgba(From::to_rgba(p)); });
+        }
+    }
+}
+
+} // namespace canvas
+
+#endif // CANVAS_HPP_
@@ -0,0 +1,43 @@
+#define CANVAS_IMPLEMENTATION
+#include "../canvas.h"
+
+#define WIDTH 1600
+#define HEIGHT 900
+
+static uint32_t pixels[WIDTH * HEIGHT];
+
+int main() {
+    const int FPS = 30;
+    const int DURATION = 5;
+    const int RADIUS = 50;
+    const int total_frames = FPS * DURATION;
+
+    Canvas c = create_canvas(WIDTH, HEIGHT, pixels);
+    // Only the rectangle that changed since the previous frame is stored
+    ApngWriter *writer = apng_start("out.png", c.width, c.height, FPS);
+    if (!writer) {
+        fprintf(stderr, "Failed to open APNG\n");
+        return 1;
+    }
+
+    for (int frame = 0; frame < total_frames; frame++) {
+        // 0 → 1
+        float t = (float)frame / (total_frames - 1);
+
+        clear_background(&c, 0x3222DFF);
+
+        int x = (int)((RADIUS) + t * ((c.width - RADIUS) - RADIUS));
+        int y = c.height / 2;
+
+        canvas_circle_fill(&c, x, y, RADIUS, 0xFFFF00FF);
+
+        apng_write_frame(writer, &c);
+    }
+
+    if (apng_end(writer) != 0) {
+        fprintf(stderr, "Failed to write APNG\n");
+        return 1;
+    }
+    free_canvas(&c);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#define CANVAS_IMPLEMENTATION
+#include "../canvas.h"
+
+#define WIDTH 1600
+#define HEIGHT 900
+
+static uint32_t pixels[WIDTH * HEIGHT];
+static float field[WIDTH * HEIGHT];
+
+int main() {
+    const float sources[3][2] = {{400, 300}, {1100, 600}, {1300, 200}};
+
+    Canvas c = create_canvas(WIDTH, HEIGHT, pixels);
+    // Potential of three point sources: spans several orders of magnitude
+    float vmax = 0.0f;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            float v = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                float dx = x - sources[i][0], dy = y - sources[i][1];
+                v += 1.0f / (dx * dx + dy * dy + 1.0f);
+            }
+            field[y * WIDTH + x] = v;
+            if (v > vmax) vmax = v;
+        }
+    }
+
+    // Log scaling keeps the far field from collapsing into the first colour
+    Colormap cm;
+    colormap_builtin(&cm, COLORMAP_VIRIDIS, COLORMAP_LOG);
+    canvas_colormap_apply(&c, field, WIDTH, vmax * 1e-6f, vmax, &cm);
+
+    if (write_png_from_rgba32("out.png", c.pixels, c.width, c.height) != 0) {
+        fprintf(stderr, "Failed to write PNG\n");
+        return 1;
+    }
+    return 0;
+}
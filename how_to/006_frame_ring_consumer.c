@@ -0,0 +1,58 @@
+/*
+   Reference consumer for a shared-memory frame ring: dumps every frame it gets to
+   frame_00000.png, frame_00001.png, ... until the producer closes the ring (POSIX only).
+
+       cc -DCANVAS_FRAME_RING -o consumer 006_frame_ring_consumer.c   (add -lrt on glibc < 2.34)
+       ./consumer [/ring_name]
+
+   The producer side renders straight into the ring:
+
+       FrameRing *ring = frame_ring_create("/canvas_preview", 1600, 900, 4);
+       for (;;) {
+           Canvas c;
+           frame_ring_begin(ring, &c);
+           ... draw into c ...
+           frame_ring_publish(ring);
+       }
+       frame_ring_close(ring);
+*/
+#define CANVAS_FRAME_RING
+#define CANVAS_IMPLEMENTATION
+#include "../canvas.h"
+
+#include <time.h>
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "/canvas_preview";
+
+    // wait for the producer to create the ring
+    FrameRing *ring = NULL;
+    struct timespec pause = {0, 2000000};
+    while (!(ring = frame_ring_open(name))) nanosleep(&pause, NULL);
+    printf("%s: %lux%lu, %lu slots\n", name, (unsigned long)ring->width, (unsigned long)ring->height, (unsigned long)ring->slots);
+
+    uint64_t cursor = 0;
+    FrameRingFrame frame;
+    int rc;
+    while ((rc = frame_ring_next(ring, &cursor, &frame)) >= 0) {
+        if (rc == 0) {
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        // encode straight from the shared slot, then make sure it was not overwritten meanwhile
+        char filename[64];
+        snprintf(filename, sizeof filename, "frame_%05lu.png", (unsigned long)frame.frame);
+        const Canvas *c = &frame.canvas;
+        int written = write_png_from_rgba32(filename, c->pixels, (uint32_t)c->width, (uint32_t)c->height) == 0;
+        if (!frame_ring_check(ring, &frame)) {
+            // the producer lapped us while encoding: the file may mix two frames
+            remove(filename);
+            printf("frame %lu: overwritten while saving, dropped\n", (unsigned long)frame.frame);
+        } else if (written) {
+            printf("frame %lu -> %s\n", (unsigned long)frame.frame, filename);
+        }
+    }
+
+    frame_ring_close(ring);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define CANVASDEF static inline
 #define CANVAS_IMPLEMENTATION
@@ -7,6 +8,12 @@
 
 #include "test.h"
 
+// NaN made at run time: MSVC rejects the constant expression 0.0f / 0.0f (C2124)
+static float make_nan(void) {
+    volatile float zero = 0.0f;
+    return zero / zero;
+}
+
 int main(void) {
     uint32_t pix[H * W];
     Canvas c = create_canvas(W, H, pix);
@@ -105,6 +112,962 @@ int main(void) {
     canvas_triangle_fill(&c, 3, 2, 10, 6, 2, 9, RGBA(0, 0, 123, 255));
     ASSERT_TRUE(canvas_getpixel(&c, 5, 6, 0) != 0);
 
+    // rect fill with sizes that would wrap size_t clamps to the canvas
+    clear_background(&c, 0);
+    Rectangle huge = {W - 2, H - 2, (size_t)-1, (size_t)-1};
+    canvas_rect_fill(&c, huge, RGBA(5, 5, 5, 255));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), RGBA(5, 5, 5, 255));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 3, H - 1, 0), 0);
+    canvas_rect(&c, huge, RGBA(6, 6, 6, 255));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 2, H - 1, 0), RGBA(6, 6, 6, 255));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), RGBA(5, 5, 5, 255));
+
+    // polygon: a pentagram is solid under non-zero and hollow under even-odd
+    {
+        Vector2 star[5] = {{8, 0.5f}, {12.5f, 11.5f}, {1.5f, 4.5f}, {14.5f, 4.5f}, {3.5f, 11.5f}};
+        size_t star_n = 5;
+        clear_background(&c, 0);
+        ASSERT_EQ_I(canvas_polygon_fill(&c, star, &star_n, 1, FILL_NONZERO, RGB(1, 1, 1)), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 6, 0), RGB(1, 1, 1));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 2, 0), RGB(1, 1, 1));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), 0);
+        clear_background(&c, 0);
+        canvas_polygon_fill(&c, star, &star_n, 1, FILL_EVEN_ODD, RGB(1, 1, 1));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 2, 0), RGB(1, 1, 1));
+
+        // two contours: a square with a same-direction inner square stays solid
+        // under non-zero; reversing the inner one punches a hole under both rules
+        Vector2 rings[8] = {{1, 1}, {15, 1}, {15, 11}, {1, 11}, {5, 4}, {11, 4}, {11, 8}, {5, 8}};
+        size_t ring_n[2] = {4, 4};
+        clear_background(&c, 0);
+        canvas_polygon_fill(&c, rings, ring_n, 2, FILL_NONZERO, RGB(2, 2, 2));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), RGB(2, 2, 2));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 1, 0), RGB(2, 2, 2));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 15, 6, 0), 0); // right edge is exclusive
+        ASSERT_EQ_U32(canvas_getpixel(&c, 6, 11, 0), 0); // bottom edge is exclusive
+        Vector2 t = rings[5]; rings[5] = rings[7]; rings[7] = t;
+        clear_background(&c, 0);
+        canvas_polygon_fill(&c, rings, ring_n, 2, FILL_NONZERO, RGB(2, 2, 2));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 6, 0), RGB(2, 2, 2));
+
+        // random self-intersecting polygons match a per-pixel winding number,
+        // including parts that hang off the canvas
+        uint32_t seed = 12345;
+        Vector2 pts[40];
+        size_t pts_n = 40;
+        int mismatches = 0;
+        for (int round = 0; round < 20; ++round) {
+            for (size_t i = 0; i < pts_n; ++i) {
+                seed = seed * 1664525u + 1013904223u;
+                pts[i].x = (float)((int)(seed >> 16) % 26 - 5) + 0.25f;
+                seed = seed * 1664525u + 1013904223u;
+                pts[i].y = (float)((int)(seed >> 16) % 22 - 5) + 0.25f;
+            }
+            FillRule rule = round & 1 ? FILL_EVEN_ODD : FILL_NONZERO;
+            clear_background(&c, 0);
+            canvas_polygon_fill(&c, pts, &pts_n, 1, rule, RGB(3, 3, 3));
+            for (int y = 0; y < H; ++y) {
+                for (int x = 0; x < W; ++x) {
+                    double px = x + 0.5, py = y + 0.5;
+                    int wind = 0, tie = 0;
+                    for (size_t i = 0; i < pts_n; ++i) {
+                        Vector2 a = pts[i], b = pts[(i + 1) % pts_n];
+                        if ((a.y <= py) != (b.y <= py)) {
+                            double cx = a.x + (py - a.y) * (b.x - a.x) / (b.y - a.y);
+                            if (cx <= px) wind += b.y > a.y ? 1 : -1;
+                            if (cx > px - 1e-6 && cx < px + 1e-6) tie = 1; // edge through the centre
+                        }
+                    }
+                    int inside = rule == FILL_EVEN_ODD ? (wind & 1) : wind != 0;
+                    if (!tie && (canvas_getpixel(&c, x, y, 0) != 0) != inside) mismatches++;
+                }
+            }
+        }
+        ASSERT_EQ_I(mismatches, 0);
+    }
+
+    // paints
+    {
+        Paint paint;
+        GradientStop bw[2] = {{0.0f, RGB(0, 0, 0)}, {1.0f, RGBA(255, 255, 255, 0)}};
+        ASSERT_EQ_I(paint_linear(&paint, 0, 0, W, 0, bw, 2, SPREAD_PAD), 0);
+        clear_background(&c, 0);
+        Rectangle full = {0, 0, W, H};
+        canvas_rect_fill_paint(&c, full, &paint);
+        // ramp runs left to right, alpha interpolates with the colour
+        for (int x = 1; x < W; ++x) {
+            ASSERT_TRUE(canvas_getpixel(&c, x, 3, 0) >> 24 > canvas_getpixel(&c, x - 1, 3, 0) >> 24);
+        }
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), canvas_getpixel(&c, 0, H - 1, 0));
+        ASSERT_EQ_U32(canvas_getpixel(&c, W / 2, 0, 0) & 0xFF, 0x77);
+
+        // pad clamps to the end stops, repeat wraps, reflect mirrors
+        paint_linear(&paint, 4, 0, 8, 0, bw, 2, SPREAD_PAD);
+        canvas_hline_paint(&c, -100, 100, 0, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), RGB(0, 0, 0));
+        ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, 0, 0), RGBA(255, 255, 255, 0));
+        paint_linear(&paint, 4, 0, 8, 0, bw, 2, SPREAD_REPEAT);
+        canvas_hline_paint(&c, 0, W - 1, 1, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 5, 1, 0), canvas_getpixel(&c, 9, 1, 0));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 1, 0), canvas_getpixel(&c, 13, 1, 0));
+        paint_linear(&paint, 4, 0, 8, 0, bw, 2, SPREAD_REFLECT);
+        canvas_hline_paint(&c, 0, W - 1, 2, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 5, 2, 0), canvas_getpixel(&c, 10, 2, 0));
+
+        // the stepped ramp index matches evaluating every pixel directly
+        GradientStop three[3] = {{0.0f, RGB(255, 0, 0)}, {0.3f, RGB(0, 255, 0)}, {1.0f, RGB(0, 0, 255)}};
+        paint_linear(&paint, 1.5f, 2.0f, 13.0f, 9.5f, three, 3, SPREAD_PAD);
+        canvas_rect_fill_paint(&c, full, &paint);
+        int off = 0;
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                double dx = 11.5, dy = 7.5;
+                double t = ((x + 0.5 - 1.5) * dx + (y + 0.5 - 2.0) * dy) / (dx * dx + dy * dy);
+                int k = (int)(t * CANVAS_GRADIENT_LUT + (t < 0 ? -1 : 0));
+                k = k < 0 ? 0 : k >= CANVAS_GRADIENT_LUT ? CANVAS_GRADIENT_LUT - 1 : k;
+                uint32_t got = canvas_getpixel(&c, x, y, 0);
+                if (got != paint.lut[k] && (k == 0 || got != paint.lut[k - 1]) &&
+                    (k == CANVAS_GRADIENT_LUT - 1 || got != paint.lut[k + 1])) off++;
+            }
+        }
+        ASSERT_EQ_I(off, 0);
+
+        // radial: first stop at the centre, last stop from the radius on
+        ASSERT_EQ_I(paint_radial(&paint, 8.5f, 6.5f, 4, three, 3, SPREAD_PAD), 0);
+        canvas_rect_fill_paint(&c, full, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 6, 0) >> 16, 0xFF00);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), RGB(0, 0, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 6, 0), RGB(0, 0, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), canvas_getpixel(&c, 8, 5, 0)); // symmetric
+        ASSERT_EQ_I(paint_radial(&paint, 8, 6, 0, three, 3, SPREAD_PAD), -1);
+        ASSERT_EQ_I(paint_linear(&paint, 0, 0, 1, 1, three, 0, SPREAD_PAD), -1);
+
+        // a 3x2 pattern repeats from its origin in both directions
+        uint32_t tile_px[6] = {1, 2, 3, 4, 5, 6};
+        Canvas tile = create_canvas(3, 2, tile_px);
+        paint_pattern(&paint, &tile, -1, 1);
+        canvas_rect_fill_paint(&c, full, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), 5);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 1, 0), 1);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 14, 2, 0), 4);
+        // a canvas can be its own pattern: runs overlap their source but stay well defined
+        for (int x = 0; x < W; ++x) canvas_putpixel(&c, x, 0, (uint32_t)x);
+        paint_pattern(&paint, &c, 1, 0);
+        canvas_hline_paint(&c, 0, W - 1, 0, &paint);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), W - 1);
+        for (int x = 2; x < W; ++x) ASSERT_EQ_U32(canvas_getpixel(&c, x, 0, 0), (uint32_t)(x - 1));
+
+        // polygons take paints too; outside pixels are untouched
+        Vector2 tri[3] = {{0, 0}, {16, 0}, {0, 12}};
+        size_t tri_n = 3;
+        paint_solid(&paint, RGB(9, 8, 7));
+        clear_background(&c, 0);
+        ASSERT_EQ_I(canvas_polygon_fill_paint(&c, tri, &tri_n, 1, FILL_NONZERO, &paint), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 1, 0), RGB(9, 8, 7));
+        ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), 0);
+    }
+
+    // flood fill: a diagonal gap stops a 4-connected fill but not an 8-connected one
+    {
+        clear_background(&c, RGB(0, 0, 0));
+        canvas_line(&c, 0, 5, 5, 0, RGB(255, 255, 255));
+        ASSERT_EQ_I(canvas_flood_fill(&c, 0, 0, RGB(9, 9, 9), 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 1, 0), RGB(9, 9, 9));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 8, 0), RGB(0, 0, 0));
+        FloodStack fs;
+        ASSERT_EQ_I(flood_stack_init(&fs, 64), 0);
+        clear_background(&c, RGB(0, 0, 0));
+        canvas_line(&c, 0, 5, 5, 0, RGB(255, 255, 255));
+        canvas_flood_fill_ex(&c, 0, 0, RGB(7, 7, 7), 0, FLOOD_8, &fs);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 8, 0), RGB(7, 7, 7));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 2, 0), RGB(255, 255, 255));
+
+        // tolerance, including a fill colour that still matches the target
+        clear_background(&c, RGB(100, 100, 100));
+        canvas_putpixel(&c, 3, 3, RGB(104, 100, 97));
+        canvas_putpixel(&c, 4, 3, RGB(106, 100, 100));
+        canvas_flood_fill(&c, 0, 0, RGB(101, 101, 101), 5);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 3, 0), RGB(101, 101, 101));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 3, 0), RGB(106, 100, 100));
+        ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), RGB(101, 101, 101));
+
+        // noisy images against a breadth-first reference; a one-span stack
+        // overflows constantly and must give the same result
+        enum { FW = 61, FH = 47 };
+        static uint32_t img[FH * FW], ref_img[FH * FW];
+        static int queue[FH * FW];
+        static uint8_t seen[FH * FW];
+        FloodStack tiny;
+        ASSERT_EQ_I(flood_stack_init(&tiny, 1), 0);
+        uint32_t seed = 777;
+        int mismatches = 0;
+        for (int round = 0; round < 12; ++round) {
+            for (int i = 0; i < FH * FW; ++i) {
+                seed = seed * 1664525u + 1013904223u;
+                img[i] = (seed >> 28) < 5 ? RGB(0, 0, 0) : RGB(0, 0, (uint8_t)(2 + (seed >> 30)));
+            }
+            FloodConnectivity conn = round & 1 ? FLOOD_8 : FLOOD_4;
+            int tol = round & 2 ? 3 : 0;
+            uint32_t fill = round & 4 ? RGB(0, 0, 1) : RGB(200, 0, 0);
+            int sx = round * 5 % FW, sy = round * 3 % FH;
+            memcpy(ref_img, img, sizeof(img));
+            memset(seen, 0, sizeof(seen));
+            uint32_t target = img[sy * FW + sx];
+            int head = 0, tail = 0;
+            queue[tail++] = sy * FW + sx;
+            seen[sy * FW + sx] = 1;
+            while (head < tail) {
+                int i = queue[head++], px = i % FW, py = i / FW;
+                ref_img[i] = fill;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int nx = px + dx, ny = py + dy;
+                        if ((dx == 0) == (dy == 0) && (conn == FLOOD_4 || (dx == 0 && dy == 0))) continue;
+                        if (nx < 0 || ny < 0 || nx >= FW || ny >= FH || seen[ny * FW + nx]) continue;
+                        uint32_t p = img[ny * FW + nx];
+                        int db = (int)((p >> 8) & 0xFF) - (int)((target >> 8) & 0xFF);
+                        if (p >> 16 != target >> 16 || db > tol || db < -tol) continue;
+                        seen[ny * FW + nx] = 1;
+                        queue[tail++] = ny * FW + nx;
+                    }
+                }
+            }
+            Canvas fc = create_canvas(FW, FH, img);
+            uint32_t copy[FH * FW];
+            memcpy(copy, img, sizeof(img));
+            canvas_flood_fill_ex(&fc, sx, sy, fill, (uint8_t)tol, conn, &fs);
+            if (memcmp(img, ref_img, sizeof(img)) != 0) mismatches++;
+            fc.pixels = copy;
+            canvas_flood_fill_ex(&fc, sx, sy, fill, (uint8_t)tol, conn, &tiny);
+            if (memcmp(copy, ref_img, sizeof(img)) != 0) mismatches++;
+        }
+        ASSERT_EQ_I(mismatches, 0);
+        flood_stack_free(&tiny);
+        flood_stack_free(&fs);
+    }
+
+    // box blur matches a direct average with edge pixels repeated, and
+    // leaves everything outside the region alone
+    {
+        enum { BW = 53, BH = 37 };
+        static uint32_t img[BH * BW], orig[BH * BW];
+        uint32_t seed = 99;
+        for (int i = 0; i < BH * BW; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            img[i] = orig[i] = seed;
+        }
+        Canvas bc = create_canvas(BW, BH, img);
+        Rectangle region = {5, 3, 40, 30};
+        int mismatches = 0;
+        for (int radius = 1; radius <= 45; radius += 11) {
+            memcpy(img, orig, sizeof(img));
+            ASSERT_EQ_I(canvas_box_blur(&bc, region, radius), 0);
+            static uint32_t horiz[BH * BW];
+            for (int y = 0; y < (int)region.h; ++y) {
+                for (int x = 0; x < (int)region.w; ++x) {
+                    uint32_t sum[4] = {0, 0, 0, 0};
+                    for (int k = -radius; k <= radius; ++k) {
+                        int sx = x + k < 0 ? 0 : x + k >= (int)region.w ? (int)region.w - 1 : x + k;
+                        uint32_t p = orig[(region.y + y) * BW + region.x + sx];
+                        for (int ch = 0; ch < 4; ++ch) sum[ch] += (p >> (24 - 8 * ch)) & 0xFF;
+                    }
+                    uint32_t v = 0;
+                    for (int ch = 0; ch < 4; ++ch) v |= ((sum[ch] + radius) / (2 * radius + 1)) << (24 - 8 * ch);
+                    horiz[y * BW + x] = v;
+                }
+            }
+            for (int y = 0; y < (int)region.h; ++y) {
+                for (int x = 0; x < (int)region.w; ++x) {
+                    uint32_t sum[4] = {0, 0, 0, 0};
+                    for (int k = -radius; k <= radius; ++k) {
+                        int sy = y + k < 0 ? 0 : y + k >= (int)region.h ? (int)region.h - 1 : y + k;
+                        uint32_t p = horiz[sy * BW + x];
+                        for (int ch = 0; ch < 4; ++ch) sum[ch] += (p >> (24 - 8 * ch)) & 0xFF;
+                    }
+                    uint32_t v = 0;
+                    for (int ch = 0; ch < 4; ++ch) v |= ((sum[ch] + radius) / (2 * radius + 1)) << (24 - 8 * ch);
+                    if (img[(region.y + y) * BW + region.x + x] != v) mismatches++;
+                }
+            }
+        }
+        ASSERT_EQ_I(mismatches, 0);
+        ASSERT_EQ_U32(img[0], orig[0]);
+        ASSERT_EQ_U32(img[(region.y + 2) * BW + region.x + region.w], orig[(region.y + 2) * BW + region.x + region.w]);
+        ASSERT_EQ_U32(img[(region.y + region.h) * BW + region.x], orig[(region.y + region.h) * BW + region.x]);
+
+        // gaussian: flat stays flat, a dot spreads symmetrically and keeps its energy
+        clear_background(&bc, RGB(40, 80, 120));
+        Rectangle all = {0, 0, BW, BH};
+        ASSERT_EQ_I(canvas_gaussian_blur(&bc, all, 3.0f), 0);
+        ASSERT_EQ_U32(img[BH / 2 * BW + 7], RGB(40, 80, 120));
+        clear_background(&bc, 0);
+        img[18 * BW + 26] = 0xFF000000u;
+        canvas_gaussian_blur(&bc, all, 2.5f);
+        ASSERT_TRUE(img[18 * BW + 26] >> 24 > 0);
+        ASSERT_EQ_U32(img[18 * BW + 23], img[18 * BW + 29]);
+        ASSERT_EQ_U32(img[15 * BW + 26], img[21 * BW + 26]);
+        ASSERT_TRUE(img[18 * BW + 26] >> 24 > img[18 * BW + 24] >> 24);
+        uint32_t energy = 0;
+        for (int i = 0; i < BH * BW; ++i) energy += img[i] >> 24;
+        ASSERT_TRUE(energy > 235 && energy < 275);
+        ASSERT_EQ_I(canvas_gaussian_blur(&bc, all, 0.0f), 0);
+
+        // radii far beyond the region cost no more than small ones: windows are seeded
+        // from the repeated edges, and a two-tone row averages out to the middle
+        clear_background(&bc, RGB(0, 0, 0));
+        for (int y = 0; y < BH; ++y) {
+            for (int x = BW / 2; x < BW; ++x) img[y * BW + x] = RGB(200, 0, 0);
+        }
+        ASSERT_EQ_I(canvas_box_blur(&bc, all, 1 << 20), 0);
+        int off_middle = 0;
+        for (int i = 0; i < BH * BW; ++i) {
+            int red = (int)(img[i] >> 24);
+            if (red < 99 || red > 101) off_middle++;
+        }
+        ASSERT_EQ_I(off_middle, 0);
+        clear_background(&bc, RGB(40, 80, 120));
+        ASSERT_EQ_I(canvas_gaussian_blur(&bc, all, 50000.0f), 0);
+        ASSERT_EQ_U32(img[BH / 2 * BW + 7], RGB(40, 80, 120));
+    }
+
+    // colormaps: endpoints, clamping, NaN, row stride, log scaling
+    {
+        Colormap cm;
+        colormap_builtin(&cm, COLORMAP_VIRIDIS, 0);
+        ASSERT_EQ_U32(cm.lut[0], 0x440154FF);
+        ASSERT_EQ_U32(cm.lut[CANVAS_COLORMAP_SIZE - 1], 0xFDE725FF);
+        cm.nan_color = RGB(1, 2, 3);
+        float field[H][W + 3];
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W + 3; ++x) field[y][x] = (float)x / (float)(W - 1);
+        }
+        field[2][2] = -5.0f;
+        field[2][3] = 7.0f;
+        field[2][4] = make_nan();
+        canvas_colormap_apply(&c, &field[0][0], W + 3, 0.0f, 1.0f, &cm);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), cm.lut[0]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), cm.lut[CANVAS_COLORMAP_SIZE - 1]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 5, 7, 0), cm.lut[5 * CANVAS_COLORMAP_SIZE / (W - 1)]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 2, 0), cm.lut[0]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 2, 0), cm.lut[CANVAS_COLORMAP_SIZE - 1]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 2, 0), RGB(1, 2, 3));
+
+        // each decade of 1..10^4 gets a quarter of a log-scaled gray ramp
+        colormap_builtin(&cm, COLORMAP_GRAY, COLORMAP_LOG);
+        float decades[4] = {1.0f, 10.0f, 100.0f, 1000.0f};
+        float *row = &field[0][0];
+        for (int i = 0; i < 4; ++i) row[i] = decades[i] * 1.001f;
+        Canvas strip = create_canvas(4, 1, pix);
+        canvas_colormap_apply(&strip, row, 0, 1.0f, 10000.0f, &cm);
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ_I(pix[i] >> 24, 64 * i);
+        }
+        colormap_builtin(&cm, COLORMAP_MAGMA, COLORMAP_REVERSE);
+        ASSERT_EQ_U32(cm.lut[0], 0xFCFDBFFF);
+    }
+
+    // circle fill emits one span per row but keeps the octant algorithm's pixel set
+    {
+        static uint32_t got[64 * 64], want[64 * 64];
+        Canvas cg = create_canvas(64, 64, got), cw = create_canvas(64, 64, want);
+        for (int r = 1; r <= 40; ++r) {
+            clear_background(&cg, 0);
+            clear_background(&cw, 0);
+            canvas_circle_fill(&cg, 30, 33, r, 1);
+            int x = r, y = 0, err = 1 - r;
+            while (x >= y) {
+                canvas_hline(&cw, 30 - x, 30 + x, 33 + y, 1);
+                canvas_hline(&cw, 30 - x, 30 + x, 33 - y, 1);
+                canvas_hline(&cw, 30 - y, 30 + y, 33 + x, 1);
+                canvas_hline(&cw, 30 - y, 30 + y, 33 - x, 1);
+                ++y;
+                if (err < 0) err += 2 * y + 1;
+                else {
+                    --x;
+                    err += 2 * (y - x) + 1;
+                }
+            }
+            ASSERT_TRUE(memcmp(got, want, sizeof got) == 0);
+        }
+    }
+
+    // thick lines: butt, square and round caps cover the centres inside the outline
+    {
+        uint32_t ink = RGB(1, 2, 3);
+        clear_background(&c, 0);
+        ASSERT_EQ_I(canvas_thick_line(&c, 2, 5, 12, 5, 4, CAP_BUTT, ink), 0);
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                int inside = x >= 2 && x <= 11 && y >= 3 && y <= 6;
+                ASSERT_EQ_U32(canvas_getpixel(&c, x, y, 0), inside ? ink : 0);
+            }
+        }
+        clear_background(&c, 0);
+        canvas_thick_line(&c, 2, 5, 12, 5, 4, CAP_SQUARE, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 3, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 13, 6, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 14, 6, 0), 0);
+        clear_background(&c, 0);
+        canvas_thick_line(&c, 2, 5, 12, 5, 4, CAP_ROUND, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 5, 0), ink);   // (0.5, 5.5) is 1.58 from the end
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 3, 0), 0);     // (0.5, 3.5) is 2.12 away
+        ASSERT_EQ_U32(canvas_getpixel(&c, 13, 4, 0), ink);
+
+        // joins: only the miter reaches the outer corner of a right angle
+        Vector2 elbow[3] = {{2, 3}, {10, 3}, {10, 11}};
+        LineJoin joins[3] = {JOIN_MITER, JOIN_BEVEL, JOIN_ROUND};
+        for (int j = 0; j < 3; ++j) {
+            clear_background(&c, 0);
+            ASSERT_EQ_I(canvas_polyline(&c, elbow, 3, 0, 4, CAP_BUTT, joins[j], ink), 0);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 11, 1, 0), j == JOIN_MITER ? ink : 0);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 10, 2, 0), ink);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 11, 3, 0), ink);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), 0);
+        }
+        // closed polylines join their ends; a repeated point is harmless
+        Vector2 square[5] = {{3, 3}, {3, 3}, {12, 3}, {12, 9}, {3, 9}};
+        clear_background(&c, 0);
+        ASSERT_EQ_I(canvas_polyline(&c, square, 5, 1, 2, CAP_BUTT, JOIN_MITER, ink), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 2, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 12, 9, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 6, 0), 0);
+        // a lone point with round caps is a dot
+        clear_background(&c, 0);
+        canvas_polyline(&c, square, 2, 0, 3, CAP_ROUND, JOIN_ROUND, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 3, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 2, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 5, 5, 0), 0);
+    }
+
+    // ellipses, annuli and rounded rectangles, row by row
+    {
+        uint32_t ink = RGB(4, 5, 6);
+        clear_background(&c, 0);
+        canvas_ellipse_fill(&c, 8, 6, 5, 3, ink);
+        for (int x = 0; x < W; ++x) {
+            ASSERT_EQ_U32(canvas_getpixel(&c, x, 6, 0), x >= 3 && x <= 12 ? ink : 0);
+            ASSERT_EQ_U32(canvas_getpixel(&c, x, 2, 0), 0);
+            ASSERT_EQ_U32(canvas_getpixel(&c, x, 9, 0), 0);
+        }
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 3, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 8, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 3, 0), 0);
+
+        clear_background(&c, 0);
+        canvas_ellipse(&c, 8, 6, 5, 4, 2, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 5, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 1, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 3, 0), 0);
+
+        clear_background(&c, 0);
+        canvas_annulus(&c, 8, 6, 2, 5, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 9, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 11, 6, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 2, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 1, 0), 0);
+
+        // radius 0 matches the plain rectangle helpers
+        static uint32_t want[H * W];
+        Canvas cw = create_canvas(W, H, want);
+        Rectangle rr = {2, 3, 11, 7};
+        clear_background(&c, 0);
+        clear_background(&cw, 0);
+        canvas_rounded_rect_fill(&c, rr, 0, ink);
+        canvas_rect_fill(&cw, rr, ink);
+        ASSERT_TRUE(memcmp(pix, want, sizeof want) == 0);
+        clear_background(&c, 0);
+        clear_background(&cw, 0);
+        canvas_rounded_rect(&c, rr, 0, 1, ink);
+        canvas_rect(&cw, rr, ink);
+        ASSERT_TRUE(memcmp(pix, want, sizeof want) == 0);
+        clear_background(&c, 0);
+        canvas_rounded_rect_fill(&c, rr, 3, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 3, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 12, 9, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 4, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 6, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 3, 0), ink);
+        clear_background(&c, 0);
+        canvas_rounded_rect(&c, rr, 3, 2, ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 6, 0), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 4, 0), ink);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 7, 5, 0), 0);
+        // off-canvas and degenerate input
+        canvas_ellipse_fill(&c, -1e30f, 5, 1e29f, 3, ink);
+        canvas_annulus(&c, 8, make_nan(), 1, 3, ink);
+        canvas_rounded_rect_fill(&c, rr, -5, 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, 3, 0), 0);
+    }
+
+    // shaded triangles: same coverage as polygons, shared edges filled exactly once
+    {
+        static uint32_t want[H * W], other[H * W];
+        Canvas cw = create_canvas(W, H, want), co = create_canvas(W, H, other);
+        Vertex tri[3] = {{1.3f, 0.6f, 0, 0, 0, 0xFFFFFFFF}, {14.8f, 4.2f, 0, 0, 0, 0xFFFFFFFF}, {5.1f, 11.7f, 0, 0, 0, 0xFFFFFFFF}};
+        Vector2 pts[3] = {{1.3f, 0.6f}, {14.8f, 4.2f}, {5.1f, 11.7f}};
+        clear_background(&c, 0);
+        clear_background(&cw, 0);
+        ASSERT_EQ_I(canvas_triangle_gouraud(&c, tri, NULL), 0);
+        size_t three = 3;
+        canvas_polygon_fill(&cw, pts, &three, 1, FILL_NONZERO, 0xFFFFFFFF);
+        ASSERT_TRUE(memcmp(pix, want, sizeof want) == 0);
+
+        Vertex a[3] = {{1, 1, 0, 0, 0, 0x0000FFFF}, {13, 1, 0, 0, 0, 0x0000FFFF}, {13, 10, 0, 0, 0, 0x0000FFFF}};
+        Vertex b[3] = {{1, 1, 0, 0, 0, 0xFF0000FF}, {13, 10, 0, 0, 0, 0xFF0000FF}, {1, 10, 0, 0, 0, 0xFF0000FF}};
+        clear_background(&c, 0);
+        clear_background(&co, 0);
+        canvas_triangle_gouraud(&c, a, NULL);
+        canvas_triangle_gouraud(&co, b, NULL);
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                int inside = x >= 1 && x < 13 && y >= 1 && y < 10;
+                int n = (pix[y * W + x] != 0) + (other[y * W + x] != 0);
+                ASSERT_EQ_I(n, inside);
+            }
+        }
+
+        // colours interpolate linearly: compare with barycentric weights at pixel centres
+        Vertex g[3] = {{0, 0, 0, 0, 0, 0xFF000080}, {16, 0, 0, 0, 0, 0x00FF00FF}, {0, 12, 0, 0, 0, 0x0000FF00}};
+        clear_background(&c, 0);
+        canvas_triangle_gouraud(&c, g, NULL);
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                float l1 = (x + 0.5f) / 16, l2 = (y + 0.5f) / 12, l0 = 1 - l1 - l2;
+                if (l0 <= 0) continue;
+                uint32_t ref = RGBA((uint8_t)(255 * l0 + 0.5f), (uint8_t)(255 * l1 + 0.5f), (uint8_t)(255 * l2 + 0.5f), (uint8_t)(128 * l0 + 255 * l1 + 0.5f));
+                ASSERT_TRUE(canvas__color_within(pix[y * W + x], ref, 1));
+            }
+        }
+
+        // degenerate and unusable input
+        Vertex flat[3] = {{0, 0, 0, 0, 0, 1}, {5, 5, 0, 0, 0, 1}, {10, 10, 0, 0, 0, 1}};
+        Vertex bad[3] = {{0, 0, 0, 0, 0, 1}, {5, 5, 0, 0, 0, 1}, {10, 0, 0, 0, 0, 1}};
+        bad[0].x = make_nan();
+        bad[2].u = make_nan();
+        clear_background(&c, 0);
+        ASSERT_EQ_I(canvas_triangle_gouraud(&c, flat, NULL), 0);
+        ASSERT_EQ_I(canvas_triangle_gouraud(&c, bad, NULL), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 5, 2, 0), 0);
+        Texture none = {NULL, TEXTURE_NEAREST, TEXTURE_WRAP};
+        ASSERT_EQ_I(canvas_triangle_textured(&c, tri, &none, NULL), -1);
+        DepthBuffer small;
+        ASSERT_EQ_I(depth_buffer_init(&small, W - 1, H, DEPTH_16), 0);
+        ASSERT_EQ_I(canvas_triangle_gouraud(&c, tri, &small), -1);
+        depth_buffer_free(&small);
+    }
+
+    // textured triangles: nearest, wrap, clamp, bilinear and colour modulation
+    {
+        uint32_t texels[16];
+        for (int i = 0; i < 16; ++i) texels[i] = RGB((uint8_t)(i * 16), (uint8_t)(255 - i * 16), (uint8_t)i);
+        Canvas img = create_canvas(4, 4, texels);
+        Texture tex = {&img, TEXTURE_NEAREST, TEXTURE_WRAP};
+        // a quad from two triangles; uv_max 1 magnifies 2x, 2 repeats or clamps
+        for (int mode = 0; mode < 3; ++mode) {
+            float m = mode == 0 ? 1.0f : 2.0f;
+            tex.wrap = mode == 2 ? TEXTURE_CLAMP : TEXTURE_WRAP;
+            Vertex q0[3] = {{0, 0, 0, 0, 0, 0xFFFFFFFF}, {8, 0, 0, m, 0, 0xFFFFFFFF}, {8, 8, 0, m, m, 0xFFFFFFFF}};
+            Vertex q1[3] = {{0, 0, 0, 0, 0, 0xFFFFFFFF}, {8, 8, 0, m, m, 0xFFFFFFFF}, {0, 8, 0, 0, m, 0xFFFFFFFF}};
+            clear_background(&c, 0);
+            ASSERT_EQ_I(canvas_triangle_textured(&c, q0, &tex, NULL), 0);
+            ASSERT_EQ_I(canvas_triangle_textured(&c, q1, &tex, NULL), 0);
+            for (int y = 0; y < 8; ++y) {
+                for (int x = 0; x < 8; ++x) {
+                    int tx = mode == 0 ? x / 2 : mode == 1 ? x % 4 : (x < 3 ? x : 3);
+                    int ty = mode == 0 ? y / 2 : mode == 1 ? y % 4 : (y < 3 ? y : 3);
+                    ASSERT_EQ_U32(pix[y * W + x], texels[ty * 4 + tx]);
+                }
+            }
+            ASSERT_EQ_U32(pix[8], 0);
+        }
+
+        // bilinear at 1:1 hits texel centres exactly; across a 2-texel ramp it is monotonic
+        tex.filter = TEXTURE_BILINEAR;
+        tex.wrap = TEXTURE_CLAMP;
+        Vertex b0[3] = {{0, 0, 0, 0, 0, 0xFFFFFFFF}, {4, 0, 0, 1, 0, 0xFFFFFFFF}, {4, 4, 0, 1, 1, 0xFFFFFFFF}};
+        clear_background(&c, 0);
+        canvas_triangle_textured(&c, b0, &tex, NULL);
+        ASSERT_EQ_U32(pix[0 * W + 3], texels[3]);
+        ASSERT_EQ_U32(pix[2 * W + 3], texels[2 * 4 + 3]);
+        uint32_t ramp_px[2] = {RGB(0, 0, 0), RGB(255, 255, 255)};
+        Canvas ramp = create_canvas(2, 1, ramp_px);
+        Texture rt = {&ramp, TEXTURE_BILINEAR, TEXTURE_CLAMP};
+        Vertex r0[3] = {{0, 0, 0, 0, 0.5f, 0xFFFFFFFF}, {32, 0, 0, 2, 0.5f, 0xFFFFFFFF}, {0, 4, 0, 0, 0.5f, 0xFFFFFFFF}};
+        clear_background(&c, 0);
+        canvas_triangle_textured(&c, r0, &rt, NULL);
+        ASSERT_EQ_U32(pix[0], RGB(0, 0, 0));
+        ASSERT_EQ_U32(pix[15], RGB(255, 255, 255));
+        for (int x = 1; x < W; ++x) ASSERT_TRUE((pix[x] >> 24) >= (pix[x - 1] >> 24));
+        ASSERT_TRUE(canvas__color_within(pix[7], RGB(112, 112, 112), 2));   // texel coordinate 0.4375
+
+        // modulation by the vertex colour
+        uint32_t white = 0xFFFFFFFF;
+        Canvas wimg = create_canvas(1, 1, &white);
+        Texture wt = {&wimg, TEXTURE_NEAREST, TEXTURE_WRAP};
+        Vertex grey[3] = {{0, 0, 0, 0, 0, 0x804020FF}, {16, 0, 0, 1, 0, 0x804020FF}, {0, 12, 0, 0, 1, 0x804020FF}};
+        clear_background(&c, 0);
+        canvas_triangle_textured(&c, grey, &wt, NULL);
+        ASSERT_EQ_U32(pix[W + 1], 0x804020FF);
+    }
+
+    // depth buffers: nearer wins regardless of order, with 16- and 32-bit storage
+    for (int fmt = 0; fmt < 2; ++fmt) {
+        DepthBuffer depth;
+        ASSERT_EQ_I(depth_buffer_init(&depth, W, H, fmt ? DEPTH_32 : DEPTH_16), 0);
+        Vertex slope[3] = {{0, 0, 0.0f, 0, 0, 0xFF0000FF}, {16, 0, 1.0f, 0, 0, 0xFF0000FF}, {0, 12, 0.0f, 0, 0, 0xFF0000FF}};
+        Vertex level[3] = {{0, 0, 0.5f, 0, 0, 0x0000FFFF}, {16, 0, 0.5f, 0, 0, 0x0000FFFF}, {0, 12, 0.5f, 0, 0, 0x0000FFFF}};
+        for (int order = 0; order < 2; ++order) {
+            clear_background(&c, 0);
+            depth_buffer_clear(&depth);
+            canvas_triangle_gouraud(&c, order ? level : slope, &depth);
+            canvas_triangle_gouraud(&c, order ? slope : level, &depth);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 2, 1, 0), 0xFF0000FF);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 12, 1, 0), 0x0000FFFF);
+            // equal depth does not pass, so redrawing is a no-op
+            canvas_triangle_gouraud(&c, slope, &depth);
+            ASSERT_EQ_U32(canvas_getpixel(&c, 12, 1, 0), 0x0000FFFF);
+        }
+        // textured and depth-tested together
+        uint32_t t1 = 0x00FF00FF;
+        Canvas timg = create_canvas(1, 1, &t1);
+        Texture tt = {&timg, TEXTURE_BILINEAR, TEXTURE_WRAP};
+        Vertex near_tri[3] = {{0, 0, 0.1f, 0, 0, 0xFFFFFFFF}, {16, 0, 0.1f, 1, 0, 0xFFFFFFFF}, {0, 12, 0.1f, 0, 1, 0xFFFFFFFF}};
+        canvas_triangle_textured(&c, near_tri, &tt, &depth);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 12, 1, 0), 0x00FF00FF);
+        canvas_triangle_gouraud(&c, level, &depth);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 12, 1, 0), 0x00FF00FF);
+        depth_buffer_free(&depth);
+    }
+
+    // anti-aliased lines: Wu coverage with half-covered ends at pixel centres
+    {
+        clear_background(&c, RGBA(0, 0, 0, 255));
+        canvas_line_aa(&c, 1.5f, 2.5f, 8.5f, 2.5f, RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 2, 0), RGBA(0, 0, 0, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 1, 2, 0), RGBA(128, 128, 128, 255));
+        for (int x = 2; x <= 7; ++x) ASSERT_EQ_U32(canvas_getpixel(&c, x, 2, 0), RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 8, 2, 0), RGBA(128, 128, 128, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 1, 0), RGBA(0, 0, 0, 255));
+        // between two rows, and steep: the same split across columns
+        canvas_line_aa(&c, 2.5f, 5.0f, 6.5f, 5.0f, RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 4, 0), RGBA(128, 128, 128, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 5, 0), RGBA(128, 128, 128, 255));
+        canvas_line_aa(&c, 12.0f, 1.5f, 12.0f, 9.5f, RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 11, 5, 0), RGBA(128, 128, 128, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 12, 5, 0), RGBA(128, 128, 128, 255));
+        // the colour's alpha scales the coverage; far off-canvas lines are clipped
+        clear_background(&c, RGBA(0, 0, 0, 255));
+        canvas_line_aa(&c, -1e9f, 3.5f, 1e9f, 3.5f, RGBA(255, 0, 0, 51));
+        for (int x = 0; x < W; ++x) ASSERT_EQ_U32(canvas_getpixel(&c, x, 3, 0), RGBA(51, 0, 0, 255));
+        canvas_line_aa(&c, make_nan(), 0, 3, 3, RGB(255, 255, 255));
+        // a diagonal deposits one pixel of coverage per column
+        clear_background(&c, 0);
+        canvas_line_aa(&c, 0.5f, 0.5f, 10.5f, 6.5f, RGB(255, 255, 255));
+        uint32_t total = 0;
+        for (int i = 0; i < W * H; ++i) total += pix[i] & 0xFF;
+        ASSERT_TRUE(total >= 255 * 10 - 12 && total <= 255 * 10 + 12);
+    }
+
+    // anti-aliased circles: solid interior, smooth rim, area and circumference preserved
+    {
+        uint32_t big[48 * 48];
+        Canvas bc = create_canvas(48, 48, big);
+        clear_background(&bc, 0);
+        canvas_circle_fill_aa(&bc, 24.0f, 24.0f, 15.3f, RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 24, 24, 0), RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 24, 9, 0), RGB(255, 255, 255));  // 14.5 from the centre
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 24, 7, 0), 0);                  // 16.5 from the centre
+        uint32_t edge = canvas_getpixel(&bc, 24, 8, 0);                    // 15.5: 0.3 covered
+        ASSERT_TRUE((edge & 0xFF) >= 74 && (edge & 0xFF) <= 79);
+        uint32_t area = 0;
+        for (int i = 0; i < 48 * 48; ++i) area += big[i] & 0xFF;
+        // pi * 15.3^2 = 735.4 pixels
+        ASSERT_TRUE(area > 255 * 730 && area < 255 * 741);
+        for (int y = 0; y < 48; ++y) {
+            for (int x = 0; x < 48; ++x) {
+                ASSERT_EQ_U32(big[y * 48 + x], big[y * 48 + (47 - x)]);
+            }
+        }
+
+        clear_background(&bc, 0);
+        canvas_circle_aa(&bc, 24.0f, 24.0f, 15.3f, RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 24, 24, 0), 0);
+        uint32_t ring = 0;
+        for (int i = 0; i < 48 * 48; ++i) ring += big[i] & 0xFF;
+        // 2 * pi * 15.3 = 96.1 pixels
+        ASSERT_TRUE(ring > 255 * 94 && ring < 255 * 98);
+
+        // translucent fills blend the interior too, and clipped circles stay in bounds
+        clear_background(&bc, RGBA(0, 0, 0, 255));
+        canvas_circle_fill_aa(&bc, 0.0f, 0.0f, 30.0f, RGBA(0, 0, 255, 128));
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 5, 5, 0), RGBA(0, 0, 128, 255));
+        canvas_circle_fill_aa(&bc, 1e30f, 5.0f, 1e29f, RGB(255, 0, 0));
+        canvas_circle_aa(&bc, -5.0f, -5.0f, 1e9f, RGB(255, 0, 0));
+        canvas_circle_fill_aa(&bc, 24.0f, make_nan(), 3.0f, RGB(255, 0, 0));
+        ASSERT_EQ_U32(canvas_getpixel(&bc, 5, 5, 0), RGBA(0, 0, 128, 255));
+    }
+
+    // density: batched points match single adds, lines match canvas_line, scaling
+    {
+        DensityCanvas d, ref;
+        ASSERT_EQ_I(density_init(&d, W, H), 0);
+        ASSERT_EQ_I(density_init(&ref, W, H), 0);
+        enum { N = 100000 };    // large enough to take the threaded path
+        Vector2 *pts = (Vector2 *)malloc(N * sizeof(Vector2));
+        ASSERT_TRUE(pts != NULL);
+        uint32_t seed = 12345;
+        for (int i = 0; i < N; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            pts[i].x = (float)(seed >> 16) / 65536.0f * (W + 4) - 2.0f;
+            seed = seed * 1664525u + 1013904223u;
+            pts[i].y = (float)(seed >> 16) / 65536.0f * (H + 4) - 2.0f;
+        }
+        pts[7].x = make_nan();
+        for (int i = 0; i < N; ++i) density_add_point(&ref, pts[i].x, pts[i].y);
+        ASSERT_EQ_I(density_add_points(&d, pts, N), 0);
+        ASSERT_EQ_I(density_add_points(&d, pts, 10), 0);
+        for (int i = 0; i < 10; ++i) density_add_point(&ref, pts[i].x, pts[i].y);
+        ASSERT_TRUE(memcmp(d.counts, ref.counts, W * H * sizeof(uint32_t)) == 0);
+
+        density_clear(&d);
+        density_clear(&ref);
+        Vector2 segs[6] = {{1.5f, 2.5f}, {9.2f, 5.9f}, {3.0f, 9.0f}, {4.9f, 0.1f}, {-100.0f, 12.5f}, {W + 100.0f, 12.5f}};
+        ASSERT_EQ_I(density_add_lines(&d, segs, 3), 0);
+        int ends[3][4] = {{1, 2, 9, 5}, {3, 9, 4, 0}, {0, 12, W - 1, 12}};
+        for (int i = 0; i < 3; ++i) {
+            clear_background(&c, 0);
+            canvas_line(&c, ends[i][0], ends[i][1], ends[i][2], ends[i][3], 1);
+            for (int k = 0; k < W * H; ++k) ref.counts[k] += pix[k];
+        }
+        ASSERT_TRUE(memcmp(d.counts, ref.counts, W * H * sizeof(uint32_t)) == 0);
+        density_add_line(&d, -5.0f, -5.0f, -1.0f, 3.0f);   // fully outside
+        density_add_line(&d, make_nan(), 0.0f, 3.0f, 3.0f);
+
+        // counts 1, 2, 4 and 9: linear, log and rank scaling; empty cells keep the background
+        Colormap cm;
+        colormap_builtin(&cm, COLORMAP_GRAY, 0);
+        density_clear(&d);
+        uint32_t counts[4] = {1, 2, 4, 9};
+        for (int i = 0; i < 4; ++i) {
+            for (uint32_t k = 0; k < counts[i]; ++k) density_add_point(&d, (float)i + 0.5f, 0.5f);
+        }
+        clear_background(&c, RGB(1, 2, 3));
+        ASSERT_EQ_I(canvas_density_render(&c, &d, DENSITY_LINEAR, &cm), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), cm.lut[255 / 9]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 0, 0), cm.lut[255]);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 4, 0, 0), RGB(1, 2, 3));
+        ASSERT_EQ_I(canvas_density_render(&c, &d, DENSITY_LOG, &cm), 0);
+        ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), cm.lut[76]);   // 255 * log(2) / log(10)
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, 0, 0), cm.lut[255]);
+        ASSERT_EQ_I(canvas_density_render(&c, &d, DENSITY_EQ_HIST, &cm), 0);
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ_U32(canvas_getpixel(&c, i, 0, 0), cm.lut[85 * i]);
+        }
+        free(pts);
+        density_free(&d);
+        density_free(&ref);
+    }
+
+    // compare: bounding box, count, tolerance, hash, PSNR and SSIM
+    {
+        uint32_t pa[H * W], pb[H * W];
+        Canvas ca = create_canvas(W, H, pa), cb = create_canvas(W, H, pb);
+        for (int i = 0; i < W * H; ++i) pa[i] = pb[i] = RGB((uint8_t)(i * 7), (uint8_t)(i * 3), (uint8_t)i);
+        Rectangle box;
+        size_t n = 99;
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 0, &box, &n), 0);
+        ASSERT_EQ_I(n, 0);
+        ASSERT_EQ_I(box.w, 0);
+        ASSERT_TRUE(canvas_hash(&ca) == canvas_hash(&cb));
+        double psnr = 0, ssim = 0;
+        ASSERT_EQ_I(canvas_psnr(&ca, &cb, &psnr), 0);
+        ASSERT_TRUE(psnr == CANVAS_PSNR_IDENTICAL);
+        ASSERT_EQ_I(canvas_ssim(&ca, &cb, &ssim), 0);
+        ASSERT_TRUE(ssim > 0.9999 && ssim < 1.0001);
+
+        pb[3 * W + 5] += 1 << 8;        // blue off by one
+        pb[7 * W + 2] ^= 0x00FF0000;    // green far off
+        pb[4 * W + 11] += 3 << 24;      // red off by three
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 0, NULL, NULL), 1);
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 0, &box, &n), 1);
+        ASSERT_EQ_I(n, 3);
+        ASSERT_EQ_I(box.x, 2);
+        ASSERT_EQ_I(box.y, 3);
+        ASSERT_EQ_I(box.w, 10);
+        ASSERT_EQ_I(box.h, 5);
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 0, &box, NULL), 1);
+        ASSERT_EQ_I(box.x, 2);
+        ASSERT_EQ_I(box.w, 10);
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 3, &box, &n), 1);
+        ASSERT_EQ_I(n, 1);
+        ASSERT_EQ_I(box.x, 2);
+        ASSERT_EQ_I(box.y, 7);
+        ASSERT_EQ_I(box.w, 1);
+        pb[7 * W + 2] = pa[7 * W + 2];
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 3, NULL, NULL), 0);
+        ASSERT_EQ_I(canvas_diff(&ca, &cb, 2, NULL, &n), 1);
+        ASSERT_EQ_I(n, 1);
+        ASSERT_TRUE(canvas_hash(&ca) != canvas_hash(&cb));
+
+        // one channel off by one: 10 * log10(255^2 * 3 * W * H)
+        pb[4 * W + 11] = pa[4 * W + 11];
+        ASSERT_EQ_I(canvas_psnr(&ca, &cb, &psnr), 0);
+        ASSERT_TRUE(psnr > 75.72 && psnr < 75.75);
+        ASSERT_EQ_I(canvas_ssim(&ca, &cb, &ssim), 0);
+        ASSERT_TRUE(ssim > 0.99);
+        for (int i = 0; i < W * H; ++i) pb[i] = ~pa[i] | 0xFF;
+        ASSERT_EQ_I(canvas_ssim(&ca, &cb, &ssim), 0);
+        ASSERT_TRUE(ssim < 0.5);
+
+        // 13 columns: windows at 0 and 4, then one flush with the right edge covers column 12
+        Canvas odd_a = create_canvas(13, H, pa), odd_b = create_canvas(13, H, pb);
+        for (int i = 0; i < 13 * H; ++i) pb[i] = pa[i];
+        for (int y = 0; y < H; ++y) pb[y * 13 + 12] = ~pa[y * 13 + 12] | 0xFF;
+        ASSERT_EQ_I(canvas_ssim(&odd_a, &odd_b, &ssim), 0);
+        ASSERT_TRUE(ssim < 0.99);
+
+        Canvas narrow = create_canvas(W / 2, H * 2, pa);
+        ASSERT_EQ_I(canvas_diff(&ca, &narrow, 0, NULL, NULL), -1);
+        ASSERT_TRUE(canvas_hash(&ca) != canvas_hash(&narrow));
+        ASSERT_EQ_I(canvas_psnr(&ca, &narrow, &psnr), -1);
+    }
+
+    // text: 'T' is a full top bar over a centre stem
+    clear_background(&c, 0);
+    canvas_text(&c, 1, 2, "T", 1, RGB(255, 255, 255));
+    for (int x = 1; x <= 5; ++x) {
+        ASSERT_EQ_U32(canvas_getpixel(&c, x, 2, 0), RGB(255, 255, 255));
+    }
+    for (int y = 3; y <= 8; ++y) {
+        ASSERT_EQ_U32(canvas_getpixel(&c, 3, y, 0), RGB(255, 255, 255));
+        ASSERT_EQ_U32(canvas_getpixel(&c, 2, y, 0), 0);
+    }
+    ASSERT_EQ_U32(canvas_getpixel(&c, 3, 9, 0), 0);
+
+    // scaled glyphs, second line, and clipping on every edge
+    clear_background(&c, 0);
+    canvas_text(&c, -3, -4, "TT\nT", 2, RGB(1, 2, 3));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), 0);              // bar rows are above the canvas
+    ASSERT_EQ_U32(canvas_getpixel(&c, 1, 0, 0), RGB(1, 2, 3));   // stem of the first 'T' is 2px wide
+    ASSERT_EQ_U32(canvas_getpixel(&c, 2, 9, 0), RGB(1, 2, 3));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 3, 0, 0), 0);
+    ASSERT_EQ_U32(canvas_getpixel(&c, 13, 0, 0), RGB(1, 2, 3)); // second 'T' starts 12px later
+    ASSERT_EQ_U32(canvas_getpixel(&c, 1, 10, 0), 0);
+    canvas_text(&c, 8, -9, "T\nT", 1, RGB(7, 8, 9));           // second line lands at y = 0
+    ASSERT_EQ_U32(canvas_getpixel(&c, 8, 0, 0), RGB(7, 8, 9));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 10, 6, 0), RGB(7, 8, 9));
+    canvas_text(&c, W - 2, H - 1, "T\nT", 1, RGB(4, 5, 6));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), RGB(4, 5, 6));
+
+    // translucent text blends with what is underneath
+    clear_background(&c, RGB(0, 0, 0));
+    canvas_text(&c, 0, 0, "-", 1, RGBA(255, 255, 255, 128));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 0, 3, 0), RGB(128, 128, 128));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 0, 2, 0), RGB(0, 0, 0));
+
+    int tw = 0, th = 0;
+    canvas_text_measure("ab\ncde", 3, &tw, &th);
+    ASSERT_EQ_I(tw, (3 * CANVAS_FONT_ADVANCE - 1) * 3);
+    ASSERT_EQ_I(th, (CANVAS_FONT_LINE + CANVAS_FONT_HEIGHT) * 3);
+    canvas_text_measure("\xc3\xa9", 1, &tw, &th); // one code point, one '?'
+    ASSERT_EQ_I(tw, CANVAS_FONT_WIDTH);
+    // oversized scales are clamped instead of overflowing the atlas
+    canvas_text_measure("A", 0x7FFFFFFF, &tw, &th);
+    ASSERT_EQ_I(tw, CANVAS_FONT_WIDTH * CANVAS_TEXT_MAX_SCALE);
+    clear_background(&c, 0);
+    canvas_text(&c, 0, 0, "A", 0x7FFFFFFF, RGB(1, 1, 1));
+    ASSERT_EQ_U32(canvas_getpixel(&c, W - 1, H - 1, 0), 0);     // the whole canvas is font column 0 of the top row
+    canvas_text(&c, -CANVAS_TEXT_MAX_SCALE, 0, "A", 0x7FFFFFFF, RGB(1, 1, 1));
+    ASSERT_EQ_U32(canvas_getpixel(&c, 0, 0, 0), RGB(1, 1, 1));  // column 1 is set
+    canvas_text_cache_free();
+
+    // tiled canvas matches a plain canvas, with a 2-tile cache forcing spills
+    {
+        const int TW = 3 * CANVAS_TILE_SIZE - 68, TH = 2 * CANVAS_TILE_SIZE - 12;
+        uint32_t* ref_px = (uint32_t*)malloc((size_t)TW * TH * sizeof(uint32_t));
+        Canvas ref = create_canvas(TW, TH, ref_px);
+        TiledCanvas* tc = tiled_canvas_create(TW, TH, RGB(1, 1, 1), 2);
+        ASSERT_TRUE(tc != NULL);
+        clear_background(&ref, RGB(1, 1, 1));
+
+        Rectangle band = {100, 200, 500, 100};
+        canvas_rect_fill(&ref, band, RGB(200, 0, 0));
+        tiled_rect_fill(tc, band, RGB(200, 0, 0));
+        canvas_line(&ref, -20, -10, TW + 5, TH - 1, RGB(0, 200, 0));
+        tiled_line(tc, -20, -10, TW + 5, TH - 1, RGB(0, 200, 0));
+        canvas_hline(&ref, -4, TW + 4, 255, RGB(0, 0, 200));
+        tiled_hline(tc, -4, TW + 4, 255, RGB(0, 0, 200));
+        canvas_vline(&ref, 511, TH + 9, -9, RGB(9, 9, 9));
+        tiled_vline(tc, 511, TH + 9, -9, RGB(9, 9, 9));
+        canvas_circle_fill(&ref, 256, 256, 40, RGB(50, 60, 70));
+        tiled_circle_fill(tc, 256, 256, 40, RGB(50, 60, 70));
+        canvas_putpixel(&ref, TW - 1, TH - 1, RGB(3, 2, 1));
+        tiled_putpixel(tc, TW - 1, TH - 1, RGB(3, 2, 1));
+        tiled_putpixel(tc, TW, 0, RGB(3, 2, 1)); // out of bounds
+
+        int mismatches = 0;
+        for (int y = 0; y < TH; ++y) {
+            for (int x = 0; x < TW; ++x) {
+                if (tiled_getpixel(tc, x, y, 0) != canvas_getpixel(&ref, x, y, 0)) mismatches++;
+            }
+        }
+        ASSERT_EQ_I(mismatches, 0);
+        ASSERT_TRUE(tc->scratch != NULL);
+        ASSERT_EQ_I(tc->failed, 0);
+        ASSERT_EQ_I(tc->resident_count, 2);
+        ASSERT_EQ_U32(tiled_getpixel(tc, -1, 0, 0xABCDEF01), 0xABCDEF01);
+
+        // rows streamed out bypass the cache and see spilled tiles too
+        uint32_t* row = (uint32_t*)malloc((size_t)TW * sizeof(uint32_t));
+        ASSERT_EQ_I(tiled_canvas_read_row(tc, 250, row), 0);
+        ASSERT_TRUE(memcmp(row, ref_px + 250 * TW, (size_t)TW * sizeof(uint32_t)) == 0);
+        free(row);
+
+        tiled_clear_background(tc, RGB(7, 7, 7));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 300, 250, 0), RGB(7, 7, 7));
+        ASSERT_EQ_I(tc->resident_count, 0);
+
+        // ends far off the canvas: the walk starts where the line enters, in the same pixels
+        clear_background(&ref, RGB(7, 7, 7));
+        canvas_line(&ref, -100000, -70001, 100000, 70013, RGB(0, 0, 9));
+        tiled_line(tc, -100000, -70001, 100000, 70013, RGB(0, 0, 9));
+        canvas_circle_fill(&ref, -250, TH + 40, 400, RGB(0, 9, 0));
+        tiled_circle_fill(tc, -250, TH + 40, 400, RGB(0, 9, 0));
+        mismatches = 0;
+        for (int y = 0; y < TH; ++y) {
+            for (int x = 0; x < TW; ++x) {
+                if (tiled_getpixel(tc, x, y, 0) != canvas_getpixel(&ref, x, y, 0)) mismatches++;
+            }
+        }
+        ASSERT_EQ_I(mismatches, 0);
+
+        // extreme ends and radii neither overflow nor step through the off-canvas part
+        tiled_line(tc, INT64_MIN / 2, 5, INT64_MAX / 2, 5, RGB(1, 0, 0));
+        tiled_line(tc, -INT64_C(2000000000000), 9, INT64_C(2000000000000), 9, RGB(2, 0, 0));
+        tiled_line(tc, INT64_MIN, INT64_MIN, INT64_MAX, INT64_MAX, RGB(3, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 0, 5, 0), RGB(1, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, TW - 1, 5, 0), RGB(1, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 0, 9, 0), RGB(2, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, TW - 1, 9, 0), RGB(2, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, TW - 1, 6, 0), RGB(7, 7, 7));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 100, 100, 0), RGB(3, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, TH - 1, TH - 1, 0), RGB(3, 0, 0));
+        tiled_circle_fill(tc, INT64_MAX - 10, 300, INT64_MAX, RGB(4, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 0, 300, 0), RGB(4, 0, 0));
+        tiled_circle_fill(tc, -INT64_C(3000000000000), 20, INT64_C(3000000000010), RGB(5, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 10, 20, 0), RGB(5, 0, 0));
+        ASSERT_EQ_U32(tiled_getpixel(tc, 11, 20, 0), RGB(4, 0, 0));
+        tiled_circle_fill(tc, INT64_MIN, INT64_MIN, INT64_MAX, RGB(6, 0, 0));
+
+        tiled_canvas_destroy(tc);
+        free(ref_px);
+    }
+
     // create/free canvas sanity
     free_canvas(&c);
     ASSERT_EQ_I(c.width, 0);
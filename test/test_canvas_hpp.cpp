@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+
+#define CANVASDEF static inline
+#define CANVAS_IMPLEMENTATION
+#include "../canvas.hpp"
+
+#include "test.h"
+
+// packing is usable in constant expressions
+static_assert(canvas::RGBA8888::pack(1, 2, 3, 4) == 0x01020304u, "RGBA8888 packing");
+static_assert(canvas::ARGB8888::pack(1, 2, 3, 4) == 0x04010203u, "ARGB8888 packing");
+static_assert(canvas::ABGR8888::pack(1, 2, 3) == 0xFF030201u, "ABGR8888 packing");
+static_assert(canvas::ARGB8888::to_rgba(0x04010203u) == 0x01020304u, "ARGB8888 to RGBA");
+static_assert(canvas::BGRA8888::from_rgba(0x01020304u) == 0x03020104u, "RGBA to BGRA8888");
+static_assert(canvas::StaticCanvas<W, H>::width() * canvas::StaticCanvas<W, H>::height() == W * H, "static size");
+
+int main() {
+    using canvas::RGBA8888;
+
+    // owning canvas: zeroed, clipped writes, C interop on the same pixels
+    canvas::Canvas<> c(W, H);
+    ASSERT_TRUE(c.owns());
+    ASSERT_EQ_I(c.size(), W * H);
+    ASSERT_EQ_U32(c.get(W - 1, H - 1), 0);
+    c.put(-1, 0, 0xDEADBEEF);
+    c.put(W, 0, 0xDEADBEEF);
+    c.put(0, H, 0xDEADBEEF);
+    ASSERT_EQ_U32(c.get(-1, 0, 7), 7);
+    c.put(2, 3, RGBA8888::pack(9, 9, 9));
+    ::Canvas cc = c.as_c();
+    ASSERT_EQ_U32(canvas_getpixel(&cc, 2, 3, 0), RGBA(9, 9, 9, 255));
+    Rectangle r = {4, 5, 3, 2};
+    canvas_rect_fill(&cc, r, RGB(1, 2, 3));
+    ASSERT_EQ_U32(c.get(6, 6), RGBA8888::pack(1, 2, 3));
+
+    // checked hline clamps both ends, like canvas_hline
+    c.fill(0);
+    c.hline(W + 5, -5, 1, 0x11);
+    for (int x = 0; x < W; ++x) ASSERT_EQ_U32(c.get(x, 1), 0x11);
+    c.hline(-9, -2, 2, 0x22);
+    c.hline(W, W + 3, 2, 0x22);
+    c.hline(0, W - 1, H, 0x22);
+    for (uint32_t p : c) ASSERT_TRUE(p == 0 || p == 0x11);
+
+    // borrowing wraps a C buffer without owning it; moves leave the source empty
+    uint32_t pix[H * W] = {};
+    ::Canvas cview = create_canvas(W, H, pix);
+    auto b = canvas::Canvas<>::borrow(cview);
+    ASSERT_TRUE(!b.owns());
+    b.rect_fill(1, 1, 2, 2, 0x33);
+    ASSERT_EQ_U32(pix[1 * W + 2], 0x33);
+    canvas::Canvas<> moved = std::move(c);
+    ASSERT_TRUE(moved.owns() && moved.get(0, 1) == 0x11);
+    ASSERT_TRUE(c.pixels() == nullptr && c.size() == 0);
+
+    // unchecked stack canvas: row spans and iterators reach every pixel
+    static canvas::StaticCanvas<W, H, canvas::ARGB8888, canvas::Unchecked> s;
+    for (size_t y = 0; y < H; ++y) {
+        canvas::PixelSpan row = s.row(y);
+        ASSERT_EQ_I(row.size(), W);
+        for (size_t x = 0; x < row.size(); ++x) row[x] = canvas::ARGB8888::pack((uint8_t)x, (uint8_t)y, 0);
+    }
+    ASSERT_EQ_U32(s.get(5, 7), 0xFF050700u);
+    // raw pointer iterators: std::execution::par_unseq can go first where the library has it
+    std::for_each(s.begin(), s.end(), [](uint32_t &p) { p |= 0x000000FFu; });
+    ASSERT_EQ_U32(s.get(5, 7), 0xFF0507FFu);
+    ASSERT_EQ_I(std::accumulate(s.begin(), s.end(), 0ull, [](unsigned long long a, uint32_t p) { return a + (p & 0xFF); }), 255ull * W * H);
+    // empty and negative widths paint nothing, even at the left edge without bounds checks
+    s.rect_fill(0, 0, 0, 2, 0);
+    s.rect_fill(2, 0, -2, 2, 0);
+    s.rect_fill(0, 0, 3, -1, 0);
+    ASSERT_EQ_U32(s.get(0, 0), 0xFF0000FFu);
+    ASSERT_EQ_U32(s.get(1, 1), 0xFF0101FFu);
+
+    // format conversion and PNG output through the C encoder
+    canvas::Canvas<RGBA8888> rgba(W, H);
+    canvas::convert(rgba, s);
+    ASSERT_EQ_U32(rgba.get(5, 7), RGBA(5, 7, 255, 255));
+    canvas::Canvas<canvas::ABGR8888> abgr(W / 2, H / 2);
+    canvas::convert(abgr, rgba);
+    ASSERT_EQ_U32(abgr.get(5, 3), canvas::ABGR8888::pack(5, 3, 255));
+    ASSERT_EQ_I(s.write_png("build/tests_out_hpp.png"), 0);
+    ASSERT_EQ_I(rgba.write_png("build/tests_out_hpp_rgba.png"), 0);
+
+    if (g_fail) {
+        fprintf(stderr, "FAILED (%d assertion%s)\n", g_fail, g_fail == 1 ? "" : "s");
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}
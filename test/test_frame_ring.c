@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CANVASDEF static inline
+#define CANVAS_IMPLEMENTATION
+#include "../canvas.h"
+
+#include "test.h"
+
+#ifdef CANVAS_HAS_FRAME_RING
+#include <sys/wait.h>
+
+#define RING_NAME "/canvas_test_ring"
+#define SLOTS 3
+#define FORKED_FRAMES 200
+
+// every pixel of frame n carries n, so a torn read shows up as mixed values
+static void produce(FrameRing* p, uint32_t n) {
+    Canvas c;
+    ASSERT_EQ_I(frame_ring_begin(p, &c), 0);
+    if (!c.pixels) return;
+    ASSERT_EQ_I(c.width, W);
+    ASSERT_EQ_I(c.height, H);
+    clear_background(&c, n);
+    ASSERT_EQ_I(frame_ring_publish(p), 0);
+}
+
+static int uniform(const FrameRingFrame* f, uint32_t n) {
+    for (size_t i = 0; i < f->canvas.width * f->canvas.height; ++i) {
+        if (f->canvas.pixels[i] != n) return 0;
+    }
+    return 1;
+}
+#endif // CANVAS_HAS_FRAME_RING
+
+int main(void) {
+#ifdef CANVAS_HAS_FRAME_RING
+    ASSERT_TRUE(frame_ring_create(RING_NAME, W, H, 1) == NULL);
+    ASSERT_TRUE(frame_ring_create(RING_NAME, 0, H, SLOTS) == NULL);
+
+    FrameRing* p = frame_ring_create(RING_NAME, W, H, SLOTS);
+    ASSERT_TRUE(p != NULL);
+    if (!p) return 1;
+    FrameRing* r = frame_ring_open(RING_NAME);
+    ASSERT_TRUE(r != NULL);
+    if (!r) return 1;
+    ASSERT_EQ_I(r->width, W);
+    ASSERT_EQ_I(r->height, H);
+    ASSERT_EQ_I(r->slots, SLOTS);
+
+    // nothing published yet; publishing needs a begun slot
+    FrameRingFrame f;
+    uint64_t cursor = 0;
+    ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), 0);
+    ASSERT_EQ_I(frame_ring_latest(r, &f), 0);
+    ASSERT_EQ_I(frame_ring_publish(p), -1);
+    Canvas c;
+    ASSERT_EQ_I(frame_ring_begin(r, &c), -1);   // consumers cannot write
+
+    // frames arrive in order, read in place from the producer's slot
+    produce(p, 0);
+    produce(p, 1);
+    for (uint32_t n = 0; n < 2; ++n) {
+        ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), 1);
+        ASSERT_EQ_I(f.frame, n);
+        ASSERT_TRUE(uniform(&f, n));
+        ASSERT_TRUE(frame_ring_check(r, &f));
+    }
+    ASSERT_EQ_I(cursor, 2);
+    ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), 0);
+
+    // a consumer that falls behind skips to the oldest frame that is safe to read
+    for (uint32_t n = 2; n < 7; ++n) produce(p, n);
+    ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), 1);
+    ASSERT_EQ_I(f.frame, 7 - SLOTS + 1);
+    ASSERT_EQ_I(frame_ring_latest(r, &f), 1);
+    ASSERT_EQ_I(f.frame, 6);
+    ASSERT_TRUE(uniform(&f, 6));
+
+    // the producer lapping a frame that is being read invalidates it
+    ASSERT_TRUE(frame_ring_check(r, &f));
+    for (uint32_t n = 7; n < 7 + SLOTS - 1; ++n) produce(p, n);
+    ASSERT_TRUE(frame_ring_check(r, &f));
+    ASSERT_EQ_I(frame_ring_begin(p, &c), 0);
+    ASSERT_TRUE(!frame_ring_check(r, &f));
+    ASSERT_EQ_I(frame_ring_publish(p), 0);
+
+    // closing the producer ends the stream after the last frame and removes the name
+    cursor = 0;
+    ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), 1);
+    frame_ring_close(p);
+    ASSERT_TRUE(frame_ring_open(RING_NAME) == NULL);
+    while (frame_ring_next(r, &cursor, &f) == 1) {}
+    ASSERT_EQ_I(frame_ring_next(r, &cursor, &f), -1);
+    ASSERT_EQ_I(cursor, 7 + SLOTS);
+    frame_ring_close(r);
+
+    // another process produces as fast as it can; every frame that checks out is whole
+    p = frame_ring_create(RING_NAME, W, H, SLOTS);
+    r = frame_ring_open(RING_NAME);
+    ASSERT_TRUE(p != NULL && r != NULL);
+    if (!p || !r) return 1;
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (uint32_t n = 0; n < FORKED_FRAMES; ++n) produce(p, n);
+        frame_ring_close(p);
+        _exit(g_fail ? 1 : 0);
+    }
+    ASSERT_TRUE(pid > 0);
+    int got = 0, rc;
+    uint64_t last = 0;
+    cursor = 0;
+    while ((rc = frame_ring_next(r, &cursor, &f)) >= 0) {
+        if (rc == 0) continue;
+        int whole = uniform(&f, (uint32_t)f.frame);
+        if (frame_ring_check(r, &f)) {
+            ASSERT_TRUE(whole);
+            ASSERT_TRUE(got == 0 || f.frame > last);
+            last = f.frame;
+            ++got;
+        }
+    }
+    int status = 1;
+    if (pid > 0) waitpid(pid, &status, 0);
+    ASSERT_EQ_I(status, 0);
+    ASSERT_TRUE(got > 0);
+    ASSERT_EQ_I(last, FORKED_FRAMES - 1);
+    free(p->name);  // the child owned the producer side; just drop our copy of the handle
+    p->name = NULL;
+    frame_ring_close(p);
+    frame_ring_close(r);
+#else
+    // built without CANVAS_FRAME_RING, or no shared memory on this platform
+    ASSERT_TRUE(frame_ring_create("/canvas_test_ring", W, H, 3) == NULL);
+    ASSERT_TRUE(frame_ring_open("/canvas_test_ring") == NULL);
+#endif // CANVAS_HAS_FRAME_RING
+
+    if (g_fail) {
+        fprintf(stderr, "FAILED (%d assertion%s)\n", g_fail, g_fail == 1 ? "" : "s");
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}
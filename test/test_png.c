@@ -37,13 +37,112 @@ static uint32_t be32(const unsigned char* p) {
     return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | ((uint32_t)p[3]);
 }
 
+typedef struct {
+    uint32_t width, height;
+    int bit_depth, color_type;
+    uint32_t palette[256];
+    uint32_t palette_size, trns_len;
+    unsigned char* raw; // inflated scanlines, including filter bytes
+    size_t raw_len;
+} DecodedPng;
+
+// Walks the chunks (checking CRCs) and inflates the stored-block zlib stream.
+static int decode_png(const char* path, DecodedPng* d) {
+    size_t n = 0;
+    unsigned char* buf = read_all(path, &n);
+    if (!buf || n < 8) return -1;
+    memset(d, 0, sizeof *d);
+    unsigned char* z = (unsigned char*)malloc(n);
+    size_t zlen = 0, p = 8;
+    int ok = 0;
+    while (p + 12 <= n) {
+        uint32_t len = be32(buf + p);
+        const unsigned char* type = buf + p + 4;
+        const unsigned char* data = buf + p + 8;
+        if (p + 12 + len > n || crc32(type, 4 + len) != be32(data + len)) break;
+        if (memcmp(type, "IHDR", 4) == 0) {
+            d->width = be32(data);
+            d->height = be32(data + 4);
+            d->bit_depth = data[8];
+            d->color_type = data[9];
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            d->palette_size = len / 3;
+            for (uint32_t i = 0; i < d->palette_size; ++i) {
+                d->palette[i] = ((uint32_t)data[i * 3] << 24) | ((uint32_t)data[i * 3 + 1] << 16) | ((uint32_t)data[i * 3 + 2] << 8) | 0xFF;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            d->trns_len = len;
+            for (uint32_t i = 0; i < len && i < 256; ++i) d->palette[i] = (d->palette[i] & 0xFFFFFF00u) | data[i];
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            memcpy(z + zlen, data, len);
+            zlen += len;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            ok = (p + 12 == n);
+        }
+        p += 12 + len;
+    }
+    free(buf);
+    if (!ok || zlen < 6) {
+        free(z);
+        return -1;
+    }
+
+    d->raw = (unsigned char*)malloc(zlen);
+    size_t zp = 2;
+    int final = 0;
+    while (!final && zp + 5 <= zlen) {
+        final = z[zp] & 1;
+        size_t blen = (size_t)z[zp + 1] | ((size_t)z[zp + 2] << 8);
+        zp += 5;
+        memcpy(d->raw + d->raw_len, z + zp, blen);
+        d->raw_len += blen;
+        zp += blen;
+    }
+    ok = final && zp + 4 == zlen && adler32(d->raw, d->raw_len) == be32(z + zp);
+    free(z);
+    return ok ? 0 : -1;
+}
+
+static uint32_t decoded_pixel(const DecodedPng* d, uint32_t x, uint32_t y) {
+    static const int channels[7] = {1, 0, 3, 1, 2, 0, 4};
+    size_t row_bytes = ((size_t)d->width * d->bit_depth * channels[d->color_type] + 7) / 8;
+    const unsigned char* row = d->raw + (size_t)y * (1 + row_bytes) + 1;
+    if (d->color_type == 0 || d->color_type == 3) {
+        int per_byte = 8 / d->bit_depth;
+        int shift = 8 - d->bit_depth * (int)(x % per_byte + 1);
+        uint32_t v = (row[x / per_byte] >> shift) & ((1u << d->bit_depth) - 1);
+        if (d->color_type == 3) return v < d->palette_size ? d->palette[v] : 0xDEADBEEF;
+        v = v * 255 / ((1u << d->bit_depth) - 1);
+        return (v << 24) | (v << 16) | (v << 8) | 0xFF;
+    }
+    if (d->color_type == 2) {
+        const unsigned char* q = row + (size_t)x * 3;
+        return ((uint32_t)q[0] << 24) | ((uint32_t)q[1] << 16) | ((uint32_t)q[2] << 8) | 0xFF;
+    }
+    if (d->color_type == 4) {
+        const unsigned char* q = row + (size_t)x * 2;
+        return ((uint32_t)q[0] << 24) | ((uint32_t)q[0] << 16) | ((uint32_t)q[0] << 8) | q[1];
+    }
+    const unsigned char* q = row + (size_t)x * 4;
+    return be32(q);
+}
+
+// one slot per frame, so callbacks on different workers never share one
+static int export_results[8];
+
+static void export_done(void* user, const char* filename, int result) {
+    int* results = (int*)user;
+    const char* digit = filename + strlen(filename) - 5; // "...exportN.png"
+    results[*digit - '0'] = result;
+}
+
 int main() {
     uint32_t px[W * H] = {
         0xFF0000FF, 0x00FF00FF, 0x0000FFFF,
         0x00000000, 0xFFFFFFFF, 0x11223344
     };
     const char* path = "build/tests_out_tiny.png";
-    int rc = write_png_from_rgba32(path, px, W, H);
+    int rc = write_png_from_rgba32_ex(path, px, W, H, PNG_COLOR_RGBA);
     ASSERT_EQ_I(rc, 0);
 
     // Parse the PNG
@@ -145,6 +244,223 @@ int main() {
     // No trailing bytes
     ASSERT_EQ_I((long long)p, (long long)n);
 
+    // Few colours -> palette with 4-bit indices, translucent entries first
+    DecodedPng d;
+    ASSERT_EQ_I(write_png_from_rgba32(path, px, W, H), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 3);
+    ASSERT_EQ_I(d.bit_depth, 4);
+    ASSERT_EQ_I(d.palette_size, 6);
+    ASSERT_EQ_I(d.trns_len, 2);
+    for (uint32_t y = 0; y < H; ++y) {
+        for (uint32_t x = 0; x < W; ++x) {
+            ASSERT_EQ_U32(decoded_pixel(&d, x, y), px[y * W + x]);
+        }
+    }
+    free(d.raw);
+
+    // Two colours -> 1-bit indices, no tRNS when everything is opaque
+    uint32_t* big = (uint32_t*)malloc(64 * 64 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 64 * 64; ++i) big[i] = ((i / 64 + i % 64) & 1) ? 0xFFFFFFFFu : 0x102030FFu;
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 3);
+    ASSERT_EQ_I(d.bit_depth, 1);
+    ASSERT_EQ_I(d.trns_len, 0);
+    ASSERT_EQ_I(d.raw_len, 64 * (1 + 8));
+    ASSERT_EQ_U32(decoded_pixel(&d, 0, 0), 0x102030FFu);
+    ASSERT_EQ_U32(decoded_pixel(&d, 63, 0), 0xFFFFFFFFu);
+    ASSERT_EQ_U32(decoded_pixel(&d, 63, 63), 0x102030FFu);
+    free(d.raw);
+
+    // More than 256 colours: AUTO drops alpha when opaque, INDEXED quantizes
+    for (uint32_t i = 0; i < 64 * 64; ++i) big[i] = RGBA((uint8_t)(i % 64 * 4), (uint8_t)(i / 64 * 4), 0x80, 0xFF);
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 2);
+    ASSERT_EQ_I(d.bit_depth, 8);
+    ASSERT_EQ_U32(decoded_pixel(&d, 5, 7), big[7 * 64 + 5]);
+    free(d.raw);
+
+    big[100] = RGBA(1, 2, 3, 4);
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 6);
+    ASSERT_EQ_U32(decoded_pixel(&d, 100 % 64, 100 / 64), RGBA(1, 2, 3, 4));
+    free(d.raw);
+    big[100] = RGBA(100 % 64 * 4, 100 / 64 * 4, 0x80, 0xFF);
+
+    ASSERT_EQ_I(write_png_from_rgba32_ex(path, big, 64, 64, PNG_COLOR_INDEXED), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 3);
+    ASSERT_EQ_I(d.bit_depth, 8);
+    ASSERT_TRUE(d.palette_size > 128 && d.palette_size <= 256);
+    int max_err = 0;
+    for (uint32_t i = 0; i < 64 * 64; ++i) {
+        uint32_t a = big[i], b = decoded_pixel(&d, i % 64, i / 64);
+        for (int s = 0; s < 32; s += 8) {
+            int e = abs((int)((a >> s) & 0xFF) - (int)((b >> s) & 0xFF));
+            if (e > max_err) max_err = e;
+        }
+    }
+    ASSERT_TRUE(max_err <= 16);
+    free(d.raw);
+
+    // Grayscale: exact 2-bit levels, full 8-bit ramp, and gray + alpha
+    for (uint32_t i = 0; i < 64 * 64; ++i) big[i] = RGB((uint8_t)(i % 4 * 0x55), (uint8_t)(i % 4 * 0x55), (uint8_t)(i % 4 * 0x55));
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 0);
+    ASSERT_EQ_I(d.bit_depth, 2);
+    ASSERT_EQ_I(d.raw_len, 64 * (1 + 16));
+    for (uint32_t x = 0; x < 8; ++x) ASSERT_EQ_U32(decoded_pixel(&d, x, 3), big[3 * 64 + x]);
+    free(d.raw);
+
+    for (uint32_t i = 0; i < 64 * 64; ++i) big[i] = RGB((uint8_t)i, (uint8_t)i, (uint8_t)i);
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 0);
+    ASSERT_EQ_I(d.bit_depth, 8);
+    ASSERT_EQ_U32(decoded_pixel(&d, 17, 9), big[9 * 64 + 17]);
+    free(d.raw);
+
+    for (uint32_t i = 0; i < 64 * 64; ++i) big[i] = RGBA((uint8_t)i, (uint8_t)i, (uint8_t)i, (uint8_t)(i >> 4));
+    ASSERT_EQ_I(write_png_from_rgba32(path, big, 64, 64), 0);
+    ASSERT_EQ_I(decode_png(path, &d), 0);
+    ASSERT_EQ_I(d.color_type, 4);
+    ASSERT_EQ_U32(decoded_pixel(&d, 33, 40), big[40 * 64 + 33]);
+    free(d.raw);
+    free(big);
+
+    // Tiled canvas streams the same bytes as the contiguous encoder, across several IDATs
+    {
+        const uint32_t TW = 300, TH = 290;
+        uint32_t* flat = (uint32_t*)malloc((size_t)TW * TH * sizeof(uint32_t));
+        Canvas fc = create_canvas(TW, TH, flat);
+        TiledCanvas* tc = tiled_canvas_create(TW, TH, RGB(0, 0, 0), 1);
+        clear_background(&fc, RGB(0, 0, 0));
+        for (uint32_t i = 0; i < 40; ++i) {
+            Rectangle r = {i * 7, i * 7, 20, 30};
+            uint32_t color = RGBA((uint8_t)(i * 6), (uint8_t)(255 - i), 9, (uint8_t)(i < 20 ? 255 : 128));
+            canvas_rect_fill(&fc, r, color);
+            tiled_rect_fill(tc, r, color);
+        }
+        const char* tpath = "build/tests_out_tiled.png";
+        const PngColorMode modes[2] = {PNG_COLOR_AUTO, PNG_COLOR_RGBA};
+        for (int m = 0; m < 2; ++m) {
+            ASSERT_EQ_I(write_png_from_rgba32_ex(path, flat, TW, TH, modes[m]), 0);
+            ASSERT_EQ_I(tiled_canvas_write_png(tc, tpath, modes[m]), 0);
+            size_t na = 0, nb = 0;
+            unsigned char* fa = read_all(path, &na);
+            unsigned char* fb = read_all(tpath, &nb);
+            ASSERT_TRUE(fa && fb && na == nb && memcmp(fa, fb, na) == 0);
+            free(fa);
+            free(fb);
+        }
+        ASSERT_EQ_I(decode_png(tpath, &d), 0);
+        ASSERT_EQ_I(d.color_type, 6);
+        ASSERT_EQ_U32(decoded_pixel(&d, 140, 141), flat[141 * TW + 140]);
+        free(d.raw);
+        tiled_canvas_destroy(tc);
+        free(flat);
+    }
+
+    // APNG: full default image, then only the changed rectangle; repeats extend the delay
+    const char* apath = "build/tests_out_anim.png";
+    uint32_t frame[W * H];
+    Canvas fc = create_canvas(W, H, frame);
+    ApngWriter* aw = apng_start(apath, W, H, 25);
+    ASSERT_TRUE(aw != NULL);
+    clear_background(&fc, RGB(0, 0, 0));
+    ASSERT_EQ_I(apng_write_frame(aw, &fc), 0);
+    Rectangle moved = {3, 4, 2, 3};
+    canvas_rect_fill(&fc, moved, RGB(255, 0, 0));
+    ASSERT_EQ_I(apng_write_frame(aw, &fc), 0);
+    ASSERT_EQ_I(apng_write_frame(aw, &fc), 0);
+    canvas_putpixel(&fc, W - 1, H - 1, RGB(0, 255, 0));
+    ASSERT_EQ_I(apng_write_frame(aw, &fc), 0);
+    ASSERT_EQ_I(apng_end(aw), 0);
+
+    unsigned char* anim = read_all(apath, &n);
+    ASSERT_TRUE(anim != NULL);
+    uint32_t expect_seq = 0, fctl_count = 0, fdat_count = 0, idat_count = 0;
+    for (p = 8; anim && p + 12 <= n;) {
+        uint32_t len = be32(anim + p);
+        const unsigned char* type = anim + p + 4;
+        const unsigned char* data = anim + p + 8;
+        ASSERT_EQ_U32(crc32(type, 4 + len), be32(data + len));
+        if (memcmp(type, "acTL", 4) == 0) {
+            ASSERT_EQ_I(be32(data), 3);
+            ASSERT_EQ_I(be32(data + 4), 0);
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            ASSERT_EQ_I(fctl_count, 1); // default image is the first frame
+            idat_count++;
+        } else if (memcmp(type, "fcTL", 4) == 0) {
+            ASSERT_EQ_I(be32(data), expect_seq++);
+            uint32_t fw = be32(data + 4), fh = be32(data + 8), fx = be32(data + 12), fy = be32(data + 16);
+            int delay = (data[20] << 8) | data[21];
+            if (fctl_count == 0) {
+                ASSERT_TRUE(fw == W && fh == H && fx == 0 && fy == 0 && delay == 1);
+            } else if (fctl_count == 1) {
+                ASSERT_TRUE(fw == 2 && fh == 3 && fx == 3 && fy == 4 && delay == 2);
+            } else {
+                ASSERT_TRUE(fw == 1 && fh == 1 && fx == W - 1 && fy == H - 1 && delay == 1);
+            }
+            ASSERT_EQ_I((data[22] << 8) | data[23], 25);
+            fctl_count++;
+        } else if (memcmp(type, "fdAT", 4) == 0) {
+            ASSERT_EQ_I(be32(data), expect_seq++);
+            if (fdat_count == 0) ASSERT_EQ_I(len, 4 + 2 + 5 + 3 * (1 + 2 * 4) + 4);
+            fdat_count++;
+        }
+        p += 12 + len;
+    }
+    ASSERT_EQ_I(p, n);
+    ASSERT_EQ_I(fctl_count, 3);
+    ASSERT_EQ_I(fdat_count, 2);
+    ASSERT_EQ_I(idat_count, 1);
+    free(anim);
+
+    // export queue: copied, borrowed and handed-over frames, a tight budget and a failing path
+    {
+        enum { FRAMES = 6 };
+        PngExportQueue* q = png_export_start(2 * W * H * sizeof(uint32_t), PNG_COLOR_RGBA, export_done, export_results);
+        ASSERT_TRUE(q != NULL);
+        uint32_t scratch[W * H], borrowed[FRAMES][W * H];
+        char path[64];
+        for (int i = 0; i < FRAMES; ++i) {
+            export_results[i] = 99;
+            snprintf(path, sizeof path, "build/tests_out_export%d.png", i);
+            uint32_t color = RGBA((uint8_t)(40 * i), 7, 9, 255);
+            if (i % 3 == 0) {
+                for (int k = 0; k < W * H; ++k) scratch[k] = color;
+                ASSERT_EQ_I(png_export_submit(q, path, scratch, W, H, PNG_EXPORT_COPY), 0);
+                memset(scratch, 0, sizeof scratch); // the queue has its own copy
+            } else if (i % 3 == 1) {
+                for (int k = 0; k < W * H; ++k) borrowed[i][k] = color;
+                ASSERT_EQ_I(png_export_submit(q, path, borrowed[i], W, H, PNG_EXPORT_BORROW), 0);
+            } else {
+                uint32_t* owned = (uint32_t*)malloc(W * H * sizeof(uint32_t));
+                for (int k = 0; k < W * H; ++k) owned[k] = color;
+                ASSERT_EQ_I(png_export_submit(q, path, owned, W, H, PNG_EXPORT_TAKE), 0);
+            }
+        }
+        ASSERT_EQ_I(png_export_wait(q), 0);
+        for (int i = 0; i < FRAMES; ++i) {
+            ASSERT_EQ_I(export_results[i], 0);
+            snprintf(path, sizeof path, "build/tests_out_export%d.png", i);
+            DecodedPng d;
+            ASSERT_EQ_I(decode_png(path, &d), 0);
+            ASSERT_EQ_I(d.color_type, 6);
+            ASSERT_EQ_U32(decoded_pixel(&d, W - 1, H - 1), RGBA((uint8_t)(40 * i), 7, 9, 255));
+            free(d.raw);
+        }
+        export_results[0] = 99;
+        ASSERT_EQ_I(png_export_submit(q, "build/no_such_dir/tests_out_export0.png", scratch, W, H, PNG_EXPORT_BORROW), 0);
+        ASSERT_EQ_I(png_export_end(q), -1);
+        ASSERT_EQ_I(export_results[0], -1);
+    }
+
     if (g_fail) {
         free(buf);
         fprintf(stderr, "FAILED (%d assertion%s)\n", g_fail, g_fail == 1 ? "" : "s");
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CANVASDEF static inline
+#define CANVAS_IMPLEMENTATION
+// a tiny window makes the mapped writer slide and grow the file several times
+#define CANVAS_Y4M_WINDOW 4096u
+#include "../canvas.h"
+
+#include "test.h"
+
+#define FRAMES 20
+
+static unsigned char* read_all(const char* path, size_t* out_len) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    unsigned char* buf = (unsigned char*)malloc((size_t)n);
+    if (!buf) {
+        fclose(f);
+        return NULL;
+    }
+    size_t rd = fread(buf, 1, (size_t)n, f);
+    fclose(f);
+    if (rd != (size_t)n) {
+        free(buf);
+        return NULL;
+    }
+    *out_len = (size_t)n;
+    return buf;
+}
+
+static void draw_frame(Canvas* c, int frame) {
+    clear_background(c, RGB(10, 20, 30));
+    canvas_circle_fill(c, frame % W, H / 2, 3, RGB(255, 255, 0));
+    canvas_putpixel(c, 0, 0, RGB((uint8_t)(frame * 12), 0, 255));
+}
+
+static void write_y4m(Y4MWriter* w, Canvas* c) {
+    for (int i = 0; i < FRAMES; ++i) {
+        draw_frame(c, i);
+        y4m_write_frame(w, c);
+    }
+    y4m_end(w);
+}
+
+static int write_bytes(const char* path, const void* data, size_t n) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+    size_t wr = fwrite(data, 1, n, f);
+    fclose(f);
+    return wr == n ? 0 : -1;
+}
+
+static uint8_t clamp_channel(double v) {
+    v = v + 0.5;
+    return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// float reference of full-range BT.601 for one pixel
+static uint32_t yuv_reference(int y, int u, int v) {
+    return RGB(clamp_channel(y + 1.402 * (v - 128)),
+               clamp_channel(y - 0.344136 * (u - 128) - 0.714136 * (v - 128)),
+               clamp_channel(y + 1.772 * (u - 128)));
+}
+
+// reads every frame of a stream written by write_y4m and checks it against draw_frame
+static void check_read_back(Y4MReader* r, Canvas* c) {
+    static uint32_t want_pix[W * H];
+    Canvas want = create_canvas(W, H, want_pix);
+    ASSERT_TRUE(r != NULL);
+    if (!r) return;
+    ASSERT_EQ_I(r->width, W);
+    ASSERT_EQ_I(r->height, H);
+    ASSERT_EQ_I(r->chroma, Y4M_444);
+    ASSERT_EQ_I(r->fps_num, 30);
+    ASSERT_EQ_I(r->fps_den, 1);
+    for (int i = 0; i < FRAMES; ++i) {
+        ASSERT_EQ_I(y4m_read_frame(r), 1);
+        ASSERT_EQ_I(y4m_frame_to_canvas(r, c), 0);
+        draw_frame(&want, i);
+        // the writer truncates, so allow its rounding error amplified by the chroma gains
+        ASSERT_EQ_I(canvas_diff(c, &want, 3, NULL, NULL), 0);
+    }
+    ASSERT_EQ_I(y4m_read_frame(r), 0);
+    ASSERT_EQ_I(r->frames, FRAMES);
+    y4m_close(r);
+}
+
+int main(void) {
+    uint32_t pix[W * H];
+    Canvas c = create_canvas(W, H, pix);
+
+    const char* header = "YUV4MPEG2 W16 H12 F30:1 Ip A1:1 C444\n";
+    size_t expect = strlen(header) + FRAMES * (6 + 3 * W * H);
+
+    Y4MWriter* w = y4m_start("build/tests_out_stdio.y4m", W, H, 30);
+    ASSERT_TRUE(w != NULL);
+    write_y4m(w, &c);
+
+    // exact preallocation, over-estimated frame count, and growth in extents
+    const char* mapped[3] = {"build/tests_out_mapped.y4m", "build/tests_out_mapped_over.y4m", "build/tests_out_mapped_grow.y4m"};
+    size_t reserve[3] = {FRAMES, FRAMES * 3, 0};
+
+    size_t n_ref = 0;
+    unsigned char* ref = read_all("build/tests_out_stdio.y4m", &n_ref);
+    ASSERT_TRUE(ref != NULL);
+    ASSERT_EQ_I(n_ref, expect);
+    ASSERT_TRUE(ref && memcmp(ref, header, strlen(header)) == 0);
+    ASSERT_TRUE(ref && memcmp(ref + strlen(header), "FRAME\n", 6) == 0);
+
+    for (int i = 0; i < 3; ++i) {
+        w = y4m_start_mapped(mapped[i], W, H, 30, reserve[i]);
+        ASSERT_TRUE(w != NULL);
+        if (!w) continue;
+        write_y4m(w, &c);
+
+        size_t n = 0;
+        unsigned char* buf = read_all(mapped[i], &n);
+        ASSERT_EQ_I(n, expect);
+        ASSERT_TRUE(buf && ref && n == n_ref && memcmp(buf, ref, n) == 0);
+        free(buf);
+    }
+    free(ref);
+
+    // reading back: mapped from a file and streamed block by block from a FILE
+    check_read_back(y4m_open("build/tests_out_mapped.y4m"), &c);
+    FILE* stream = fopen("build/tests_out_stdio.y4m", "rb");
+    ASSERT_TRUE(stream != NULL);
+    check_read_back(y4m_open_stream(stream), &c);
+    if (stream) fclose(stream);
+
+    // subsampled and mono layouts with an odd width, tags and frame parameters
+    {
+        enum { SW = 5, SH = 3 };
+        const char* tags[4] = {"C444", "C422", "C420jpeg", "Cmono"};
+        for (int k = 0; k < 4; ++k) {
+            size_t cw = k == 0 ? SW : k == 3 ? 0 : (SW + 1) / 2;
+            size_t ch = k == 2 ? (SH + 1) / 2 : k == 3 ? 0 : SH;
+            uint8_t data[256];
+            int len = snprintf((char*)data, sizeof data, "YUV4MPEG2 W%d H%d F25:2 Ip A1:1 %s XCOMMENT=1\nFRAME Ixyz\n", SW, SH, tags[k]);
+            uint8_t* planes = data + len;
+            for (size_t i = 0; i < SW * SH; ++i) planes[i] = (uint8_t)(20 + 15 * i);
+            for (size_t i = 0; i < cw * ch; ++i) {
+                planes[SW * SH + i] = (uint8_t)(40 + 37 * i);           // U
+                planes[SW * SH + cw * ch + i] = (uint8_t)(230 - 29 * i); // V
+            }
+            size_t total = (size_t)len + SW * SH + 2 * cw * ch;
+            ASSERT_EQ_I(write_bytes("build/tests_in_layout.y4m", data, total), 0);
+
+            Y4MReader* r = y4m_open("build/tests_in_layout.y4m");
+            ASSERT_TRUE(r != NULL);
+            if (!r) continue;
+            ASSERT_EQ_I(r->chroma, k);
+            ASSERT_EQ_I(r->chroma_width, cw);
+            ASSERT_EQ_I(r->chroma_height, ch);
+            ASSERT_EQ_I(r->fps_num, 25);
+            ASSERT_EQ_I(r->fps_den, 2);
+            ASSERT_EQ_I(y4m_read_frame(r), 1);
+            // zero copy: the planes are the file's bytes
+            ASSERT_TRUE(r->y && memcmp(r->y, planes, SW * SH) == 0);
+            ASSERT_TRUE(k == 3 ? r->u == NULL && r->v == NULL : r->v == r->u + cw * ch);
+
+            uint32_t out[SW * SH];
+            Canvas oc = create_canvas(SW, SH, out);
+            ASSERT_EQ_I(y4m_frame_to_canvas(r, &oc), 0);
+            for (int y = 0; y < SH; ++y) {
+                for (int x = 0; x < SW; ++x) {
+                    size_t ci = k == 0 ? (size_t)(y * SW + x) : k == 1 ? y * cw + x / 2 : (y / 2) * cw + x / 2;
+                    int u = k == 3 ? 128 : planes[SW * SH + ci], v = k == 3 ? 128 : planes[SW * SH + cw * ch + ci];
+                    uint32_t want = yuv_reference(planes[y * SW + x], u, v);
+                    ASSERT_TRUE(canvas__color_within(out[y * SW + x], want, 1));
+                }
+            }
+            ASSERT_EQ_I(y4m_read_frame(r), 0);
+            Canvas wrong = create_canvas(SW - 1, SH, out);
+            ASSERT_EQ_I(y4m_frame_to_canvas(r, &wrong), -1);
+            y4m_close(r);
+        }
+    }
+
+    // malformed input: unsupported layouts, bad sizes, truncated frames
+    {
+        const char* bad[3] = {"YUV4MPEG2 W4 H4 C420p10\n", "YUV4MPEG2 W0 H4\n", "YUV4MPEG1 W4 H4\n"};
+        for (int i = 0; i < 3; ++i) {
+            ASSERT_EQ_I(write_bytes("build/tests_in_bad.y4m", bad[i], strlen(bad[i])), 0);
+            ASSERT_TRUE(y4m_open("build/tests_in_bad.y4m") == NULL);
+        }
+        const char* cut = "YUV4MPEG2 W4 H4 C444\nFRAME\n0123456789";
+        ASSERT_EQ_I(write_bytes("build/tests_in_bad.y4m", cut, strlen(cut)), 0);
+        Y4MReader* r = y4m_open("build/tests_in_bad.y4m");
+        ASSERT_TRUE(r != NULL);
+        ASSERT_EQ_I(y4m_read_frame(r), -1);
+        y4m_close(r);
+        const char* garbage = "YUV4MPEG2 W1 H1 Cmono\nFRAMEX\n0";
+        ASSERT_EQ_I(write_bytes("build/tests_in_bad.y4m", garbage, strlen(garbage)), 0);
+        r = y4m_open("build/tests_in_bad.y4m");
+        ASSERT_EQ_I(y4m_read_frame(r), -1);
+        y4m_close(r);
+        ASSERT_TRUE(y4m_open("build/does/not/exist.y4m") == NULL);
+    }
+
+    if (g_fail) {
+        fprintf(stderr, "FAILED (%d assertion%s)\n", g_fail, g_fail == 1 ? "" : "s");
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}